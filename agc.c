@@ -0,0 +1,162 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "agc.h"
+
+/*******************************************************************************************************/
+size_t agc_arena_size(int channelCount, unsigned long length)
+{
+        size_t size = 0;
+        length = (length < 1 ? 1 : length);
+        size += arena_round(channelCount * length * sizeof(float));
+        size += arena_round(channelCount * (length + 1) * sizeof(float));
+        size += arena_round(channelCount * (length + 1) * sizeof(unsigned long));
+        size += 2 * arena_round(channelCount * sizeof(unsigned long));
+        size += arena_round(channelCount * sizeof(float));
+        return size;
+}
+
+/*******************************************************************************************************/
+int agc_init(agc_t *agc, int channelCount, int linked, float rate, float attack, float release, float window, arena_t *arena)
+{
+        agc->channelCount = channelCount;
+        agc->linked = linked;
+        agc->length = window * rate;
+        agc->length = (agc->length < 1 ? 1 : agc->length);
+        agc->position = 0;
+        agc->attack = 1.0 - exp(-1.0 / (attack * rate));
+        agc->release = 1.0 - exp(-1.0 / (release * rate));
+        agc->limited = 0;
+
+        agc->delay      = arena_alloc(arena, channelCount * agc->length * sizeof(float));
+        agc->dequeValue = arena_alloc(arena, channelCount * (agc->length + 1) * sizeof(float));
+        agc->dequeIndex = arena_alloc(arena, channelCount * (agc->length + 1) * sizeof(unsigned long));
+        agc->head       = arena_alloc(arena, channelCount * sizeof(unsigned long));
+        agc->tail       = arena_alloc(arena, channelCount * sizeof(unsigned long));
+        agc->gain       = arena_alloc(arena, channelCount * sizeof(float));
+
+        if (!agc->delay || !agc->dequeValue || !agc->dequeIndex || !agc->head || !agc->tail || !agc->gain)
+                return -1;
+
+        for (int i = 0; i < channelCount; i++)
+        {
+                agc->head[i] = 0;
+                agc->tail[i] = 0;
+                agc->gain[i] = 1.0;
+        }
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+/* Add a value to the sliding window of one channel and return the maximum over the window,
+   every value enters and leaves the deque only once, so this is O(1) amortized. */
+static float sliding_max(agc_t *agc, int channel, float value)
+{
+        unsigned long capacity = agc->length + 1;
+        float *dequeValue = agc->dequeValue + channel * capacity;
+        unsigned long *dequeIndex = agc->dequeIndex + channel * capacity;
+        unsigned long head = agc->head[channel];
+        unsigned long tail = agc->tail[channel];
+
+        /* remove the candidates that have left the window first, so that at most length+1 remain after the push */
+        while (tail > head && dequeIndex[head % capacity] + agc->length < agc->position)
+                head++;
+
+        /* older candidates that are smaller can never become the maximum again */
+        while (tail > head && dequeValue[(tail - 1) % capacity] <= value)
+                tail--;
+        dequeValue[tail % capacity] = value;
+        dequeIndex[tail % capacity] = agc->position;
+        tail++;
+
+        agc->head[channel] = head;
+        agc->tail[channel] = tail;
+        return dequeValue[head % capacity];
+}
+
+/*******************************************************************************************************/
+static float update_gain(agc_t *agc, float gain, float peak)
+{
+        float target = AGCLEVEL / fmaxf(peak, AGCLEVEL / AGCMAXGAIN);
+
+        /* while the window is being filled for the first time the gain follows the peak directly */
+        if (agc->position < agc->length)
+                return target;
+        else if (target < gain)
+                return gain + agc->attack * (target - gain);
+        else
+                return gain + agc->release * (target - gain);
+}
+
+/*******************************************************************************************************/
+void agc_process(agc_t *agc, const float *input, float *output, unsigned long frames)
+{
+        int channelCount = agc->channelCount;
+
+        for (unsigned long i = 0; i < frames; i++)
+        {
+                const float *in = input + i * channelCount;
+                float *out = output + i * channelCount;
+                float *delay = agc->delay + (agc->position % agc->length) * channelCount;
+
+                if (agc->linked)
+                {
+                        /* a single gain for all channels preserves their relative amplitude */
+                        float peak = 0;
+                        for (int j = 0; j < channelCount; j++)
+                                peak = fmaxf(peak, fabsf(in[j]));
+                        agc->gain[0] = update_gain(agc, agc->gain[0], sliding_max(agc, 0, peak));
+                        for (int j = 1; j < channelCount; j++)
+                                agc->gain[j] = agc->gain[0];
+                }
+                else
+                {
+                        for (int j = 0; j < channelCount; j++)
+                                agc->gain[j] = update_gain(agc, agc->gain[j], sliding_max(agc, j, fabsf(in[j])));
+                }
+
+                for (int j = 0; j < channelCount; j++)
+                {
+                        /* the delayed sample is replaced by the new one */
+                        float value = delay[j] * agc->gain[j];
+                        delay[j] = in[j];
+
+                        /* the look-ahead should prevent this, except for very fast transients */
+                        if (fabsf(value) > 1.0f)
+                        {
+                                value = copysignf(1.0f, value);
+                                agc->limited++;
+                        }
+                        out[j] = value;
+                }
+
+                agc->position++;
+        }
+}
+
+/*******************************************************************************************************/
+void agc_range(agc_t *agc, float *lower, float *upper)
+{
+        *lower = agc->gain[0];
+        *upper = agc->gain[0];
+        for (int j = 1; j < agc->channelCount; j++)
+        {
+                *lower = fminf(*lower, agc->gain[j]);
+                *upper = fmaxf(*upper, agc->gain[j]);
+        }
+}
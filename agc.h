@@ -0,0 +1,53 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef AGC_H
+#define AGC_H
+
+#include "arena.h"
+
+#define AGCLEVEL      (0.9)   // target peak level of the output
+#define AGCMAXGAIN    (1e6)   // upper limit of the gain, for flat channels
+
+/* Automatic gain control with a look-ahead peak limiter. The input is delayed by the window
+   length, and the peak over the window is tracked with a monotonic deque, so that the gain can
+   already be reduced before a peak reaches the output. The state is stored per channel, or
+   once for all channels if they are linked. */
+typedef struct {
+        int channelCount;
+        int linked;
+        unsigned long length;           /* window length in samples, which is also the look-ahead */
+        unsigned long position;         /* number of samples processed so far */
+        float attack;                   /* smoothing coefficient when the gain decreases */
+        float release;                  /* smoothing coefficient when the gain increases */
+        float *delay;                   /* delay line, length samples per channel */
+        float *dequeValue;              /* monotonic deque with the peak candidates, length+1 per channel */
+        unsigned long *dequeIndex;      /* sample number of each peak candidate */
+        unsigned long *head;            /* index of the first element in the deque of each channel */
+        unsigned long *tail;            /* index after the last element in the deque of each channel */
+        float *gain;                    /* current gain of each channel */
+        unsigned long limited;          /* number of samples that had to be clipped */
+} agc_t;
+
+/* Return the number of bytes that the AGC needs from the arena. */
+size_t agc_arena_size(int channelCount, unsigned long length);
+
+/* Set up the AGC, attack, release and window are in seconds. */
+int agc_init(agc_t *agc, int channelCount, int linked, float rate, float attack, float release, float window, arena_t *arena);
+
+/* Process interleaved samples, the output is delayed by the window length. */
+void agc_process(agc_t *agc, const float *input, float *output, unsigned long frames);
+
+/* Return the smallest and largest gain over all channels. */
+void agc_range(agc_t *agc, float *lower, float *upper);
+
+#endif
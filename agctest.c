@@ -0,0 +1,80 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "agc.h"
+
+/* This checks the sliding maximum of the AGC against a brute force maximum over the same window,
+   with input that decreases monotonically, which keeps every value in the deque, and with random
+   input. With a very short attack and release the gain follows the peak directly, hence the peak
+   can be recovered from the gain. */
+
+#define FRAMES (1000)
+
+/*******************************************************************************************************/
+int check(unsigned long length, int decreasing)
+{
+        float input[FRAMES], output[FRAMES];
+        arena_t arena;
+        agc_t agc;
+        int errors = 0;
+
+        if (arena_init(&arena, agc_arena_size(1, length)) || agc_init(&agc, 1, 0, length, 1e-9, 1e-9, 1, &arena))
+        {
+                printf("ERROR: Cannot set up the AGC.\n");
+                return 1;
+        }
+
+        srand(length);
+        for (int i = 0; i < FRAMES; i++)
+                input[i] = (decreasing ? FRAMES - i : rand() % 100 + 1);
+
+        for (int i = 0; i < FRAMES; i++)
+        {
+                agc_process(&agc, input + i, output + i, 1);
+
+                /* the window consists of the newest value and the length values before it */
+                float peak = 0;
+                for (int k = (i > length ? i - length : 0); k <= i; k++)
+                        peak = fmaxf(peak, input[k]);
+
+                if (agc.tail[0] - agc.head[0] > length + 1 || fabsf(agc.gain[0] * peak / AGCLEVEL - 1) > 1e-4)
+                {
+                        printf("ERROR: length %lu, %s input, frame %d: gain %g instead of %g, deque %lu to %lu\n",
+                               length, decreasing ? "decreasing" : "random", i, agc.gain[0], AGCLEVEL / peak, agc.head[0], agc.tail[0]);
+                        errors++;
+                        break;
+                }
+        }
+
+        arena_free(&arena);
+        return errors;
+}
+
+/*******************************************************************************************************/
+int main(int argc, char *argv[])
+{
+        unsigned long lengths[] = {1, 2, 3, 7, 64};
+        int errors = 0;
+
+        for (int i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+        {
+                errors += check(lengths[i], 1);
+                errors += check(lengths[i], 0);
+        }
+
+        printf("%s\n", errors ? "FAILED" : "PASSED");
+        return (errors ? EXIT_FAILURE : EXIT_SUCCESS);
+}
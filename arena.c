@@ -0,0 +1,210 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#include <unistd.h>
+#include <sys/mman.h>
+#elif defined _WIN32
+// Windows code goes here
+#include <windows.h>
+#endif
+
+#include "arena.h"
+
+#define HUGEPAGE      (2*1024*1024)
+
+/*******************************************************************************************************/
+int arena_init(arena_t *arena, size_t size)
+{
+        arena->base = NULL;
+        arena->used = 0;
+        arena->hugepages = 0;
+        arena->sealed = 0;
+
+#if defined __linux__
+        /* try explicit huge pages first, these are only available if the system has reserved them */
+        arena->size = (size + HUGEPAGE - 1) & ~((size_t)HUGEPAGE - 1);
+        arena->base = mmap(NULL, arena->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (arena->base == MAP_FAILED)
+        {
+                /* fall back to normal pages and ask for transparent huge pages */
+                arena->base = mmap(NULL, arena->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (arena->base == MAP_FAILED)
+                {
+                        arena->base = NULL;
+                        return -1;
+                }
+                madvise(arena->base, arena->size, MADV_HUGEPAGE);
+        }
+        else
+                arena->hugepages = 1;
+#elif defined __APPLE__
+        arena->size = (size + HUGEPAGE - 1) & ~((size_t)HUGEPAGE - 1);
+        arena->base = mmap(NULL, arena->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (arena->base == MAP_FAILED)
+        {
+                arena->base = NULL;
+                return -1;
+        }
+#elif defined _WIN32
+        arena->size = size;
+        arena->base = VirtualAlloc(NULL, arena->size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (arena->base == NULL)
+                return -1;
+#endif
+
+#if defined __linux__ || defined __APPLE__
+        /* keep the arena resident, this is allowed to fail for unprivileged users */
+        mlock(arena->base, arena->size);
+#endif
+
+        /* touch all pages, so that no page faults happen on the real-time path */
+        memset(arena->base, 0, arena->size);
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+void *arena_alloc(arena_t *arena, size_t size)
+{
+        void *ptr;
+
+        if (arena->sealed)
+        {
+#ifdef ARENA_DEBUG
+                fprintf(stderr, "ERROR: Allocation of %zu bytes from a sealed arena.\n", size);
+                abort();
+#endif
+                return NULL;
+        }
+
+        size = arena_round(size);
+        if (arena->base == NULL || arena->used + size > arena->size)
+                return NULL;
+
+        ptr = arena->base + arena->used;
+        arena->used += size;
+        return ptr;
+}
+
+/*******************************************************************************************************/
+void arena_seal(arena_t *arena)
+{
+        arena->sealed = 1;
+}
+
+/*******************************************************************************************************/
+void arena_free(arena_t *arena)
+{
+        if (arena->base == NULL)
+                return;
+
+#if defined __linux__ || defined __APPLE__
+        munlock(arena->base, arena->size);
+        munmap(arena->base, arena->size);
+#elif defined _WIN32
+        VirtualFree(arena->base, 0, MEM_RELEASE);
+#endif
+
+        arena->base = NULL;
+        arena->size = 0;
+        arena->used = 0;
+}
+
+/*******************************************************************************************************/
+#if defined ARENA_DEBUG && defined __GLIBC__
+
+/* In the debug build the allocation functions of the C library are interposed, so that any
+   heap allocation on a thread that is inside a real-time section can be caught. */
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void *__libc_memalign(size_t, size_t);
+
+static _Thread_local int realtime = 0;
+
+static void check_realtime(void)
+{
+        static const char message[] = "ERROR: Heap allocation on the real-time path.\n";
+        if (realtime)
+        {
+                /* do not use printf here, since that might allocate itself */
+                write(2, message, sizeof(message) - 1);
+                abort();
+        }
+}
+
+void *malloc(size_t size)
+{
+        check_realtime();
+        return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+        check_realtime();
+        return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+        check_realtime();
+        return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+        check_realtime();
+        return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+        check_realtime();
+        return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+        check_realtime();
+        *ptr = __libc_memalign(alignment, size);
+        return (*ptr == NULL) ? ENOMEM : 0;
+}
+
+void arena_enter_realtime(void)
+{
+        realtime = 1;
+}
+
+void arena_leave_realtime(void)
+{
+        realtime = 0;
+}
+
+#else
+
+void arena_enter_realtime(void)
+{
+}
+
+void arena_leave_realtime(void)
+{
+}
+
+#endif
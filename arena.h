@@ -0,0 +1,50 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* all blocks that are carved from the arena start on a cache line */
+#define ARENA_ALIGN   (64)
+
+/* round a size up to the next multiple of the cache line */
+#define arena_round(size) ((((size_t)(size)) + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1))
+
+typedef struct {
+        char *base;
+        size_t size;
+        size_t used;
+        short hugepages;
+        short sealed;
+} arena_t;
+
+/* Reserve a single block of memory from which all pipeline buffers are carved. This is
+   called once at startup, the size should be computed with arena_round() for each buffer. */
+int arena_init(arena_t *arena, size_t size);
+
+/* Return a zeroed and cache-line aligned block, or NULL if the arena is exhausted or sealed. */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/* Mark the arena as complete, after this no more blocks can be carved from it. */
+void arena_seal(arena_t *arena);
+
+/* Release the memory of the arena. */
+void arena_free(arena_t *arena);
+
+/* Mark the code that runs on the real-time path, e.g. the audio callbacks. When compiled
+   with ARENA_DEBUG, any heap allocation in between these two calls aborts the program. */
+void arena_enter_realtime(void);
+void arena_leave_realtime(void);
+
+#endif
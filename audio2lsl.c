@@ -14,6 +14,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <stdatomic.h>
 
 #if defined __linux__ || defined __APPLE__
 // Linux and macOS code goes here
@@ -27,12 +28,26 @@
 #include "portaudio.h"
 #include "samplerate.h"
 #include "lsl_c.h"
+#include "arena.h"
+#include "chanmap.h"
+#include "resampler.h"
+#include "control.h"
+#include "options.h"
+#include "recorder.h"
+#include "replay.h"
+#include "thread.h"
+#include "governor.h"
+#include "ledger.h"
+#include "planner.h"
+#include "device.h"
+#include "ring.h"
+#include "seqlock.h"
+#include "trace.h"
 
 /* Helper function to generate random UID string. */
 void rand_str(char *, size_t);
 
 #define STRLEN        (80)
-#define SAMPLETYPE    paFloat32
 #define BLOCKSIZE     (0.01)  // in seconds
 #define BUFFERSIZE    (2.00)  // in seconds
 #define DEFAULTRATE   (44100.0)
@@ -41,57 +56,175 @@ void rand_str(char *, size_t);
 #define LSLSTREAM     "Audio"
 #define LSLTYPE       "EEG"
 #define LSLBUFFER     (360)
+#define CROSSFADE     (0.05)  // in seconds
+#define OUTLETCOUNT   (8)     // maximum number of LSL outlets
+#define PUSHINTERVAL  (1)     // in milliseconds, how often the push thread checks the queues
 
 typedef struct {
         float *data;
         unsigned long frames;
 } dataBuffer_t;
 
-dataBuffer_t inputData, outputData;
-lsl_outlet outlet;
-
-SRC_STATE* resampleState = NULL;
-SRC_DATA resampleData;
+/* Each outlet taps the decimation tree after a number of halfband stages, and has its own
+   fractional resampling stage to arrive at its exact rate. The resampled frames are queued by the
+   callback and pushed to LSL in chunks by a separate thread. Each frame carries the capture time
+   of the audio that it corresponds to, corrected for the delay of the halfband stages. */
+typedef struct {
+        double rate;
+        int depth;                      /* number of halfband stages in front of the resampler */
+        dataBuffer_t inputData, outputData;
+        int inputBufsize, outputBufsize;
+        resampler_t resampler;
+        SRC_DATA resampleData;
+        double resampleRatio;
+        ledger_t ledger[3];             /* the frames that pass through the decimation, the resampler and the queue */
+        seqlock_t stats;                /* the ledgers, published by the callback for the main loop */
+        double delay;                   /* group delay of the halfband stages and of the resampler */
+        double position;                /* input frame of the resampler that corresponds to the next output frame */
+        double *outputTime;             /* capture time of each frame in outputData */
+        ring_t queue;                   /* the frames and their capture time, from the callback to the push thread */
+        atomic_ulong dropped;           /* frames that did not fit in the queue */
+        float *chunk;                   /* contiguous copy of the frames that are pushed */
+        double *chunkTime;              /* capture time of each frame in the chunk */
+        double waiting;                 /* time at which the push thread first saw the oldest queued frame */
+        atomic_ulong chunkCounter;      /* written by the push thread */
+        lsl_outlet outlet;
+} outlet_t;
+
+arena_t arena;
+outlet_t outlets[OUTLETCOUNT];
+int outletCount = 0;
+
+/* the halfband stages are shared by all outlets, level 0 holds the input block after the channel selection */
+plan_t plan;
+
+chanmap_t chanmap;
+governor_t governor;
+tap_t inputTap, outputTap, ratioTap;
+replay_t replay;
+float *replayData = NULL;
 int srcErr;
 
-float inputRate, outputRate, resampleRatio;
-short keepRunning = 1;
-int channelCount, inputBlocksize, outputBlocksize, inputBufsize, outputBufsize;
-unsigned long inputCounter = 0, outputCounter = 0;
+double inputRate;
+/* State that is shared between the callback, the replay and push threads, and the main and control
+   threads. Both are single values without dependent data, hence relaxed. The frames are passed
+   to the push thread through the queue of each outlet. */
+struct {
+        atomic_int keepRunning;
+        _Atomic double ratioTarget;
+} shared = {1, 0};
+int channelCount, inputBlocksize;
+uint64_t inputFrames = 0;               /* total number of frames that entered the decimation tree */
+
+/* the capture is shared by all outlets, the push thread passes on every frame in the queue */
+#define STAGECOUNT (4)
+SEQLOCK_FITS(STAGECOUNT * sizeof(ledger_t));
+const char *stageName[STAGECOUNT] = {"capture", "decimate", "resample", "queue"};
+ledger_t capture;
+seqlock_t captureLedger;
+int pushChunk;
+double pushLatency;
 
 /*******************************************************************************************************/
-int output_lsl(void)
+int queue_output(outlet_t *out)
 {
-        for (int sample=0; sample<outputData.frames; sample++)
+        unsigned long frames = out->outputData.frames;
+
+        /* the push thread is too slow, the newest frames are dropped */
+        if (frames > ring_space(&out->queue))
         {
-                /* write the available output samples to LSL */
-                float *dat = outputData.data + sample * channelCount * sizeof(float);
-                lsl_push_sample_f(outlet, dat);
+                TRACE_INSTANT("queue overflow");
+                atomic_fetch_add_explicit(&out->dropped, frames, memory_order_relaxed);
+                ledger_add(&out->ledger[2], frames, 0, 1);
+                out->outputData.frames = 0;
+                return -1;
         }
-        outputData.frames = 0;
+
+        ring_write(&out->queue, out->outputData.data, out->outputTime, frames);
+        ledger_add(&out->ledger[2], frames, frames, 1);
+
+        out->outputData.frames = 0;
+        return 0;
+}
+
+/*******************************************************************************************************/
+int output_lsl(outlet_t *out, int flush)
+{
+        unsigned long frames = ring_count(&out->queue);
+        double now = thread_now();
+
+        if (frames == 0)
+                return 0;
+        if (out->waiting == 0)
+                out->waiting = now;
+
+        /* without a policy every frame is pushed as soon as possible, otherwise when the chunk is
+           complete or when the oldest frame has been waiting too long */
+        int push = (pushChunk == 0 && pushLatency == 0);
+        push |= (pushChunk > 0 && frames >= pushChunk);
+        push |= (pushLatency > 0 && now - out->waiting >= pushLatency);
+        if (!push && !flush)
+                return 0;
+
+        frames = ring_read(&out->queue, out->chunk, out->chunkTime, frames);
+        out->waiting = 0;
+
+        if (out == &outlets[0])
+                tap_write(&outputTap, out->chunkTime[0], out->chunk, frames);
+
+        /* write the available output samples to LSL, liblsl derives the timestamps of the others from the last one */
+        TRACE_BEGIN("lsl push");
+        lsl_push_chunk_ft(out->outlet, out->chunk, frames * channelCount, out->chunkTime[frames - 1]);
+        TRACE_END("lsl push");
+        atomic_fetch_add_explicit(&out->chunkCounter, 1, memory_order_relaxed);
 
         return 0;
 }
 
 /*******************************************************************************************************/
-int resample_buffers(void)
+/* Pushing to LSL is not real-time safe, since liblsl allocates internally. */
+static void *push_thread(void *arg)
 {
-        resampleData.src_ratio      = resampleRatio;
-        resampleData.end_of_input   = 0;
-        resampleData.data_in        = inputData.data;
-        resampleData.input_frames   = inputData.frames;
-        resampleData.data_out       = outputData.data + outputData.frames * channelCount;
-        resampleData.output_frames  = outputBufsize - outputData.frames;
+        TRACE_THREAD("push thread");
+        while (atomic_load_explicit(&shared.keepRunning, memory_order_relaxed))
+        {
+                for (int i = 0; i < outletCount; i++)
+                        output_lsl(&outlets[i], 0);
+                thread_sleep(PUSHINTERVAL);
+        }
+
+        /* push the remaining frames */
+        for (int i = 0; i < outletCount; i++)
+                output_lsl(&outlets[i], 1);
+
+        return NULL;
+}
+
+/*******************************************************************************************************/
+int resample_buffers(outlet_t *out, double adcTime)
+{
+        /* an explicit ratio applies to the first outlet, the other outlets follow proportionally */
+        double ratioTarget = atomic_load_explicit(&shared.ratioTarget, memory_order_relaxed);
+        double scale = (ratioTarget > 0 ? ratioTarget / outlets[0].resampleRatio : 1.0);
+
+        out->resampleData.src_ratio      = out->resampleRatio * scale;
+        out->resampleData.end_of_input   = 0;
+        out->resampleData.data_in        = out->inputData.data;
+        out->resampleData.input_frames   = out->inputData.frames;
+        out->resampleData.data_out       = out->outputData.data + out->outputData.frames * channelCount;
+        out->resampleData.output_frames  = out->outputBufsize - out->outputData.frames;
 
         /* check whether there is data in the input buffer */
-        if (inputData.frames==0)
+        if (out->inputData.frames==0)
                 return 0;
 
         /* check whether there is room for new data in the output buffer */
-        if (outputData.frames==outputBufsize)
+        if (out->outputData.frames==out->outputBufsize)
                 return 0;
 
-        int srcErr = src_process (resampleState, &resampleData);
+        TRACE_BEGIN("resample");
+        int srcErr = resampler_process (&out->resampler, &out->resampleData);
+        TRACE_END("resample");
         if (srcErr)
         {
                 printf("ERROR: Cannot resample the input data\n");
@@ -100,21 +233,28 @@ int resample_buffers(void)
         }
 
         /* the input data buffer decreased */
-        size_t len = (inputData.frames - resampleData.input_frames_used) * channelCount * sizeof(float);
-        memcpy(inputData.data, inputData.data + resampleData.input_frames_used * channelCount, len);
-        inputData.frames -= resampleData.input_frames_used;
+        size_t len = (out->inputData.frames - out->resampleData.input_frames_used) * channelCount * sizeof(float);
+        memcpy(out->inputData.data, out->inputData.data + out->resampleData.input_frames_used * channelCount, len);
+        out->inputData.frames -= out->resampleData.input_frames_used;
+
+        /* an output frame corresponds to an input frame of the decimation tree and hence to a capture time,
+           from which the group delay of the halfband stages and of the resampler is subtracted */
+        for (unsigned long i = 0; i < out->resampleData.output_frames_gen; i++)
+        {
+                double frame = (out->position + i / out->resampleData.src_ratio) * (1 << out->depth);
+                out->outputTime[out->outputData.frames + i] = adcTime + (frame - inputFrames) / inputRate - out->delay;
+        }
+        out->position += out->resampleData.output_frames_gen / out->resampleData.src_ratio;
 
         /* the output data buffer increased */
-        outputData.frames += resampleData.output_frames_gen;
+        out->outputData.frames += out->resampleData.output_frames_gen;
 
         /* keep track of how many samples were converted */
-        inputCounter += resampleData.input_frames_used;
-        outputCounter += resampleData.output_frames_gen;
+        ledger_add(&out->ledger[1], out->resampleData.input_frames_used, out->resampleData.output_frames_gen, out->resampleData.src_ratio);
 
         return 0;
 }
 
-
 /*******************************************************************************************************/
 static int input_callback( const void *input,
                            void *output,
@@ -124,57 +264,223 @@ static int input_callback( const void *input,
                            void *userData )
 {
         float *data = (float *)input;
-        dataBuffer_t *inputData = (dataBuffer_t *)userData;
-        unsigned int newFrames = min(frameCount, inputBufsize - inputData->frames);
+        unsigned long blockFrames = min(frameCount, inputBlocksize), newFrames;
+
+        double start = thread_now();
+        arena_enter_realtime();
+        TRACE_THREAD("input callback");
+        TRACE_BEGIN("input callback");
+        if (statusFlags & paInputOverflow)
+                TRACE_INSTANT("input overflow");
+
+        /* the capture time of the first frame, expressed in the LSL clock; a replay passes the recorded one */
+        double adcTime = timeInfo->inputBufferAdcTime;
+        if (userData == NULL)
+        {
+                adcTime = lsl_local_clock();
+                if (timeInfo->inputBufferAdcTime > 0 && timeInfo->currentTime > timeInfo->inputBufferAdcTime)
+                        adcTime -= timeInfo->currentTime - timeInfo->inputBufferAdcTime;
+        }
+
+        tap_write(&inputTap, adcTime, data, frameCount);
+
+        /* the channels are selected once for all outlets, frames beyond a block are dropped */
+        chanmap_apply(&chanmap, data, plan.data[0], blockFrames);
+        ledger_add(&capture, frameCount, blockFrames, 1);
+        seqlock_write(&captureLedger, &capture, sizeof(capture));
+
+        /* each stage of the decimation tree is computed only once */
+        plan_decimate(&plan, blockFrames);
+
+        for (int i = 0; i < outletCount; i++)
+        {
+                outlet_t *out = &outlets[i];
+                newFrames = min(plan.frames[out->depth], out->inputBufsize - out->inputData.frames);
+                memcpy(out->inputData.data + out->inputData.frames * channelCount, plan.data[out->depth], newFrames * channelCount * sizeof(float));
+                out->inputData.frames += newFrames;
+                ledger_add(&out->ledger[0], blockFrames, newFrames, 1.0 / (1 << out->depth));
+
+                /* the data can be resampled and handed over to the push thread immediately */
+                resample_buffers(out, adcTime);
+                queue_output(out);
+                seqlock_write(&out->stats, out->ledger, sizeof(out->ledger));
+        }
+        inputFrames += blockFrames;
 
-        size_t len = newFrames * channelCount * sizeof(float);
-        memcpy(inputData->data + inputData->frames * channelCount, data, len);
-        inputData->frames += newFrames;
+        float queued = ring_count(&outlets[0].queue);
+        float ratio[2] = {outlets[0].resampleData.src_ratio, queued};
+        tap_write(&ratioTap, adcTime, ratio, 1);
 
-        /* the data can be resampled and streamed out immediately */
-        resample_buffers();
-        output_lsl();
+        TRACE_END("input callback");
+        arena_leave_realtime();
+        governor_measure(&governor, thread_now() - start, (double)frameCount / inputRate);
 
         return paContinue;
 }
 
 /*******************************************************************************************************/
-void stream_finished(void *userData)
+/* The converters are only changed by the main thread, on request of the user or by the governor. */
+void update_converter(void)
+{
+        int converter = governor_update(&governor, thread_now());
+        for (int i = 0; i < outletCount; i++)
+        {
+                if (converter == resampler_get_converter(&outlets[i].resampler))
+                        continue;
+
+                /* if the previous change is still in progress, this is tried again the next time */
+                int err = resampler_set_converter(&outlets[i].resampler, converter);
+                if (err > 0)
+                        printf("ERROR: %s\n", src_strerror(err));
+                else if (err == 0)
+                        TRACE_INSTANT("converter");
+        }
+}
+
+/*******************************************************************************************************/
+/* The recorded blocks are passed to the same callback as the live audio. */
+static void *replay_thread(void *arg)
+{
+        PaStreamCallbackTimeInfo timeInfo = {0, 0, 0};
+        unsigned long frames;
+
+        /* the recorded capture times are in the LSL clock and are pushed unchanged */
+        while (atomic_load_explicit(&shared.keepRunning, memory_order_relaxed) && (frames = replay_read(&replay, replayData, inputBlocksize, &timeInfo.inputBufferAdcTime)) > 0)
+        {
+                timeInfo.currentTime = timeInfo.inputBufferAdcTime;
+                input_callback(replayData, NULL, frames, &timeInfo, 0, &replay);
+        }
+
+        printf("End of the recording.\n");
+        atomic_store_explicit(&shared.keepRunning, 0, memory_order_relaxed);
+        return NULL;
+}
+
+/*******************************************************************************************************/
+/* Copy the most recent ledgers of an outlet, preceded by that of the capture. */
+void read_ledger(outlet_t *out, ledger_t *ledger)
 {
-        keepRunning = 0;
-        return;
+        seqlock_read(&captureLedger, ledger, sizeof(ledger_t));
+        seqlock_read(&out->stats, ledger + 1, 3 * sizeof(ledger_t));
+}
+
+/*******************************************************************************************************/
+int control_handler(const char *command, const char *argument)
+{
+        if (strcmp(command, "help") == 0)
+        {
+                printf("ratio <value>          set the resampling ratio of the first outlet, 0 for outputRate/inputRate\n");
+                printf("channels <spec>        select or combine input channels, e.g. 3,0:2,4-5,0.5*6+0.5*7\n");
+                printf("converter <name>       switch to the best, medium, fastest, zoh or linear converter\n");
+                printf("trace <filename>       write the most recent trace events to a JSON file\n");
+                printf("counters               show the frames that passed through each stage\n");
+        }
+        else if (strcmp(command, "ratio") == 0)
+        {
+                double ratioTarget = atof(argument);
+                atomic_store_explicit(&shared.ratioTarget, ratioTarget, memory_order_relaxed);
+                printf("Changed resampleRatio to %f\n", ratioTarget > 0 ? ratioTarget : outlets[0].resampleRatio);
+        }
+        else if (strcmp(command, "channels") == 0)
+        {
+                int err = chanmap_set(&chanmap, argument);
+                if (err == -3)
+                        printf("ERROR: The previous change is still in progress.\n");
+                else if (err == -2)
+                        printf("ERROR: Channel number out of range.\n");
+                else if (err)
+                        printf("ERROR: Invalid channel specification.\n");
+                else
+                        printf("Changed channels to %s\n", argument);
+                return err;
+        }
+        else if (strcmp(command, "converter") == 0)
+        {
+                int converter = control_parse_converter(argument);
+                if (converter < 0)
+                {
+                        printf("ERROR: Unknown converter '%s'.\n", argument);
+                        return -1;
+                }
+                /* the main thread changes the converters, the governor may lower the quality below this */
+                governor_select(&governor, converter);
+                printf("Changed to %s rate converter\n", src_get_name(converter));
+                return 0;
+        }
+        else if (strcmp(command, "counters") == 0)
+        {
+                for (int i = 0; i < outletCount; i++)
+                {
+                        ledger_t ledger[STAGECOUNT];
+                        read_ledger(&outlets[i], ledger);
+                        printf("Outlet at %.0f Hz\n", outlets[i].rate);
+                        ledger_print(stageName, ledger, STAGECOUNT, outlets[i].rate / inputRate);
+                }
+        }
+        else if (strcmp(command, "trace") == 0)
+        {
+                if (trace_dump(argument))
+                {
+                        printf("ERROR: Cannot write the trace, tracing requires compiling with TRACE.\n");
+                        return -1;
+                }
+                printf("Wrote the trace to %s\n", argument);
+        }
+        else
+        {
+                printf("ERROR: Unknown command '%s', type 'help' for a list of commands.\n", command);
+                return -1;
+        }
+
+        return 0;
 }
 
 /*******************************************************************************************************/
 int main(int argc, char *argv[]) {
         char line[STRLEN];
+        size_t arenaSize;
+        const char *channelSpec = option_get(argc, argv, "channels");
+        const char *recordPrefix = option_get(argc, argv, "record");
+        const char *replayFile = option_get(argc, argv, "replay");
+        const char *rateSpec = option_get(argc, argv, "rates");
+        int enableGovernor = (option_get(argc, argv, "governor") != NULL);
+        int maxDepth = (option_get(argc, argv, "single-stage") ? 0 : HALFBANDSTAGES);
+        int fixedPoint = (option_get(argc, argv, "fixed-point") != NULL);
+        double rates[OUTLETCOUNT];
+        int depth[OUTLETCOUNT];
+        float replaySpeed = option_number(argc, argv, "replay-speed", 1);
+        pushChunk = option_number(argc, argv, "push-chunk", 0);
+        pushLatency = option_number(argc, argv, "push-latency", 0) / 1000;
+        thread_t replayThread, pushThread;
+        int replayStarted = 0, pushStarted = 0;
+        int inputChannelCount;
         float blockSize;
 
         /* variables that are specific for PortAudio */
         unsigned int inputDevice;
-        PaStream *inputStream;
-        PaStreamParameters inputParameters;
+        device_t inputStream = {NULL};
+        device_t *devices[1] = {&inputStream};
         PaError paErr = paNoError;
         unsigned int numDevices;
         const PaDeviceInfo *deviceInfo;
 
         /* variables that are specific for LSL */
-        char outputStream[STRLEN], outputUID[STRLEN];
-        int lslErr = 0;
+        char outputStream[STRLEN], outputName[STRLEN], outputUID[STRLEN];
 
         /* STAGE 1: Initialize the audio input and output. */
 
+        /* the status lines are passed on as they are printed when running under the supervisor */
+        setvbuf(stdout, NULL, _IOLBF, 0);
+
         printf("PortAudio version: 0x%08X\n", Pa_GetVersion());
 
         printf("Block size in seconds [%.4f]: ", BLOCKSIZE);
-        fgets(line, STRLEN, stdin);
+        option_prompt(argc, argv, "block-size", line, STRLEN);
         if (strlen(line) == 1)
                 blockSize = BLOCKSIZE;
         else
                 blockSize = atof(line);
 
-        inputParameters.device = paNoDevice;
-
         /* Initialize library before making any other calls. */
         paErr = Pa_Initialize();
         if( paErr != paNoError )
@@ -192,179 +498,351 @@ int main(int argc, char *argv[]) {
                 goto cleanup1;
         }
 
-        printf("Number of host APIs = %d\n", Pa_GetHostApiCount());
-        printf("Number of devices = %d\n", numDevices);
-        for( int i=0; i<numDevices; i++ )
+        if (replayFile)
         {
-                deviceInfo = Pa_GetDeviceInfo( i );
-                if (Pa_GetHostApiCount()==1)
-                        printf("device %2d - %s (%d in, %d out)\n", i,
-                               deviceInfo->name,
-                               deviceInfo->maxInputChannels,
-                               deviceInfo->maxOutputChannels  );
-                else
-                        printf("device %2d - %s - %s (%d in, %d out)\n", i,
-                               Pa_GetHostApiInfo(deviceInfo->hostApi)->name,
-                               deviceInfo->name,
-                               deviceInfo->maxInputChannels,
-                               deviceInfo->maxOutputChannels);
+                /* the input comes from a recording instead of from an audio device */
+                if (replay_open(&replay, replayFile, replaySpeed))
+                {
+                        printf("ERROR: Cannot open recording '%s'.\n", replayFile);
+                        goto cleanup1;
+                }
+                inputRate = replay.header.rate;
+                inputChannelCount = replay.header.channelCount;
+                printf("Replaying %d channels at %.0f Hz from %s\n", inputChannelCount, inputRate, replayFile);
         }
-
-        printf("Select input device [%d]: ", Pa_GetDefaultInputDevice());
-        fgets(line, STRLEN, stdin);
-        if (strlen(line)==1)
-                inputDevice = Pa_GetDefaultInputDevice();
         else
-                inputDevice = atoi(line);
+        {
+                printf("Number of host APIs = %d\n", Pa_GetHostApiCount());
+                printf("Number of devices = %d\n", numDevices);
+                for( int i=0; i<numDevices; i++ )
+                {
+                        deviceInfo = Pa_GetDeviceInfo( i );
+                        if (Pa_GetHostApiCount()==1)
+                                printf("device %2d - %s (%d in, %d out)\n", i,
+                                       deviceInfo->name,
+                                       deviceInfo->maxInputChannels,
+                                       deviceInfo->maxOutputChannels  );
+                        else
+                                printf("device %2d - %s - %s (%d in, %d out)\n", i,
+                                       Pa_GetHostApiInfo(deviceInfo->hostApi)->name,
+                                       deviceInfo->name,
+                                       deviceInfo->maxInputChannels,
+                                       deviceInfo->maxOutputChannels);
+                }
+
+                printf("Select input device [%d]: ", Pa_GetDefaultInputDevice());
+                option_prompt(argc, argv, "input-device", line, STRLEN);
+                if (strlen(line)==1)
+                        inputDevice = Pa_GetDefaultInputDevice();
+                else
+                        inputDevice = atoi(line);
 
-        printf("Input sampling rate [%.0f]: ", DEFAULTRATE);
-        fgets(line, STRLEN, stdin);
-        if (strlen(line)==1)
-                inputRate = DEFAULTRATE;
-        else
-                inputRate = atof(line);
+                printf("Input sampling rate [%.0f]: ", DEFAULTRATE);
+                option_prompt(argc, argv, "input-rate", line, STRLEN);
+                if (strlen(line)==1)
+                        inputRate = DEFAULTRATE;
+                else
+                        inputRate = atof(line);
 
-        deviceInfo = Pa_GetDeviceInfo(inputDevice);
-        printf("Number of channels [%d]: ", deviceInfo->maxInputChannels);
-        fgets(line, STRLEN, stdin);
-        if (strlen(line) == 1)
-                channelCount = deviceInfo->maxInputChannels;
-        else
-                channelCount = atoi(line);
+                deviceInfo = Pa_GetDeviceInfo(inputDevice);
+                printf("Number of channels [%d]: ", deviceInfo->maxInputChannels);
+                option_prompt(argc, argv, "input-channels", line, STRLEN);
+                if (strlen(line) == 1)
+                        inputChannelCount = deviceInfo->maxInputChannels;
+                else
+                        inputChannelCount = atoi(line);
+        }
 
-        inputParameters.device = inputDevice;
-        inputParameters.channelCount = channelCount;
-        inputParameters.sampleFormat = SAMPLETYPE;
-        inputParameters.suggestedLatency = Pa_GetDeviceInfo( inputParameters.device )->defaultLowInputLatency;
-        inputParameters.hostApiSpecificStreamInfo = NULL;
+        /* the channel selection or combination is applied before resampling */
+        if (channelSpec == NULL)
+                channelCount = inputChannelCount;
+        else if (chanmap_count(channelSpec, inputChannelCount, &channelCount, NULL) || channelCount == 0)
+        {
+                printf("ERROR: Invalid channel specification '%s'.\n", channelSpec);
+                goto cleanup1;
+        }
 
-        inputBufsize = BUFFERSIZE * inputRate;
         inputBlocksize = blockSize * inputRate;
 
-        paErr = Pa_OpenStream(
-                &inputStream,
-                &inputParameters,
-                NULL,
-                inputRate,
-                inputBlocksize,
-                paNoFlag,
-                input_callback,
-                &inputData );
-        if( paErr != paNoError )
+        if (!replayFile)
         {
-                printf("ERROR: Cannot open input stream.\n");
-                printf("ERROR: %s\n", Pa_GetErrorText( paErr ) );
-                goto cleanup1;
+                /* the device is remembered by name, so that it can be found again after it is replugged */
+                paErr = device_open(&inputStream, inputDevice, 1, inputChannelCount, inputRate, inputBlocksize, input_callback, NULL);
+                if( paErr != paNoError )
+                {
+                        printf("ERROR: Cannot open input stream.\n");
+                        printf("ERROR: %s\n", Pa_GetErrorText( paErr ) );
+                        goto cleanup1;
+                }
+
+                printf("Opened input stream with %d channels at %.0f Hz.\n", inputChannelCount, inputRate);
         }
 
-        printf("Opened input stream with %d channels at %.0f Hz.\n", channelCount, inputRate);
-        Pa_SetStreamFinishedCallback(&inputStream, stream_finished);
-
         memset(outputStream, 0, STRLEN);
         sprintf(outputStream, LSLSTREAM);
         printf("LSL stream name [%s]: ", LSLSTREAM);
-        fgets(line, STRLEN, stdin);
+        option_prompt(argc, argv, "stream-name", line, STRLEN);
         if (strlen(line)>1)
                 strncpy(outputStream, line, strlen(line)-1);
 
-        printf("Output sampling rate [%.0f]: ", FSAMPLE);
-        fgets(line, STRLEN, stdin);
-        if (strlen(line)==1)
-                outputRate = FSAMPLE;
+        if (rateSpec)
+        {
+                /* multiple outlets at different rates can be fed from the same capture */
+                const char *str = rateSpec;
+                char *end;
+                while (*str && outletCount < OUTLETCOUNT)
+                {
+                        outlets[outletCount].rate = strtod(str, &end);
+                        if (end == str || outlets[outletCount].rate <= 0)
+                        {
+                                printf("ERROR: Invalid output rates '%s'.\n", rateSpec);
+                                goto cleanup1;
+                        }
+                        outletCount++;
+                        str = (*end == ',' ? end + 1 : end);
+                }
+        }
         else
-                outputRate = atof(line);
+        {
+                printf("Output sampling rate [%.0f]: ", FSAMPLE);
+                option_prompt(argc, argv, "output-rate", line, STRLEN);
+                if (strlen(line)==1)
+                        outlets[0].rate = FSAMPLE;
+                else
+                        outlets[0].rate = atof(line);
+                outletCount = 1;
+        }
 
-        outputBufsize = BUFFERSIZE * outputRate;
+        /* each outlet taps the decimation tree at the lowest rate that is still sufficiently high for
+           its fractional stage, each stage of the tree only needs to protect the band of the outlets
+           further down */
+        for (int i = 0; i < outletCount; i++)
+                rates[i] = outlets[i].rate;
+        plan_decimation(&plan, inputRate, rates, depth, outletCount, inputBlocksize, maxDepth);
+        plan.fixedPoint = fixedPoint;
+        for (int i = 0; i < outletCount; i++)
+                outlets[i].depth = depth[i];
+        plan_print(&plan);
 
         /* STAGE 2: Initialize the inputData and outputData for use by the callbacks. */
 
-        inputData.frames = 0;
-        inputData.data = NULL;
-        if ((inputData.data = malloc(inputBufsize * channelCount * sizeof(float))) == NULL)
+        /* all buffers are carved from a single arena, which is zeroed upon initialization */
+        arenaSize = chanmap_arena_size(inputChannelCount, channelCount);
+        arenaSize += plan_arena_size(&plan, channelCount);
+        for (int i = 0; i < outletCount; i++)
+        {
+                outlets[i].inputBufsize = BUFFERSIZE * plan.rate[outlets[i].depth];
+                outlets[i].outputBufsize = BUFFERSIZE * outlets[i].rate;
+                arenaSize += arena_round(outlets[i].inputBufsize * channelCount * sizeof(float));
+                arenaSize += 2 * arena_round(outlets[i].outputBufsize * channelCount * sizeof(float));
+                arenaSize += 2 * arena_round(outlets[i].outputBufsize * sizeof(double));
+                arenaSize += ring_arena_size(channelCount, outlets[i].outputBufsize, 1);
+                arenaSize += resampler_arena_size(channelCount, outlets[i].outputBufsize, outlets[i].rate / plan.rate[outlets[i].depth]);
+        }
+        arenaSize += (replayFile ? arena_round(inputBlocksize * inputChannelCount * sizeof(float)) : 0);
+        if (recordPrefix)
+        {
+                arenaSize += tap_arena_size(inputChannelCount, inputRate);
+                arenaSize += tap_arena_size(channelCount, outlets[0].rate);
+                arenaSize += tap_arena_size(2, 1.0 / blockSize);
+        }
+        if (arena_init(&arena, arenaSize))
+        {
+                printf("ERROR: Cannot allocate memory.\n");
                 goto cleanup2;
-        else
-                memset(inputData.data, 0, inputBufsize * channelCount * sizeof(float));
+        }
 
-        outputData.frames = 0;
-        outputData.data = NULL;
-        if ((outputData.data = malloc(outputBufsize * channelCount * sizeof(float))) == NULL)
+        if (plan_init(&plan, channelCount, &arena))
                 goto cleanup2;
-        else
-                memset(outputData.data, 0, outputBufsize * channelCount * sizeof(float));
 
-        /* STAGE 3: Initialize the resampling. */
+        for (int i = 0; i < outletCount; i++)
+        {
+                outlets[i].inputData.frames = 0;
+                if ((outlets[i].inputData.data = arena_alloc(&arena, outlets[i].inputBufsize * channelCount * sizeof(float))) == NULL)
+                        goto cleanup2;
+
+                outlets[i].outputData.frames = 0;
+                if ((outlets[i].outputData.data = arena_alloc(&arena, outlets[i].outputBufsize * channelCount * sizeof(float))) == NULL)
+                        goto cleanup2;
+
+                if (ring_init(&outlets[i].queue, channelCount, outlets[i].outputBufsize, 1, &arena))
+                        goto cleanup2;
+                if ((outlets[i].chunk = arena_alloc(&arena, outlets[i].outputBufsize * channelCount * sizeof(float))) == NULL)
+                        goto cleanup2;
+                outlets[i].outputTime = arena_alloc(&arena, outlets[i].outputBufsize * sizeof(double));
+                outlets[i].chunkTime = arena_alloc(&arena, outlets[i].outputBufsize * sizeof(double));
+                if (!outlets[i].outputTime || !outlets[i].chunkTime)
+                        goto cleanup2;
+                atomic_init(&outlets[i].dropped, 0);
+                atomic_init(&outlets[i].chunkCounter, 0);
+                seqlock_init(&outlets[i].stats);
+                for (int j = 0; j < 3; j++)
+                        ledger_init(&outlets[i].ledger[j]);
+        }
+        seqlock_init(&captureLedger);
+        ledger_init(&capture);
+
+        if (chanmap_init(&chanmap, channelSpec, inputChannelCount, channelCount, CROSSFADE * inputRate, &arena))
+                goto cleanup2;
+
+        /* the replay reads one block at a time */
+        if (replayFile && (replayData = arena_alloc(&arena, inputBlocksize * inputChannelCount * sizeof(float))) == NULL)
+                goto cleanup2;
 
-        resampleRatio = outputRate / inputRate;
-        printf("Resampling ratio = %f\n", resampleRatio);
+        /* the raw audio input, the samples that are pushed to LSL and the resampling ratio with the buffer size are recorded */
+        if (recordPrefix)
+        {
+                if (tap_open(&inputTap, recordPrefix, "input", inputChannelCount, inputRate, &arena) ||
+                    tap_open(&outputTap, recordPrefix, "output", channelCount, outlets[0].rate, &arena) ||
+                    tap_open(&ratioTap, recordPrefix, "ratio", 2, 1.0 / blockSize, &arena))
+                {
+                        printf("ERROR: Cannot open the recording files.\n");
+                        goto cleanup2;
+                }
+                recorder_start();
+        }
+
+        /* STAGE 3: Initialize the resampling. */
 
         printf("Setting up %s rate converter with %s\n",
                src_get_name (SRC_SINC_MEDIUM_QUALITY),
                src_get_description (SRC_SINC_MEDIUM_QUALITY));
 
-        resampleState = src_new (SRC_SINC_MEDIUM_QUALITY, channelCount, &srcErr);
-        if (resampleState == NULL)
+        for (int i = 0; i < outletCount; i++)
         {
-                printf("ERROR: Cannot set up resample state.\n");
-                printf("ERROR: %s\n", src_strerror(srcErr));
-                goto cleanup3;
+                /* the fractional stage works on the output of the decimation tree */
+                outlet_t *out = &outlets[i];
+                out->resampleRatio = out->rate / plan.rate[out->depth];
+                out->delay = plan_delay(&plan, out->depth, resampler_delay(SRC_SINC_MEDIUM_QUALITY, out->resampleRatio));
+                out->position = 0;
+                printf("Resampling ratio = %f after %d halfband stages for %.0f Hz\n", out->resampleRatio, out->depth, out->rate);
+                printf("The timestamps are corrected for a group delay of %.2f ms, of which %.2f ms in the resampler\n", 1000 * out->delay, 1000 * (out->delay - plan_delay(&plan, out->depth, 0)));
+
+                srcErr = resampler_init (&out->resampler, SRC_SINC_MEDIUM_QUALITY, channelCount, out->outputBufsize, out->resampleRatio, CROSSFADE * out->rate, &arena);
+                if (srcErr)
+                {
+                        printf("ERROR: Cannot set up resample state.\n");
+                        printf("ERROR: %s\n", src_strerror(srcErr));
+                        goto cleanup3;
+                }
+
+                srcErr = resampler_set_ratio (&out->resampler, out->resampleRatio);
+                if (srcErr)
+                {
+                        printf("ERROR: Cannot set resampling ratio.\n");
+                        printf("ERROR: %s\n", src_strerror(srcErr));
+                        goto cleanup3;
+                }
         }
 
-        srcErr = src_set_ratio (resampleState, resampleRatio);
-        if (srcErr)
+        /* the quality can be lowered when the input callback uses too much of its time */
+        governor_init(&governor, SRC_SINC_MEDIUM_QUALITY, enableGovernor);
+
+        /* all memory has been allocated, nothing can be added after the streams start */
+        arena_seal(&arena);
+
+        /* initialize the LSL streams, with multiple outlets the rate is appended to the name */
+        for (int i = 0; i < outletCount; i++)
         {
-                printf("ERROR: Cannot set resampling ratio.\n");
-                printf("ERROR: %s\n", src_strerror(srcErr));
-                goto cleanup3;
+                if (outletCount > 1)
+                        snprintf(outputName, STRLEN, "%s-%.0f", outputStream, outlets[i].rate);
+                else
+                        snprintf(outputName, STRLEN, "%s", outputStream);
+                rand_str(outputUID, 8);
+                lsl_streaminfo info = lsl_create_streaminfo(outputName, LSLTYPE, channelCount, outlets[i].rate, cft_float32, outputUID);
+                printf("Opened LSL stream.\n");
+                printf("LSL name = %s\n", outputName);
+                printf("LSL type = %s\n", LSLTYPE);
+                printf("LSL uid = %s\n", outputUID);
+
+                /* the chunk size tells liblsl how to group the samples in network packets */
+                int chunkSize = max(pushChunk, (int)(pushLatency * outlets[i].rate));
+                outlets[i].outlet = lsl_create_outlet(info, chunkSize, LSLBUFFER);
         }
 
-        /* initialize the LSL stream */
-        rand_str(outputUID, 8);
-        lsl_streaminfo info = lsl_create_streaminfo(outputStream, LSLTYPE, channelCount, outputRate, cft_float32, outputUID);
-        printf("Opened LSL stream.\n");
-        printf("LSL name = %s\n", outputStream);
-        printf("LSL type = %s\n", LSLTYPE);
-        printf("LSL uid = %s\n", outputUID);
-
-        outlet = lsl_create_outlet(info, 0, LSLBUFFER);
+        if (thread_create(&pushThread, push_thread, NULL))
+        {
+                printf("ERROR: Cannot start the push thread.\n");
+                goto cleanup3;
+        }
+        pushStarted = 1;
 
         /* STAGE 4: Start the streams. */
 
-        paErr = Pa_StartStream( inputStream );
-        if( paErr != paNoError )
+        if (replayFile)
         {
-                printf("ERROR: Cannot start input stream.\n");
-                printf("ERROR: %s\n", Pa_GetErrorText( paErr ) );
-                goto cleanup3;
+                if (thread_create(&replayThread, replay_thread, NULL))
+                {
+                        printf("ERROR: Cannot start replay.\n");
+                        goto cleanup3;
+                }
+                replayStarted = 1;
+        }
+        else
+        {
+                paErr = device_start( &inputStream );
+                if( paErr != paNoError )
+                {
+                        printf("ERROR: Cannot start input stream.\n");
+                        printf("ERROR: %s\n", Pa_GetErrorText( paErr ) );
+                        goto cleanup3;
+                }
         }
 
         printf("Processing data...\n");
+        printf("Type 'help' for a list of commands to change the settings.\n");
+        control_start(control_handler);
 
-        while (keepRunning)
+        while (atomic_load_explicit(&shared.keepRunning, memory_order_relaxed))
         {
-                Pa_Sleep(1000);
-                printf("inputCounter = %lu, ", inputCounter);
-                printf("outputCounter = %lu", outputCounter);
+                for (int i = 0; i < 10 && atomic_load_explicit(&shared.keepRunning, memory_order_relaxed); i++)
+                {
+                        Pa_Sleep(100);
+
+                        /* the decimation tree and the resamplers are kept, the stream continues when the device is back */
+                        if (!replayFile)
+                                device_watch(devices, 1);
+                        update_converter();
+                }
+                for (int i = 0; i < outletCount; i++)
+                {
+                        if (outletCount > 1)
+                                printf("%s%.0f Hz: ", i ? ", " : "", outlets[i].rate);
+                        ledger_t ledger[STAGECOUNT];
+                        read_ledger(&outlets[i], ledger);
+                        printf("inputCounter = %llu, ", (unsigned long long)ledger[2].input);
+                        printf("outputCounter = %llu, ", (unsigned long long)ledger[2].output);
+                        printf("chunkCounter = %lu", atomic_load_explicit(&outlets[i].chunkCounter, memory_order_relaxed));
+                        printf(", offset = %.1f", ledger_chain(ledger, STAGECOUNT));
+                        if (atomic_load(&outlets[i].dropped))
+                                printf(", dropped = %lu", atomic_load(&outlets[i].dropped));
+                }
+                printf(", load = %.0f%%", 100 * governor.load);
                 printf("\n");
         }
 
-        paErr = Pa_StopStream( outputStream );
-        if( paErr != paNoError ) goto cleanup3;
-        paErr = Pa_CloseStream( outputStream );
+        paErr = device_close( &inputStream );
         if( paErr != paNoError ) goto cleanup3;
 
 cleanup3:
-        lsl_destroy_outlet(outlet);
-
-        if (resampleState)
-                src_delete (resampleState);
+        atomic_store_explicit(&shared.keepRunning, 0, memory_order_relaxed);
+        if (replayStarted)
+                thread_join(replayThread);
+        if (pushStarted)
+                thread_join(pushThread);
+        for (int i = 0; i < outletCount; i++)
+        {
+                if (outlets[i].outlet)
+                        lsl_destroy_outlet(outlets[i].outlet);
+                resampler_free (&outlets[i].resampler);
+        }
 
 cleanup2:
-        if (inputData.data)
-                free(inputData.data);
-        if (outputData.data)
-                free(outputData.data);
+        recorder_stop();
+        arena_free(&arena);
 
 cleanup1:
+        replay_close(&replay);
         Pa_Terminate();
 
         if (srcErr)
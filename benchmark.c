@@ -0,0 +1,497 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "samplerate.h"
+#include "arena.h"
+#include "thread.h"
+#include "planner.h"
+#include "chanmap.h"
+#include "kernel.h"
+#include "scrub.h"
+#include "filterbank.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define AUDIORATE     (44100.)
+#define EEGRATE       (250.)
+#define BLOCKSIZE     (0.01)    // in seconds
+#define SIGNAL        (0.4)     // frequency of the test tone, relative to the EEG rate
+#define ALIAS         (1.2)     // frequency of a tone that should be removed when decimating
+#define PASSBAND      (0.4)     // the passband error is measured up to this frequency, relative to the EEG rate
+#define PASSBANDTONES (8)       // number of tones for the passband error
+#define PASSBANDTIME  (2)       // in seconds, the duration of the conversion of each tone
+#define SETTLE        (0.5)     // in seconds, the start of the output is not used for the error
+#define REPEAT        (5)       // the kernels are timed several times and the fastest run is reported
+#define AMPLITUDE     (0.5)     // of the test tone for the signal-to-noise ratio and distortion
+#define HARMONICS     (5)       // number of harmonics for the distortion
+#define FILTERSPEC    "hp:1,lp:40:4,notch:50"   // a typical EEG filter, four biquad sections
+#define DRIFTHOURS    (24)      // duration of the simulated run
+#define DRIFTOFFSET   (1e5)     // in seconds, the LSL clock at the start of the simulated run
+#define DRIFTRATE     (250.01)  // the true rate of the simulated stream, the nominal rate is EEGRATE
+#define DRIFTJITTER   (0.001)   // in seconds, the peak-to-peak jitter of the simulated timestamps
+
+#define min(x, y) ((x)<(y) ? x : y)
+
+/* This compares the CPU time and the quality of a single libsamplerate stage against the
+   halfband cascade with a small fractional stage, for the conversions that audio2lsl and
+   lsl2audio do. The single stage uses the cheapest converter whose passband error does not
+   exceed that of the cascade, so that both are compared at the same passband quality. The quality is expressed as the error after removing the best fitting test tone,
+   which includes the aliases and images. It also compares the kernels for specific channel
+   counts with the generic ones, the cascades in floating and in fixed point, and the drift of
+   the rate estimate in single and in double precision. */
+
+/*******************************************************************************************************/
+void tone_fit(const float *data, int channelCount, unsigned long frames, double rate, double frequency, double *gain, double *error, double *sine, double *cosine)
+{
+        /* least-squares fit of a sine and cosine to the first channel */
+        double ss = 0, sc = 0, cc = 0, ys = 0, yc = 0, yy = 0;
+        for (unsigned long i = 0; i < frames; i++)
+        {
+                double s = sin(2 * M_PI * frequency * i / rate);
+                double c = cos(2 * M_PI * frequency * i / rate);
+                double y = data[i * channelCount];
+                ss += s * s; sc += s * c; cc += c * c;
+                ys += y * s; yc += y * c; yy += y * y;
+        }
+        double det = ss * cc - sc * sc;
+        double a = (ys * cc - yc * sc) / det;
+        double b = (yc * ss - ys * sc) / det;
+        double residual = yy - a * ys - b * yc;
+        *gain = sqrt(a * a + b * b);
+        *error = 10 * log10(fmax(residual, 1e-30) / (0.5 * frames));
+        if (sine && cosine)
+        {
+                *sine = a;
+                *cosine = b;
+        }
+}
+
+/*******************************************************************************************************/
+void tone_subtract(float *data, int channelCount, unsigned long frames, double rate, double frequency, double sine, double cosine)
+{
+        for (unsigned long i = 0; i < frames; i++)
+                data[i * channelCount] -= sine * sin(2 * M_PI * frequency * i / rate) + cosine * cos(2 * M_PI * frequency * i / rate);
+}
+
+/*******************************************************************************************************/
+/* Convert a tone at the specified frequency, when decimating together with one that would alias onto
+   the passband, and return the gain and the error of the tone and the CPU time. */
+int convert(double inputRate, double outputRate, int channelCount, double seconds, int maxDepth, int converter, double frequency, double *gain, double *error, double *elapsed, int *stages)
+{
+        int interpolate = (outputRate > inputRate);
+        unsigned long inputFrames = seconds * inputRate;
+        unsigned long outputFrames = seconds * outputRate + 1024;
+        unsigned long blockFrames = BLOCKSIZE * inputRate;
+        unsigned long maxFrames = blockFrames * outputRate / inputRate * 2 + 64;
+        arena_t arena;
+        plan_t plan;
+        int depth, srcErr;
+        SRC_STATE *state;
+        SRC_DATA data;
+
+        if (interpolate)
+                plan_interpolation(&plan, inputRate, outputRate, maxFrames, maxDepth);
+        else
+                plan_decimation(&plan, inputRate, &outputRate, &depth, 1, blockFrames, maxDepth);
+
+        if (arena_init(&arena, arena_round(inputFrames * channelCount * sizeof(float)) + arena_round(outputFrames * channelCount * sizeof(float)) + plan_arena_size(&plan, channelCount)))
+                return -1;
+        float *input = arena_alloc(&arena, inputFrames * channelCount * sizeof(float));
+        float *output = arena_alloc(&arena, outputFrames * channelCount * sizeof(float));
+        if (!input || !output || plan_init(&plan, channelCount, &arena))
+                return -1;
+
+        /* a tone in the passband, and when decimating one that would alias onto it */
+        for (unsigned long i = 0; i < inputFrames; i++)
+        {
+                float value = sin(2 * M_PI * frequency * i / inputRate);
+                if (!interpolate)
+                        value += sin(2 * M_PI * ALIAS * EEGRATE * i / inputRate);
+                for (int j = 0; j < channelCount; j++)
+                        input[i * channelCount + j] = value;
+        }
+
+        if ((state = src_new(converter, channelCount, &srcErr)) == NULL)
+                return srcErr;
+
+        /* the fractional stage runs at the lowest rate of the plan */
+        double fractionalRate = (interpolate ? plan.rate[0] : plan.rate[plan.depth]);
+        data.src_ratio = (interpolate ? fractionalRate / inputRate : outputRate / fractionalRate);
+        data.end_of_input = 0;
+
+        unsigned long produced = 0;
+        double start = thread_now();
+
+        for (unsigned long offset = 0; offset + blockFrames <= inputFrames; offset += blockFrames)
+        {
+                if (interpolate)
+                {
+                        data.data_in = input + offset * channelCount;
+                        data.input_frames = blockFrames;
+                        data.data_out = (plan.depth ? plan.data[0] : output + produced * channelCount);
+                        data.output_frames = min(plan.maxFrames[0], (outputFrames - produced) >> plan.depth);
+                        if ((srcErr = src_process(state, &data)))
+                                break;
+                        if (plan.depth)
+                                produced += plan_interpolate(&plan, data.output_frames_gen, output + produced * channelCount);
+                        else
+                                produced += data.output_frames_gen;
+                }
+                else
+                {
+                        memcpy(plan.data[0], input + offset * channelCount, blockFrames * channelCount * sizeof(float));
+                        plan_decimate(&plan, blockFrames);
+                        data.data_in = plan.data[plan.depth];
+                        data.input_frames = plan.frames[plan.depth];
+                        data.data_out = output + produced * channelCount;
+                        data.output_frames = outputFrames - produced;
+                        if ((srcErr = src_process(state, &data)))
+                                break;
+                        produced += data.output_frames_gen;
+                }
+        }
+
+        *elapsed = thread_now() - start;
+        *stages = plan.depth;
+        src_delete(state);
+        if (srcErr)
+        {
+                printf("ERROR: %s\n", src_strerror(srcErr));
+                arena_free(&arena);
+                return srcErr;
+        }
+
+        unsigned long skip = SETTLE * outputRate;
+        tone_fit(output + skip * channelCount, channelCount, produced - skip, outputRate, frequency, gain, error, NULL, NULL);
+
+        arena_free(&arena);
+        return 0;
+}
+
+/*******************************************************************************************************/
+int run(double inputRate, double outputRate, int channelCount, double seconds, int maxDepth, int converter)
+{
+        double gain, error, elapsed;
+        int stages, err;
+
+        if ((err = convert(inputRate, outputRate, channelCount, seconds, maxDepth, converter, SIGNAL * EEGRATE, &gain, &error, &elapsed, &stages)))
+                return err;
+
+        printf("%7.0f -> %7.0f Hz  %2d channels  %-12s  %-20s  %2d stages  %8.3f ms per channel per second  gain %.4f  error %6.1f dB\n",
+               inputRate, outputRate, channelCount, maxDepth ? "multistage" : "single stage", src_get_name(converter), stages,
+               1000 * elapsed / (seconds * channelCount), gain, error);
+        return 0;
+}
+
+/*******************************************************************************************************/
+/* Return the largest deviation in dB of the gain from one, over tones in the passband. */
+double passband_error(double inputRate, double outputRate, int maxDepth, int converter)
+{
+        double worst = 0, gain, error, elapsed;
+        int stages;
+
+        for (int k = 1; k <= PASSBANDTONES; k++)
+        {
+                if (convert(inputRate, outputRate, 1, PASSBANDTIME, maxDepth, converter, k * PASSBAND * EEGRATE / PASSBANDTONES, &gain, &error, &elapsed, &stages))
+                        return INFINITY;
+                worst = fmax(worst, fabs(20 * log10(gain)));
+        }
+        return worst;
+}
+
+/*******************************************************************************************************/
+/* Return the cheapest converter for a single stage whose passband error does not exceed that of the
+   cascade, or the best one if none does. */
+int match_converter(double inputRate, double outputRate, double target)
+{
+        int converter[] = {SRC_SINC_FASTEST, SRC_SINC_MEDIUM_QUALITY};
+
+        for (int i = 0; i < sizeof(converter) / sizeof(converter[0]); i++)
+                if (passband_error(inputRate, outputRate, 0, converter[i]) <= target)
+                        return converter[i];
+        return SRC_SINC_BEST_QUALITY;
+}
+
+/*******************************************************************************************************/
+/* Time the halfband cascades, a reordering of the channels and the scrubbing of non-finite
+   values, which are the loops that have kernels for specific channel counts, once with those
+   kernels and once with the generic ones. A plain copy is the reference for the scrubbing. */
+int run_kernels(int channelCount, double seconds, int generic)
+{
+        unsigned long inputFrames = seconds * AUDIORATE;
+        unsigned long blockFrames = BLOCKSIZE * AUDIORATE;
+        double outputRate = EEGRATE;
+        char spec[1024] = "";
+        arena_t arena;
+        chanmap_t chanmap;
+        scrub_t scrub;
+        filterbank_t filterbank;
+        filterstate_t filterstate;
+        plan_t decimation, interpolation;
+        int depth;
+
+        plan_decimation(&decimation, AUDIORATE, &outputRate, &depth, 1, blockFrames, HALFBANDSTAGES);
+        plan_interpolation(&interpolation, EEGRATE, AUDIORATE, 2 * blockFrames, HALFBANDSTAGES);
+        unsigned long lowFrames = BLOCKSIZE * interpolation.rate[0];
+
+        /* the channels in reverse order are a selection but not the identity */
+        for (int j = channelCount - 1; j >= 0; j--)
+                snprintf(spec + strlen(spec), sizeof(spec) - strlen(spec), "%d%s", j, j ? "," : "");
+
+        size_t arenaSize = 2 * arena_round(inputFrames * channelCount * sizeof(float)) + arena_round(2 * blockFrames * channelCount * sizeof(float));
+        arenaSize += plan_arena_size(&decimation, channelCount) + plan_arena_size(&interpolation, channelCount);
+        arenaSize += chanmap_arena_size(channelCount, channelCount) + scrub_arena_size(channelCount);
+        if (filterbank_init(&filterbank, FILTERSPEC, channelCount, EEGRATE))
+                return -1;
+        arenaSize += filterstate_arena_size(&filterbank);
+        if (arena_init(&arena, arenaSize))
+                return -1;
+        float *input = arena_alloc(&arena, inputFrames * channelCount * sizeof(float));
+        float *mapped = arena_alloc(&arena, inputFrames * channelCount * sizeof(float));
+        float *output = arena_alloc(&arena, 2 * blockFrames * channelCount * sizeof(float));
+        if (!input || !mapped || !output || plan_init(&decimation, channelCount, &arena) || plan_init(&interpolation, channelCount, &arena) || chanmap_init(&chanmap, spec, channelCount, channelCount, 0, &arena) || scrub_init(&scrub, channelCount, &arena) || filterstate_init(&filterbank, &filterstate, &arena))
+        {
+                arena_free(&arena);
+                return -1;
+        }
+
+        for (unsigned long i = 0; i < inputFrames * channelCount; i++)
+                input[i] = sin(2 * M_PI * SIGNAL * EEGRATE * i / (AUDIORATE * channelCount));
+
+        kernelGeneric = generic;
+        /* a few values are not finite, as with an occasional electrode disconnect */
+        for (unsigned long i = 0; i < inputFrames * channelCount; i += 9973)
+                input[i] = NAN;
+        double elapsed[6] = {INFINITY, INFINITY, INFINITY, INFINITY, INFINITY, INFINITY};
+
+        for (int r = 0; r < REPEAT; r++)
+        {
+                double start = thread_now();
+                chanmap_apply(&chanmap, input, mapped, inputFrames);
+                elapsed[0] = fmin(elapsed[0], thread_now() - start);
+
+                start = thread_now();
+                for (unsigned long offset = 0; offset + blockFrames <= inputFrames; offset += blockFrames)
+                {
+                        memcpy(decimation.data[0], mapped + offset * channelCount, blockFrames * channelCount * sizeof(float));
+                        plan_decimate(&decimation, blockFrames);
+                }
+                elapsed[1] = fmin(elapsed[1], thread_now() - start);
+
+                /* the interpolation cascade gets the same number of blocks at its lowest rate */
+                start = thread_now();
+                for (unsigned long offset = 0; offset + blockFrames <= inputFrames; offset += blockFrames)
+                {
+                        memcpy(interpolation.data[0], mapped + offset * channelCount, lowFrames * channelCount * sizeof(float));
+                        plan_interpolate(&interpolation, lowFrames, output);
+                }
+                elapsed[2] = fmin(elapsed[2], thread_now() - start);
+
+                start = thread_now();
+                memcpy(mapped, input, inputFrames * channelCount * sizeof(float));
+                elapsed[3] = fmin(elapsed[3], thread_now() - start);
+
+                start = thread_now();
+                scrub_copy(&scrub, input, mapped, inputFrames);
+                elapsed[4] = fmin(elapsed[4], thread_now() - start);
+
+                /* the filters run in place on the scrubbed data, as in lsl2audio */
+                start = thread_now();
+                filterbank_process(&filterbank, &filterstate, mapped, mapped, inputFrames);
+                elapsed[5] = fmin(elapsed[5], thread_now() - start);
+        }
+        kernelGeneric = 0;
+
+        printf("%2d channels  %-11s  selection %7.3f  decimation %7.3f  interpolation %7.3f  copy %7.3f  scrub %7.3f  filter %7.3f ms per channel per second\n",
+               channelCount, generic ? "generic" : "specialised",
+               1000 * elapsed[0] / (seconds * channelCount), 1000 * elapsed[1] / (seconds * channelCount), 1000 * elapsed[2] / (seconds * channelCount),
+               1000 * elapsed[3] / (seconds * channelCount), 1000 * elapsed[4] / (seconds * channelCount), 1000 * elapsed[5] / (seconds * channelCount));
+
+        arena_free(&arena);
+        return 0;
+}
+
+/*******************************************************************************************************/
+/* Pass a tone through the halfband cascade alone, and express its quality as the signal-to-noise
+   ratio and as the total harmonic distortion. */
+int run_quality(int interpolate, int channelCount, double seconds, int fixedPoint)
+{
+        double outputRate = EEGRATE;
+        unsigned long blockFrames = BLOCKSIZE * AUDIORATE;
+        arena_t arena;
+        plan_t plan;
+        int depth;
+
+        if (interpolate)
+                plan_interpolation(&plan, EEGRATE, AUDIORATE, blockFrames, HALFBANDSTAGES);
+        else
+                plan_decimation(&plan, AUDIORATE, &outputRate, &depth, 1, blockFrames, HALFBANDSTAGES);
+        plan.fixedPoint = fixedPoint;
+
+        double inputRate = plan.rate[0], lowRate = plan.rate[plan.depth];
+        unsigned long inputBlock = (interpolate ? blockFrames >> plan.depth : blockFrames);
+        unsigned long blockCount = seconds / BLOCKSIZE;
+        unsigned long outputFrames = blockCount * (interpolate ? blockFrames : plan.maxFrames[plan.depth]);
+        double finalRate = (interpolate ? AUDIORATE : lowRate);
+
+        if (arena_init(&arena, arena_round(outputFrames * channelCount * sizeof(float)) + plan_arena_size(&plan, channelCount)))
+                return -1;
+        float *output = arena_alloc(&arena, outputFrames * channelCount * sizeof(float));
+        if (!output || plan_init(&plan, channelCount, &arena))
+        {
+                arena_free(&arena);
+                return -1;
+        }
+
+        unsigned long produced = 0, sample = 0;
+        double elapsed = 0;
+        for (unsigned long b = 0; b < blockCount; b++)
+        {
+                for (unsigned long i = 0; i < inputBlock; i++, sample++)
+                        for (int j = 0; j < channelCount; j++)
+                                plan.data[0][i * channelCount + j] = AMPLITUDE * sin(2 * M_PI * SIGNAL * EEGRATE * sample / inputRate);
+
+                double start = thread_now();
+                if (interpolate)
+                {
+                        produced += plan_interpolate(&plan, inputBlock, output + produced * channelCount);
+                }
+                else
+                {
+                        plan_decimate(&plan, inputBlock);
+                        memcpy(output + produced * channelCount, plan.data[plan.depth], plan.frames[plan.depth] * channelCount * sizeof(float));
+                        produced += plan.frames[plan.depth];
+                }
+                elapsed += thread_now() - start;
+        }
+
+        /* the residual of the fit at the fundamental is relative to a tone with an amplitude of one */
+        double gain, error, sine, cosine, harmonic, distortion = 0;
+        unsigned long skip = SETTLE * finalRate;
+        float *fit = output + skip * channelCount;
+        tone_fit(fit, channelCount, produced - skip, finalRate, SIGNAL * EEGRATE, &gain, &error, &sine, &cosine);
+        double snr = 20 * log10(gain) - error;
+
+        /* the fundamental is removed first, otherwise it leaks into the fit of the harmonics */
+        tone_subtract(fit, channelCount, produced - skip, finalRate, SIGNAL * EEGRATE, sine, cosine);
+        for (int k = 2; k <= HARMONICS && k * SIGNAL * EEGRATE < finalRate / 2; k++)
+        {
+                tone_fit(fit, channelCount, produced - skip, finalRate, k * SIGNAL * EEGRATE, &harmonic, &error, NULL, NULL);
+                distortion += harmonic * harmonic;
+        }
+
+        printf("%7.0f -> %7.0f Hz  %2d channels  %-14s  %2d stages  %8.3f ms per channel per second  SNR %6.1f dB  THD %6.1f dB\n",
+               inputRate, finalRate, channelCount, fixedPoint ? "fixed point" : "floating point", plan.depth,
+               1000 * elapsed / (seconds * channelCount), snr, 10 * log10(fmax(distortion, 1e-30)) - 20 * log10(gain));
+
+        arena_free(&arena);
+        return 0;
+}
+
+/*******************************************************************************************************/
+/* Simulate a long run of jittered LSL timestamps and estimate the rate from them like lsl2audio
+   does, with the estimate in double or in single precision. The resampling ratio that follows from
+   the estimate is integrated to the number of audio frames, which is compared to the number that
+   follows from the true rate. The buffer control of lsl2audio corrects a remaining drift, but the
+   larger it is, the further the ratio has to be pulled away from its estimate. */
+void run_drift(int singlePrecision)
+{
+        unsigned long samples = DRIFTHOURS * 3600 * DRIFTRATE;
+        double lambda = 0.01 / EEGRATE;
+        double timestampPerSample = 1.0 / EEGRATE, timestampPrev = DRIFTOFFSET;
+        float timestampPerSampleFloat = 1.0 / EEGRATE;
+        double frames = 0;
+        unsigned int seed = 1;
+
+        for (unsigned long i = 1; i <= samples; i++)
+        {
+                /* a simple linear congruential generator keeps the jitter reproducible */
+                seed = seed * 1103515245 + 12345;
+                double jitter = DRIFTJITTER * ((seed >> 8) / (double)(1 << 24) - 0.5);
+                double timestamp = DRIFTOFFSET + i / DRIFTRATE + jitter;
+                double inputRate;
+
+                if (singlePrecision)
+                {
+                        timestampPerSampleFloat = (1.0f - (float)lambda) * timestampPerSampleFloat + (float)lambda * (float)(timestamp - timestampPrev);
+                        inputRate = 1.0f / timestampPerSampleFloat;
+                }
+                else
+                {
+                        timestampPerSample = (1.0 - lambda) * timestampPerSample + lambda * (timestamp - timestampPrev);
+                        inputRate = 1.0 / timestampPerSample;
+                }
+                timestampPrev = timestamp;
+                frames += AUDIORATE / inputRate;
+        }
+
+        double exact = samples * AUDIORATE / DRIFTRATE;
+        printf("%2d hours  %-16s  rate estimate %.6f Hz  drift %10.1f frames  %9.3f ms\n",
+               DRIFTHOURS, singlePrecision ? "single precision" : "double precision",
+               singlePrecision ? 1.0f / timestampPerSampleFloat : 1.0 / timestampPerSample,
+               frames - exact, 1000 * (frames - exact) / AUDIORATE);
+}
+
+/*******************************************************************************************************/
+int main(int argc, char* argv[])
+{
+        int channels[] = {1, 8, 32};
+        int kernels[] = {1, 2, 8, 32, 64};
+        double seconds = (argc > 1 ? atof(argv[1]) : 10);
+
+        printf("Benchmarking the conversions with %.0f seconds of data\n", seconds);
+
+        for (int interpolate = 0; interpolate < 2; interpolate++)
+        {
+                double inputRate = (interpolate ? EEGRATE : AUDIORATE);
+                double outputRate = (interpolate ? AUDIORATE : EEGRATE);
+
+                /* the single stage is compared at the passband quality of the cascade */
+                double target = passband_error(inputRate, outputRate, HALFBANDSTAGES, SRC_SINC_MEDIUM_QUALITY);
+                int converter = match_converter(inputRate, outputRate, target);
+                printf("Passband error up to %.0f Hz is %.2g dB for the cascade, the single stage uses %s with %.2g dB\n",
+                       PASSBAND * EEGRATE, target, src_get_name(converter), passband_error(inputRate, outputRate, 0, converter));
+
+                for (int i = 0; i < sizeof(channels) / sizeof(channels[0]); i++)
+                {
+                        run(inputRate, outputRate, channels[i], seconds, 0, converter);
+                        run(inputRate, outputRate, channels[i], seconds, HALFBANDSTAGES, SRC_SINC_MEDIUM_QUALITY);
+                }
+        }
+
+        printf("Benchmarking the kernels for specific channel counts\n");
+        for (int i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+        {
+                run_kernels(kernels[i], seconds, 0);
+                run_kernels(kernels[i], seconds, 1);
+        }
+
+        printf("Benchmarking the halfband cascades in floating and in fixed point\n");
+        for (int interpolate = 0; interpolate < 2; interpolate++)
+        {
+                run_quality(interpolate, 8, seconds, 0);
+                run_quality(interpolate, 8, seconds, 1);
+        }
+
+        printf("Benchmarking the drift of the rate estimate\n");
+        run_drift(0);
+        run_drift(1);
+
+        return 0;
+}
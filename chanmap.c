@@ -0,0 +1,345 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "chanmap.h"
+#include "kernel.h"
+
+/*******************************************************************************************************/
+static const char *skip_space(const char *str)
+{
+        while (*str == ' ')
+                str++;
+        return str;
+}
+
+/*******************************************************************************************************/
+static void add_term(chanmat_t *matrix, int *terms, int index, float gain)
+{
+        if (matrix)
+        {
+                matrix->index[*terms] = index;
+                matrix->gain[*terms] = gain;
+        }
+        (*terms)++;
+}
+
+/*******************************************************************************************************/
+/* Parse the specification, the matrix can be NULL to only count the outputs and terms. This
+   returns -1 for a syntax error and -2 for a channel number or size that is out of range. */
+static int parse(const char *spec, int inputCount, chanmat_t *matrix, int maxOutputs, int maxTerms, int *outputCount, int *termCount)
+{
+        int outputs = 0, terms = 0;
+        const char *str = skip_space(spec);
+        char *end;
+
+        while (*str)
+        {
+                if (outputs == maxOutputs)
+                        return -2;
+
+                /* a range like 3:7 expands into multiple outputs */
+                long first = strtol(str, &end, 10);
+                if (end != str && *skip_space(end) == ':')
+                {
+                        str = skip_space(skip_space(end) + 1);
+                        long last = strtol(str, &end, 10);
+                        if (end == str)
+                                return -1;
+                        str = skip_space(end);
+                        for (long i = first; ; i += (last >= first ? 1 : -1))
+                        {
+                                if (i < 0 || i >= inputCount || outputs == maxOutputs || terms == maxTerms)
+                                        return -2;
+                                if (matrix)
+                                        matrix->start[outputs] = terms;
+                                add_term(matrix, &terms, i, 1.0f);
+                                outputs++;
+                                if (i == last)
+                                        break;
+                        }
+                }
+                else
+                {
+                        /* a sum of terms like 0.5*3+0.5*4 or 3-4 */
+                        float sign = 1.0f;
+                        if (matrix)
+                                matrix->start[outputs] = terms;
+                        if (*str == '-' || *str == '+')
+                        {
+                                sign = (*str == '-' ? -1.0f : 1.0f);
+                                str = skip_space(str + 1);
+                        }
+                        while (1)
+                        {
+                                float gain = 1.0f;
+                                double value = strtod(str, &end);
+                                if (end == str)
+                                        return -1;
+                                str = skip_space(end);
+                                if (*str == '*')
+                                {
+                                        gain = value;
+                                        str = skip_space(str + 1);
+                                        value = strtod(str, &end);
+                                        if (end == str)
+                                                return -1;
+                                        str = skip_space(end);
+                                }
+                                if (value != (int)value)
+                                        return -1;
+                                if (value < 0 || value >= inputCount || terms == maxTerms)
+                                        return -2;
+                                add_term(matrix, &terms, (int)value, sign * gain);
+
+                                if (*str == '+' || *str == '-')
+                                {
+                                        sign = (*str == '-' ? -1.0f : 1.0f);
+                                        str = skip_space(str + 1);
+                                }
+                                else
+                                        break;
+                        }
+                        outputs++;
+                }
+
+                if (*str == ',')
+                        str = skip_space(str + 1);
+                else if (*str)
+                        return -1;
+        }
+
+        if (matrix)
+        {
+                /* output channels that are not specified remain silent */
+                for (int i = outputs; i <= maxOutputs; i++)
+                        matrix->start[i] = terms;
+
+                matrix->selection = 1;
+                for (int i = 0; i < maxOutputs; i++)
+                        if (matrix->start[i+1] - matrix->start[i] != 1 || matrix->gain[matrix->start[i]] != 1.0f)
+                                matrix->selection = 0;
+                matrix->identity = matrix->selection;
+                for (int i = 0; i < maxOutputs && matrix->identity; i++)
+                        if (matrix->index[matrix->start[i]] != i)
+                                matrix->identity = 0;
+        }
+
+        if (outputCount)
+                *outputCount = outputs;
+        if (termCount)
+                *termCount = terms;
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+int chanmap_count(const char *spec, int inputCount, int *outputCount, int *termCount)
+{
+        return parse(spec, inputCount, NULL, 1 << 20, 1 << 30, outputCount, termCount);
+}
+
+/*******************************************************************************************************/
+size_t chanmap_arena_size(int inputCount, int outputCount)
+{
+        /* each output can at most combine all inputs */
+        int maxTerms = inputCount * outputCount;
+        return 2 * (arena_round((outputCount + 1) * sizeof(int)) + arena_round(maxTerms * sizeof(int)) + arena_round(maxTerms * sizeof(float)));
+}
+
+/*******************************************************************************************************/
+int chanmap_init(chanmap_t *chanmap, const char *spec, int inputCount, int outputCount, unsigned long fadeFrames, arena_t *arena)
+{
+        chanmap->active = 0;
+        chanmap->inputCount = inputCount;
+        chanmap->outputCount = outputCount;
+        chanmap->maxTerms = inputCount * outputCount;
+        chanmap->fadeFrames = fadeFrames;
+        chanmap->fadePosition = fadeFrames;
+        atomic_init(&chanmap->pending, 0);
+        atomic_init(&chanmap->fading, 0);
+
+        for (int i = 0; i < 2; i++)
+        {
+                chanmap->matrix[i].start = arena_alloc(arena, (outputCount + 1) * sizeof(int));
+                chanmap->matrix[i].index = arena_alloc(arena, chanmap->maxTerms * sizeof(int));
+                chanmap->matrix[i].gain  = arena_alloc(arena, chanmap->maxTerms * sizeof(float));
+                if (chanmap->matrix[i].start == NULL || chanmap->matrix[i].index == NULL || chanmap->matrix[i].gain == NULL)
+                        return -1;
+        }
+
+        if (spec)
+                return parse(spec, inputCount, &chanmap->matrix[0], outputCount, chanmap->maxTerms, NULL, NULL);
+
+        /* the identity maps the first input channels to the output */
+        int terms = 0;
+        for (int i = 0; i < outputCount; i++)
+        {
+                chanmap->matrix[0].start[i] = terms;
+                if (i < inputCount)
+                        add_term(&chanmap->matrix[0], &terms, i, 1.0f);
+        }
+        chanmap->matrix[0].start[outputCount] = terms;
+        chanmap->matrix[0].selection = (inputCount >= outputCount);
+        chanmap->matrix[0].identity = (inputCount >= outputCount);
+        return 0;
+}
+
+/*******************************************************************************************************/
+int chanmap_set(chanmap_t *chanmap, const char *spec)
+{
+        /* the previous change must have been completed, only then is the active matrix settled */
+        if (atomic_load_explicit(&chanmap->pending, memory_order_acquire) || atomic_load_explicit(&chanmap->fading, memory_order_acquire))
+                return -3;
+        int inactive = 1 - chanmap->active;
+
+        /* check the specification before touching the inactive matrix */
+        int err = parse(spec, chanmap->inputCount, NULL, chanmap->outputCount, chanmap->maxTerms, NULL, NULL);
+        if (err)
+                return err;
+        parse(spec, chanmap->inputCount, &chanmap->matrix[inactive], chanmap->outputCount, chanmap->maxTerms, NULL, NULL);
+
+        /* hand it over to the real-time thread */
+        atomic_store_explicit(&chanmap->pending, 1, memory_order_release);
+        return 0;
+}
+
+/*******************************************************************************************************/
+int chanmap_update(chanmap_t *chanmap)
+{
+        if (atomic_load_explicit(&chanmap->pending, memory_order_acquire) == 0)
+                return 0;
+
+        chanmap->active = 1 - chanmap->active;
+        chanmap->fadePosition = 0;
+        atomic_store_explicit(&chanmap->fading, 1, memory_order_relaxed);
+        atomic_store_explicit(&chanmap->pending, 0, memory_order_release);
+        return 1;
+}
+
+/*******************************************************************************************************/
+int chanmap_changed(chanmap_t *chanmap, int channel)
+{
+        const chanmat_t *a = &chanmap->matrix[chanmap->active];
+        const chanmat_t *b = &chanmap->matrix[1 - chanmap->active];
+        int count = a->start[channel+1] - a->start[channel];
+
+        if (count != b->start[channel+1] - b->start[channel])
+                return 1;
+        for (int k = 0; k < count; k++)
+                if (a->index[a->start[channel] + k] != b->index[b->start[channel] + k] || a->gain[a->start[channel] + k] != b->gain[b->start[channel] + k])
+                        return 1;
+        return 0;
+}
+
+/*******************************************************************************************************/
+int chanmap_depends(const chanmat_t *matrix, int channel, const int32_t *flag)
+{
+        for (int k = matrix->start[channel]; k < matrix->start[channel+1]; k++)
+                if (flag[matrix->index[k]])
+                        return 1;
+        return 0;
+}
+
+/*******************************************************************************************************/
+int chanmap_fading(chanmap_t *chanmap)
+{
+        return (chanmap->fadePosition < chanmap->fadeFrames);
+}
+
+/*******************************************************************************************************/
+float chanmap_fade(chanmap_t *chanmap)
+{
+        if (chanmap->fadePosition >= chanmap->fadeFrames)
+                return 1.0f;
+
+        float weight = (float)chanmap->fadePosition / chanmap->fadeFrames;
+        if (++chanmap->fadePosition == chanmap->fadeFrames)
+                atomic_store_explicit(&chanmap->fading, 0, memory_order_release);
+        return weight;
+}
+
+/*******************************************************************************************************/
+/* A plain selection or reordering is a gather. */
+KERNEL_INLINE void gather_kernel(const int *index, int inputCount, const float *input, float *output, unsigned long frames, const int outputCount)
+{
+        for (unsigned long i = 0; i < frames; i++)
+        {
+                const float *in = input + i * inputCount;
+                float *restrict out = output + i * outputCount;
+                for (int j = 0; j < outputCount; j++)
+                        out[j] = in[index[j]];
+        }
+}
+
+/*******************************************************************************************************/
+void chanmap_multiply(const chanmat_t *matrix, int inputCount, int outputCount, const float *input, float *output, unsigned long frames)
+{
+        const int *start = matrix->start;
+        const int *index = matrix->index;
+        const float *gain = matrix->gain;
+
+        if (matrix->identity && inputCount == outputCount)
+        {
+                /* all channels are passed on unchanged */
+                memcpy(output, input, frames * outputCount * sizeof(float));
+        }
+        else if (matrix->selection)
+        {
+                KERNEL_DISPATCH(outputCount, gather_kernel, index, inputCount, input, output, frames);
+        }
+        else
+        {
+                /* only the nonzero elements of each row are visited */
+                for (unsigned long i = 0; i < frames; i++)
+                {
+                        const float *in = input + i * inputCount;
+                        float *out = output + i * outputCount;
+                        for (int j = 0; j < outputCount; j++)
+                        {
+                                float sum = 0.0f;
+                                for (int k = start[j]; k < start[j+1]; k++)
+                                        sum += gain[k] * in[index[k]];
+                                out[j] = sum;
+                        }
+                }
+        }
+}
+
+/*******************************************************************************************************/
+void chanmap_apply(chanmap_t *chanmap, const float *input, float *output, unsigned long frames)
+{
+        chanmap_update(chanmap);
+        chanmap_multiply(&chanmap->matrix[chanmap->active], chanmap->inputCount, chanmap->outputCount, input, output, frames);
+
+        /* mixing the outputs of the two matrices is the same as mixing the matrices */
+        const chanmat_t *previous = &chanmap->matrix[1 - chanmap->active];
+        for (unsigned long i = 0; i < frames && chanmap->fadePosition < chanmap->fadeFrames; i++)
+        {
+                const float *in = input + i * chanmap->inputCount;
+                float *out = output + i * chanmap->outputCount;
+                float weight = (float)chanmap->fadePosition / chanmap->fadeFrames;
+                for (int j = 0; j < chanmap->outputCount; j++)
+                {
+                        float sum = 0.0f;
+                        for (int k = previous->start[j]; k < previous->start[j+1]; k++)
+                                sum += previous->gain[k] * in[previous->index[k]];
+                        out[j] = weight * out[j] + (1.0f - weight) * sum;
+                }
+                /* the last frame hands the previous matrix back to the control thread, hence this comes after reading it */
+                chanmap_fade(chanmap);
+        }
+}
@@ -0,0 +1,81 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef CHANMAP_H
+#define CHANMAP_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+/* A sparse matrix in compressed row format, each output channel is a weighted sum of a few
+   input channels. Output channel j consists of the terms start[j] up to start[j+1]. */
+typedef struct {
+        int *start;                     /* for each output channel the first term, outputCount+1 elements */
+        int *index;                     /* for each term the input channel */
+        float *gain;                    /* for each term the gain */
+        short selection;                /* all rows consist of a single term with unit gain */
+        short identity;                 /* the selection consists of the first channels in their order */
+} chanmat_t;
+
+/* The channel map is double buffered: the control thread writes the inactive matrix, the
+   real-time thread swaps them at the start of a block and crossfades from the old to the new. */
+typedef struct {
+        chanmat_t matrix[2];
+        int active;
+        int inputCount;
+        int outputCount;
+        int maxTerms;
+        atomic_int pending;             /* a new matrix is ready, written by control and cleared by real-time thread */
+        atomic_int fading;              /* the old matrix is still in use, cleared by real-time thread */
+        unsigned long fadeFrames;
+        unsigned long fadePosition;
+} chanmap_t;
+
+/* Check the specification and count the number of output channels and terms, the specification
+   is a comma-separated list of output channels, where each output is a sum of input channels.
+   For example "3,0:2,4-5,0.5*6+0.5*7" selects channel 3, the range 0 to 2, the bipolar derivation
+   between 4 and 5, and the average of 6 and 7. Channel numbers start at 0. */
+int chanmap_count(const char *spec, int inputCount, int *outputCount, int *termCount);
+
+/* Return the number of bytes that the channel map needs from the arena. */
+size_t chanmap_arena_size(int inputCount, int outputCount);
+
+/* Set up the channel map, the identity is used if the specification is NULL. */
+int chanmap_init(chanmap_t *chanmap, const char *spec, int inputCount, int outputCount, unsigned long fadeFrames, arena_t *arena);
+
+/* Prepare a new matrix, this is called from the control thread. */
+int chanmap_set(chanmap_t *chanmap, const char *spec);
+
+/* Swap the matrices at the start of a block, this returns 1 if a crossfade starts. */
+int chanmap_update(chanmap_t *chanmap);
+
+/* Return whether the matrices differ for the specified output channel. */
+int chanmap_changed(chanmap_t *chanmap, int channel);
+
+/* Return whether an output channel of the matrix depends on any of the input channels that are flagged. */
+int chanmap_depends(const chanmat_t *matrix, int channel, const int32_t *flag);
+
+/* Return whether the previous matrix is still being faded out. */
+int chanmap_fading(chanmap_t *chanmap);
+
+/* Return the weight of the active matrix during the crossfade and advance by one frame. */
+float chanmap_fade(chanmap_t *chanmap);
+
+/* Compute the output of a matrix for interleaved input and output. */
+void chanmap_multiply(const chanmat_t *matrix, int inputCount, int outputCount, const float *input, float *output, unsigned long frames);
+
+/* Apply the active matrix including the crossfade, this combines the functions above. */
+void chanmap_apply(chanmap_t *chanmap, const float *input, float *output, unsigned long frames);
+
+#endif
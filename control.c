@@ -0,0 +1,69 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "samplerate.h"
+#include "control.h"
+#include "thread.h"
+
+#define STRLEN        (80)
+
+static control_handler_t controlHandler = NULL;
+static thread_t controlThread;
+
+/*******************************************************************************************************/
+static void *control_thread(void *arg)
+{
+        char line[STRLEN], command[STRLEN], argument[STRLEN];
+
+        while (fgets(line, STRLEN, stdin))
+        {
+                command[0] = 0;
+                argument[0] = 0;
+                if (sscanf(line, "%79s %79[^\n]", command, argument) < 1)
+                        continue;
+                controlHandler(command, argument);
+        }
+
+        /* stdin was closed, the pipeline continues with its current settings */
+        return NULL;
+}
+
+/*******************************************************************************************************/
+int control_start(control_handler_t handler)
+{
+        controlHandler = handler;
+        return thread_create(&controlThread, control_thread, NULL);
+}
+
+/*******************************************************************************************************/
+int control_parse_converter(const char *argument)
+{
+        if (strcmp(argument, "best") == 0)
+                return SRC_SINC_BEST_QUALITY;
+        else if (strcmp(argument, "medium") == 0)
+                return SRC_SINC_MEDIUM_QUALITY;
+        else if (strcmp(argument, "fastest") == 0)
+                return SRC_SINC_FASTEST;
+        else if (strcmp(argument, "zoh") == 0)
+                return SRC_ZERO_ORDER_HOLD;
+        else if (strcmp(argument, "linear") == 0)
+                return SRC_LINEAR;
+        else if (isdigit(argument[0]) && src_get_name(atoi(argument)))
+                return atoi(argument);
+        else
+                return -1;
+}
@@ -0,0 +1,26 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+/* The handler is called on the control thread for each line that is typed on stdin, with the
+   first word as command and the remainder of the line as argument. It returns 0 on success. */
+typedef int (*control_handler_t)(const char *command, const char *argument);
+
+/* Start reading commands from stdin in a background thread. */
+int control_start(control_handler_t handler);
+
+/* Helper function to parse the name of the converter. */
+int control_parse_converter(const char *argument);
+
+#endif
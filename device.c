@@ -0,0 +1,259 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "device.h"
+#include "thread.h"
+
+static double lastAttempt = 0;
+static int lost = 0;
+
+/*******************************************************************************************************/
+/* The callback of the application is wrapped, such that a stalled stream can be detected. */
+static int device_callback(const void *input,
+                           void *output,
+                           unsigned long frameCount,
+                           const PaStreamCallbackTimeInfo* timeInfo,
+                           PaStreamCallbackFlags statusFlags,
+                           void *userData)
+{
+        device_t *device = (device_t *)userData;
+        atomic_fetch_add_explicit(&device->callbacks, 1, memory_order_relaxed);
+        return device->callback(input, output, frameCount, timeInfo, statusFlags, device->userData);
+}
+
+/*******************************************************************************************************/
+static void device_finished(void *userData)
+{
+        device_t *device = (device_t *)userData;
+        atomic_store(&device->finished, 1);
+}
+
+/*******************************************************************************************************/
+static PaError device_open_stream(device_t *device)
+{
+        PaStreamParameters *input = (device->parameters[0].channelCount ? &device->parameters[0] : NULL);
+        PaStreamParameters *output = (device->parameters[1].channelCount ? &device->parameters[1] : NULL);
+        PaError paErr;
+
+        if (input)
+                input->suggestedLatency = Pa_GetDeviceInfo(input->device)->defaultLowInputLatency;
+        if (output)
+                output->suggestedLatency = Pa_GetDeviceInfo(output->device)->defaultLowOutputLatency;
+
+        paErr = Pa_OpenStream(
+                &device->stream,
+                input,
+                output,
+                device->rate,
+                device->blocksize,
+                paNoFlag,
+                device_callback,
+                device);
+        if (paErr != paNoError)
+        {
+                device->stream = NULL;
+                return paErr;
+        }
+
+        atomic_store(&device->finished, 0);
+        return Pa_SetStreamFinishedCallback(device->stream, device_finished);
+}
+
+/*******************************************************************************************************/
+/* Set up the parameters for one direction, side 0 is the input and side 1 the output. */
+static PaError device_setup(device_t *device, int side, int index, int channelCount)
+{
+        device->parameters[side].device = index;
+        device->parameters[side].channelCount = channelCount;
+        device->parameters[side].sampleFormat = paFloat32;
+        device->parameters[side].hostApiSpecificStreamInfo = NULL;
+        device->name[side][0] = 0;
+        device->hostApi[side][0] = 0;
+
+        if (channelCount == 0)
+                return paNoError;
+
+        const PaDeviceInfo *deviceInfo = Pa_GetDeviceInfo(index);
+        if (deviceInfo == NULL)
+                return paInvalidDevice;
+
+        snprintf(device->name[side], DEVICENAME, "%s", deviceInfo->name);
+        snprintf(device->hostApi[side], DEVICENAME, "%s", Pa_GetHostApiInfo(deviceInfo->hostApi)->name);
+        return paNoError;
+}
+
+/*******************************************************************************************************/
+PaError device_open(device_t *device, int index, int input, int channelCount, double rate, unsigned long blocksize, PaStreamCallback *callback, void *userData)
+{
+        if (input)
+                return device_open_duplex(device, index, channelCount, paNoDevice, 0, rate, blocksize, callback, userData);
+        else
+                return device_open_duplex(device, paNoDevice, 0, index, channelCount, rate, blocksize, callback, userData);
+}
+
+/*******************************************************************************************************/
+PaError device_open_duplex(device_t *device, int inputIndex, int inputChannelCount, int outputIndex, int outputChannelCount, double rate, unsigned long blocksize, PaStreamCallback *callback, void *userData)
+{
+        PaError paErr;
+
+        device->stream = NULL;
+        device->rate = rate;
+        device->blocksize = blocksize;
+        /* with long blocks the callbacks are far apart, which is not a stall */
+        device->stall = DEVICEBLOCKS * blocksize / rate;
+        if (device->stall < DEVICESTALL)
+                device->stall = DEVICESTALL;
+        device->callback = callback;
+        device->userData = userData;
+        atomic_init(&device->callbacks, 0);
+        atomic_init(&device->finished, 0);
+
+        if ((paErr = device_setup(device, 0, inputIndex, inputChannelCount)) != paNoError)
+                return paErr;
+        if ((paErr = device_setup(device, 1, outputIndex, outputChannelCount)) != paNoError)
+                return paErr;
+
+        return device_open_stream(device);
+}
+
+/*******************************************************************************************************/
+const char *device_name(const device_t *device)
+{
+        return (device->parameters[0].channelCount ? device->name[0] : device->name[1]);
+}
+
+/*******************************************************************************************************/
+PaError device_start(device_t *device)
+{
+        device->lastCount = atomic_load(&device->callbacks);
+        device->lastChange = thread_now();
+        return Pa_StartStream(device->stream);
+}
+
+/*******************************************************************************************************/
+int device_lost(device_t *device)
+{
+        unsigned long count = atomic_load(&device->callbacks);
+        double now = thread_now();
+
+        if (device->stream == NULL || atomic_load(&device->finished) || Pa_IsStreamActive(device->stream) != 1)
+                return 1;
+
+        if (count != device->lastCount)
+        {
+                device->lastCount = count;
+                device->lastChange = now;
+        }
+
+        return (now - device->lastChange > device->stall);
+}
+
+/*******************************************************************************************************/
+int device_reopen(device_t **device, int count)
+{
+        double now = thread_now();
+        PaError paErr;
+
+        if (now - lastAttempt < DEVICERETRY)
+                return -1;
+        lastAttempt = now;
+
+        for (int i = 0; i < count; i++)
+        {
+                if (device[i]->stream)
+                {
+                        Pa_AbortStream(device[i]->stream);
+                        Pa_CloseStream(device[i]->stream);
+                }
+                device[i]->stream = NULL;
+        }
+
+        /* this enumerates the devices again */
+        Pa_Terminate();
+        if ((paErr = Pa_Initialize()) != paNoError)
+                return paErr;
+
+        for (int i = 0; i < count; i++)
+        {
+                for (int side = 0; side < 2; side++)
+                {
+                        if (device[i]->parameters[side].channelCount == 0)
+                                continue;
+
+                        /* look for the device with the same name and host API, it may have another index */
+                        int index = paNoDevice;
+                        for (int j = 0; j < Pa_GetDeviceCount() && index == paNoDevice; j++)
+                        {
+                                const PaDeviceInfo *deviceInfo = Pa_GetDeviceInfo(j);
+                                int channels = (side == 0 ? deviceInfo->maxInputChannels : deviceInfo->maxOutputChannels);
+                                if (strcmp(deviceInfo->name, device[i]->name[side]) == 0 &&
+                                    strcmp(Pa_GetHostApiInfo(deviceInfo->hostApi)->name, device[i]->hostApi[side]) == 0 &&
+                                    channels >= device[i]->parameters[side].channelCount)
+                                        index = j;
+                        }
+                        if (index == paNoDevice)
+                                return paDeviceUnavailable;
+
+                        device[i]->parameters[side].device = index;
+                }
+
+                if ((paErr = device_open_stream(device[i])) != paNoError)
+                        return paErr;
+        }
+
+        for (int i = 0; i < count; i++)
+                if ((paErr = device_start(device[i])) != paNoError)
+                        return paErr;
+
+        return paNoError;
+}
+
+/*******************************************************************************************************/
+int device_watch(device_t **device, int count)
+{
+        int failed = 0;
+
+        for (int i = 0; i < count; i++)
+                failed |= device_lost(device[i]);
+        if (!failed)
+                return 0;
+
+        if (!lost)
+                printf("WARNING: Lost the audio stream, waiting for the device to return.\n");
+        lost = 1;
+
+        if (device_reopen(device, count) != paNoError)
+                return 1;
+
+        printf("Reopened the audio stream on %s.\n", device_name(device[0]));
+        lost = 0;
+        return 0;
+}
+
+/*******************************************************************************************************/
+PaError device_close(device_t *device)
+{
+        PaError paErr;
+
+        if (device->stream == NULL)
+                return paNoError;
+
+        paErr = Pa_StopStream(device->stream);
+        if (paErr == paNoError)
+                paErr = Pa_CloseStream(device->stream);
+        device->stream = NULL;
+        return paErr;
+}
@@ -0,0 +1,73 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include <stdatomic.h>
+
+#include "portaudio.h"
+
+#define DEVICENAME      (256)
+#define DEVICESTALL     (0.2)   // in seconds, a stream without callbacks for this long is considered lost
+#define DEVICEBLOCKS    (3)     // the stall limit is at least this number of blocks
+#define DEVICERETRY     (0.25)  // in seconds, how often to look for a lost device
+
+/* An audio stream that remembers its device by name rather than by index, since the index changes
+   when a USB device is unplugged and plugged in again. If the stream fails or stops calling back,
+   it is opened again on the device with the same name and host API, with the same format, such
+   that the buffers and the resampler can continue. A full-duplex stream has an input and an
+   output device, which share the same rate and the same callback. */
+typedef struct {
+        PaStream *stream;
+        PaStreamParameters parameters[2];       /* for the input and the output, a channelCount of 0 means that it is not used */
+        double rate;
+        unsigned long blocksize;
+        PaStreamCallback *callback;
+        void *userData;
+        char name[2][DEVICENAME];
+        char hostApi[2][DEVICENAME];
+        atomic_ulong callbacks;         /* incremented for every block */
+        atomic_int finished;            /* set when PortAudio stops the stream */
+        unsigned long lastCount;
+        double lastChange;              /* time at which the number of callbacks last changed */
+        double stall;                   /* in seconds, the stall limit for the block size of the stream */
+} device_t;
+
+/* Open a stream on the device with the specified index. */
+PaError device_open(device_t *device, int index, int input, int channelCount, double rate, unsigned long blocksize, PaStreamCallback *callback, void *userData);
+
+/* Open a full-duplex stream on the input and output device with the specified indices. */
+PaError device_open_duplex(device_t *device, int inputIndex, int inputChannelCount, int outputIndex, int outputChannelCount, double rate, unsigned long blocksize, PaStreamCallback *callback, void *userData);
+
+/* Return the name of the device, or of the input device of a full-duplex stream. */
+const char *device_name(const device_t *device);
+
+/* Start the stream. */
+PaError device_start(device_t *device);
+
+/* Return 1 if the stream has failed or stalled, this is called regularly from the main thread. */
+int device_lost(device_t *device);
+
+/* Open all streams again on the devices with the same name. PortAudio only enumerates the devices
+   when it is initialized, hence all streams of the application are closed and reopened together.
+   This returns 0 on success, otherwise it should be called again later. */
+int device_reopen(device_t **device, int count);
+
+/* Check the streams and reopen them if one of them was lost, this is called regularly from the
+   main thread. This returns 1 while the streams are not running. */
+int device_watch(device_t **device, int count);
+
+/* Stop and close the stream. */
+PaError device_close(device_t *device);
+
+#endif
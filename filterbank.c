@@ -0,0 +1,261 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "filterbank.h"
+#include "kernel.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define NOTCHQ (30)   // default quality factor of the notch filter
+
+/*******************************************************************************************************/
+static const char *skip_space(const char *str)
+{
+        while (*str == ' ')
+                str++;
+        return str;
+}
+
+/*******************************************************************************************************/
+/* Add a section following the audio EQ cookbook by Robert Bristow-Johnson, the type is one of 'h'
+   for high-pass, 'l' for low-pass and 'n' for notch. */
+static int add_section(filterbank_t *filterbank, char type, double frequency, double q, double rate)
+{
+        double w0 = 2 * M_PI * frequency / rate;
+        double alpha = sin(w0) / (2 * q);
+        double cosw0 = cos(w0);
+        double a0 = 1 + alpha;
+        biquad_t *section;
+
+        if (filterbank->sectionCount == FILTERSECTIONS)
+                return -2;
+        section = &filterbank->section[filterbank->sectionCount++];
+
+        switch (type)
+        {
+                case 'h':
+                        section->b0 = (1 + cosw0) / 2 / a0;
+                        section->b1 = -(1 + cosw0) / a0;
+                        section->b2 = (1 + cosw0) / 2 / a0;
+                        break;
+                case 'l':
+                        section->b0 = (1 - cosw0) / 2 / a0;
+                        section->b1 = (1 - cosw0) / a0;
+                        section->b2 = (1 - cosw0) / 2 / a0;
+                        break;
+                case 'n':
+                        section->b0 = 1 / a0;
+                        section->b1 = -2 * cosw0 / a0;
+                        section->b2 = 1 / a0;
+                        break;
+        }
+        section->a1 = -2 * cosw0 / a0;
+        section->a2 = (1 - alpha) / a0;
+        return 0;
+}
+
+/*******************************************************************************************************/
+/* A Butterworth filter of even order is a cascade of second order sections with a different Q. */
+static int add_butterworth(filterbank_t *filterbank, char type, double frequency, int order, double rate)
+{
+        if (order < 2 || order % 2)
+                return -1;
+        for (int k = 1; k <= order / 2; k++)
+        {
+                double q = 1.0 / (2 * cos((2 * k - 1) * M_PI / (2 * order)));
+                if (add_section(filterbank, type, frequency, q, rate))
+                        return -2;
+        }
+        return 0;
+}
+
+/*******************************************************************************************************/
+int filterbank_init(filterbank_t *filterbank, const char *spec, int channelCount, float rate)
+{
+        const char *str;
+        char *end;
+
+        filterbank->sectionCount = 0;
+        filterbank->channelCount = channelCount;
+
+        if (spec == NULL)
+                return 0;
+
+        str = skip_space(spec);
+        while (*str)
+        {
+                char type[8];
+                int n = 0;
+                double low, high = 0, param = 0;
+
+                while (*str >= 'a' && *str <= 'z' && n < (int)sizeof(type) - 1)
+                        type[n++] = *str++;
+                type[n] = 0;
+                str = skip_space(str);
+                if (*str != ':')
+                        return -1;
+                str = skip_space(str + 1);
+
+                low = strtod(str, &end);
+                if (end == str)
+                        return -1;
+                str = skip_space(end);
+                if (strcmp(type, "bp") == 0)
+                {
+                        if (*str != '-')
+                                return -1;
+                        str = skip_space(str + 1);
+                        high = strtod(str, &end);
+                        if (end == str)
+                                return -1;
+                        str = skip_space(end);
+                }
+                if (*str == ':')
+                {
+                        str = skip_space(str + 1);
+                        param = strtod(str, &end);
+                        if (end == str)
+                                return -1;
+                        str = skip_space(end);
+                }
+
+                if (low <= 0 || low >= rate / 2 || (strcmp(type, "bp") == 0 && (high <= low || high >= rate / 2)))
+                        return -2;
+
+                if (strcmp(type, "hp") == 0)
+                        n = add_butterworth(filterbank, 'h', low, param ? param : 2, rate);
+                else if (strcmp(type, "lp") == 0)
+                        n = add_butterworth(filterbank, 'l', low, param ? param : 2, rate);
+                else if (strcmp(type, "bp") == 0)
+                {
+                        /* the band-pass filter is a cascade of a high-pass and a low-pass filter */
+                        n = add_butterworth(filterbank, 'h', low, param ? param : 2, rate);
+                        if (n == 0)
+                                n = add_butterworth(filterbank, 'l', high, param ? param : 2, rate);
+                }
+                else if (strcmp(type, "notch") == 0)
+                        n = add_section(filterbank, 'n', low, param ? param : NOTCHQ, rate);
+                else
+                        return -1;
+                if (n)
+                        return n;
+
+                if (*str == ',')
+                        str = skip_space(str + 1);
+                else if (*str)
+                        return -1;
+        }
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+size_t filterstate_arena_size(filterbank_t *filterbank)
+{
+        return 2 * arena_round(filterbank->sectionCount * filterbank->channelCount * sizeof(float));
+}
+
+/*******************************************************************************************************/
+int filterstate_init(filterbank_t *filterbank, filterstate_t *state, arena_t *arena)
+{
+        size_t size = filterbank->sectionCount * filterbank->channelCount * sizeof(float);
+
+        state->z1 = NULL;
+        state->z2 = NULL;
+        if (filterbank->sectionCount == 0)
+                return 0;
+
+        /* the arena memory is already zero, which corresponds to the filter being at rest */
+        state->z1 = arena_alloc(arena, size);
+        state->z2 = arena_alloc(arena, size);
+        if (!state->z1 || !state->z2)
+                return -1;
+        return 0;
+}
+
+/*******************************************************************************************************/
+void filterstate_reset(filterbank_t *filterbank, filterstate_t *state, int channel, float value)
+{
+        for (int s = 0; s < filterbank->sectionCount; s++)
+        {
+                biquad_t *section = &filterbank->section[s];
+                int k = s * filterbank->channelCount + channel;
+
+                /* the output of each section for a constant input is scaled with its DC gain */
+                float output = value * (section->b0 + section->b1 + section->b2) / (1 + section->a1 + section->a2);
+                state->z1[k] = output - section->b0 * value;
+                state->z2[k] = section->b2 * value - section->a2 * output;
+                value = output;
+        }
+}
+
+/*******************************************************************************************************/
+void filterstate_copy(filterbank_t *filterbank, filterstate_t *dest, const filterstate_t *src)
+{
+        size_t size = filterbank->sectionCount * filterbank->channelCount * sizeof(float);
+        if (size)
+        {
+                memcpy(dest->z1, src->z1, size);
+                memcpy(dest->z2, src->z2, size);
+        }
+}
+
+/*******************************************************************************************************/
+KERNEL_INLINE void filter_kernel(const biquad_t *section, int sectionCount, float *restrict z1, float *restrict z2, const float *input, float *output, unsigned long frames, const int channelCount)
+{
+        /* the frame is filtered in a local copy, which cannot alias the state and which the input and output may share */
+        float frame[channelCount];
+
+        for (unsigned long i = 0; i < frames; i++)
+        {
+                memcpy(frame, input + i * channelCount, channelCount * sizeof(float));
+
+                /* each section is applied to all channels at once, the channel loop has no dependencies
+                   and the coefficients are constant, which allows the compiler to vectorize it */
+                for (int s = 0; s < sectionCount; s++)
+                {
+                        const float b0 = section[s].b0;
+                        const float b1 = section[s].b1;
+                        const float b2 = section[s].b2;
+                        const float a1 = section[s].a1;
+                        const float a2 = section[s].a2;
+                        float *z1s = z1 + s * channelCount;
+                        float *z2s = z2 + s * channelCount;
+
+                        /* transposed direct form II */
+                        KERNEL_KEEP_LOOP
+                        for (int j = 0; j < channelCount; j++)
+                        {
+                                float x = frame[j];
+                                float y = b0 * x + z1s[j];
+                                z1s[j] = b1 * x - a1 * y + z2s[j];
+                                z2s[j] = b2 * x - a2 * y;
+                                frame[j] = y;
+                        }
+                }
+
+                memcpy(output + i * channelCount, frame, channelCount * sizeof(float));
+        }
+}
+
+/*******************************************************************************************************/
+void filterbank_process(filterbank_t *filterbank, filterstate_t *state, const float *input, float *output, unsigned long frames)
+{
+        KERNEL_DISPATCH(filterbank->channelCount, filter_kernel, filterbank->section, filterbank->sectionCount, state->z1, state->z2, input, output, frames);
+}
@@ -0,0 +1,60 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef FILTERBANK_H
+#define FILTERBANK_H
+
+#include "arena.h"
+
+#define FILTERSECTIONS (16)   // maximum number of biquad sections in the cascade
+
+/* The coefficients of a single biquad section, normalized such that a0 is one. */
+typedef struct {
+        float b0, b1, b2, a1, a2;
+} biquad_t;
+
+/* A cascade of biquad sections that is applied to all channels. The coefficients are shared,
+   the filter state is kept separately in a structure-of-arrays layout with the channels as
+   the fastest running index, so that the inner loop over channels can be vectorized. */
+typedef struct {
+        int sectionCount;
+        int channelCount;
+        biquad_t section[FILTERSECTIONS];
+} filterbank_t;
+
+/* The state of all sections, for each section z1 and z2 hold channelCount values. */
+typedef struct {
+        float *z1;
+        float *z2;
+} filterstate_t;
+
+/* Design the cascade from a comma-separated specification like "hp:1,lp:40:4,notch:50",
+   where each filter has a type, a frequency and optionally the order or the quality factor.
+   The types are hp, lp, bp (with the frequency range as low-high) and notch. */
+int filterbank_init(filterbank_t *filterbank, const char *spec, int channelCount, float rate);
+
+/* Return the number of bytes that the state needs from the arena. */
+size_t filterstate_arena_size(filterbank_t *filterbank);
+
+/* Set up the state, all channels start at rest. */
+int filterstate_init(filterbank_t *filterbank, filterstate_t *state, arena_t *arena);
+
+/* Set the state of one channel to the steady state for a constant input value. */
+void filterstate_reset(filterbank_t *filterbank, filterstate_t *state, int channel, float value);
+
+/* Copy the state of all channels. */
+void filterstate_copy(filterbank_t *filterbank, filterstate_t *dest, const filterstate_t *src);
+
+/* Filter interleaved samples, the input and output can be the same. */
+void filterbank_process(filterbank_t *filterbank, filterstate_t *state, const float *input, float *output, unsigned long frames);
+
+#endif
@@ -0,0 +1,128 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+#include <stdio.h>
+
+#include "samplerate.h"
+#include "governor.h"
+
+#define smooth(old, new, lambda) ((1.0-lambda)*(old) + (lambda)*(new))
+
+/* the converters from high to low quality, the zero-order hold is below all of them */
+static const int ladder[] = {SRC_SINC_BEST_QUALITY, SRC_SINC_MEDIUM_QUALITY, SRC_SINC_FASTEST, SRC_LINEAR};
+#define LEVELS (sizeof(ladder) / sizeof(ladder[0]))
+
+/*******************************************************************************************************/
+static int governor_rank(int converter)
+{
+        for (int i = 0; i < LEVELS; i++)
+                if (ladder[i] == converter)
+                        return i;
+        return LEVELS;
+}
+
+/*******************************************************************************************************/
+void governor_init(governor_t *governor, int converter, int enabled)
+{
+        atomic_store_explicit(&governor->busy, 0, memory_order_relaxed);
+        atomic_store_explicit(&governor->elapsed, 0, memory_order_relaxed);
+        atomic_store_explicit(&governor->selected, converter, memory_order_relaxed);
+        governor->enabled = enabled;
+        governor->ceiling = converter;
+        governor->converter = converter;
+        governor->load = 0;
+        governor->lastBusy = 0;
+        governor->lastElapsed = 0;
+        governor->lastTime = 0;
+        governor->highSince = 0;
+        governor->lowSince = 0;
+        governor->steps = 0;
+}
+
+/*******************************************************************************************************/
+void governor_measure(governor_t *governor, double busy, double duration)
+{
+        /* there is a single writer, hence the sums do not need a read-modify-write */
+        atomic_store_explicit(&governor->busy, atomic_load_explicit(&governor->busy, memory_order_relaxed) + busy, memory_order_relaxed);
+        atomic_store_explicit(&governor->elapsed, atomic_load_explicit(&governor->elapsed, memory_order_relaxed) + duration, memory_order_relaxed);
+}
+
+/*******************************************************************************************************/
+void governor_select(governor_t *governor, int converter)
+{
+        atomic_store_explicit(&governor->selected, converter, memory_order_relaxed);
+}
+
+/*******************************************************************************************************/
+int governor_update(governor_t *governor, double now)
+{
+        double busy = atomic_load_explicit(&governor->busy, memory_order_relaxed);
+        double elapsed = atomic_load_explicit(&governor->elapsed, memory_order_relaxed);
+        int selected = atomic_load_explicit(&governor->selected, memory_order_relaxed);
+
+        if (elapsed > governor->lastElapsed)
+        {
+                double load = (busy - governor->lastBusy) / (elapsed - governor->lastElapsed);
+                double lambda = (elapsed - governor->lastElapsed) / GOVERNORSMOOTH;
+                governor->load = smooth(governor->load, load, (lambda < 1 ? lambda : 1));
+        }
+        governor->lastBusy = busy;
+        governor->lastElapsed = elapsed;
+        governor->lastTime = now;
+
+        /* a new selection of the user is followed right away */
+        if (selected != governor->ceiling)
+        {
+                governor->ceiling = selected;
+                governor->converter = selected;
+                governor->highSince = 0;
+                governor->lowSince = 0;
+                return governor->converter;
+        }
+        if (!governor->enabled)
+                return governor->converter;
+
+        int rank = governor_rank(governor->converter);
+
+        if (governor->load > GOVERNORHIGH && rank + 1 < LEVELS)
+        {
+                governor->lowSince = 0;
+                if (governor->highSince == 0)
+                        governor->highSince = now;
+                else if (now - governor->highSince >= GOVERNORDOWN)
+                {
+                        governor->converter = ladder[rank + 1];
+                        governor->highSince = 0;
+                        governor->steps++;
+                        printf("Load is %.0f%% of the block duration, lowered the quality to %s\n", 100 * governor->load, src_get_name(governor->converter));
+                }
+        }
+        else if (governor->load < GOVERNORLOW && rank > governor_rank(governor->ceiling))
+        {
+                governor->highSince = 0;
+                if (governor->lowSince == 0)
+                        governor->lowSince = now;
+                else if (now - governor->lowSince >= GOVERNORUP)
+                {
+                        governor->converter = ladder[rank - 1];
+                        governor->lowSince = 0;
+                        governor->steps++;
+                        printf("Load is %.0f%% of the block duration, raised the quality to %s\n", 100 * governor->load, src_get_name(governor->converter));
+                }
+        }
+        else
+        {
+                governor->highSince = 0;
+                governor->lowSince = 0;
+        }
+
+        return governor->converter;
+}
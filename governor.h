@@ -0,0 +1,53 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include <stdatomic.h>
+
+#define GOVERNORHIGH   (0.7)    // fraction of the block duration above which the quality is lowered
+#define GOVERNORLOW    (0.3)    // fraction of the block duration below which the quality is raised again
+#define GOVERNORDOWN   (0.5)    // in seconds, how long the load must be high before the quality is lowered
+#define GOVERNORUP     (10.0)   // in seconds, how long the load must be low before the quality is raised
+#define GOVERNORSMOOTH (0.5)    // in seconds, time constant of the load estimate
+
+/* The governor measures which fraction of the block duration the real-time callback uses. When
+   that stays too high, it lowers the quality of the converter one step at a time from best to
+   medium, fastest and linear, and when there is headroom again it raises it back to the converter
+   that the user selected. The converter is changed by the main thread, which makes the resampler
+   crossfade at a block boundary. Without the governor, only the selection of the user is used. */
+typedef struct {
+        _Atomic double busy;            /* total time spent in the callback, written by the real-time thread */
+        _Atomic double elapsed;         /* total duration of the blocks, written by the real-time thread */
+        atomic_int selected;            /* the converter that the user selected, written by the control thread */
+        int enabled;
+        int ceiling;                    /* the most recent selection that was seen by the main thread */
+        int converter;                  /* the converter that should be used */
+        double load;                    /* the smoothed fraction of the block duration */
+        double lastBusy, lastElapsed, lastTime;
+        double highSince, lowSince;     /* start of the current period with a high or low load, 0 if none */
+        unsigned long steps;            /* number of times that the quality was changed */
+} governor_t;
+
+/* Set up the governor, which starts with the specified converter. */
+void governor_init(governor_t *governor, int converter, int enabled);
+
+/* Add the time spent on a block of the specified duration, this is called from the real-time thread. */
+void governor_measure(governor_t *governor, double busy, double duration);
+
+/* Select the highest quality that may be used, this is called from the control thread. */
+void governor_select(governor_t *governor, int converter);
+
+/* Update the load estimate and return the converter that should be used, this is called regularly from the main thread. */
+int governor_update(governor_t *governor, double now);
+
+#endif
@@ -0,0 +1,366 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "halfband.h"
+#include "kernel.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*******************************************************************************************************/
+/* Modified Bessel function of the first kind, for the Kaiser window. */
+static double bessel_i0(double x)
+{
+        double sum = 1, term = 1;
+        for (int k = 1; k < 50; k++)
+        {
+                term *= (x / (2 * k)) * (x / (2 * k));
+                sum += term;
+        }
+        return sum;
+}
+
+/*******************************************************************************************************/
+/* Return the input frame that is used for the frame that lies k frames before the start, the input
+   is reflected back and forth if it is shorter than that. */
+static unsigned long reflect(unsigned long k, unsigned long frames)
+{
+        unsigned long period = 2 * (frames - 1);
+        if (frames < 2)
+                return 0;
+        k %= period;
+        return (k < frames ? k : period - k);
+}
+
+/*******************************************************************************************************/
+static void halfband_prime(halfband_t *halfband, char *buffer, const char *input, unsigned long frames, int history, size_t frameSize)
+{
+        for (int j = 0; j < history; j++)
+                memcpy(buffer + j * frameSize, input + reflect(history - j, frames) * frameSize, frameSize);
+        halfband->primed = 1;
+}
+
+/*******************************************************************************************************/
+static int16_t saturate(int32_t value)
+{
+        return (value > INT16_MAX ? INT16_MAX : (value < INT16_MIN ? INT16_MIN : value));
+}
+
+/*******************************************************************************************************/
+int halfband_depth(double inputRate, double outputRate)
+{
+        /* the fractional resampler that follows the cascade should not have to downsample by more than a factor two */
+        int depth = 0;
+        while (depth < HALFBANDSTAGES && inputRate / 2 >= 2 * outputRate)
+        {
+                inputRate /= 2;
+                depth++;
+        }
+        return depth;
+}
+
+/*******************************************************************************************************/
+int halfband_taps(double rate, double passband)
+{
+        /* the band from rate/2-passband to rate/2 folds back onto the protected band */
+        double transition = (rate / 2 - 2 * passband) / rate;
+        int taps;
+
+        if (transition <= 0)
+                return HALFBANDMAXTAPS;
+
+        /* the estimate of the Kaiser window length, rounded up to the form 4k+3 */
+        taps = ceil((HALFBANDATTENUATION - 7.95) / (2.285 * 2 * M_PI * transition)) + 1;
+        taps = 4 * ((taps + 1) / 4) + 3;
+        return (taps > HALFBANDMAXTAPS ? HALFBANDMAXTAPS : taps);
+}
+
+/*******************************************************************************************************/
+size_t halfband_arena_size(int taps, int channelCount, unsigned long maxFrames, int fixedPoint)
+{
+        size_t sampleSize = (fixedPoint ? sizeof(int16_t) : sizeof(float));
+        size_t size = arena_round((taps + 1) / 4 * sizeof(float)) + arena_round((taps - 1 + maxFrames) * channelCount * sampleSize);
+        if (fixedPoint)
+                size += arena_round((taps + 1) / 4 * sizeof(int16_t));
+        return size;
+}
+
+/*******************************************************************************************************/
+int halfband_init(halfband_t *halfband, int taps, int channelCount, unsigned long maxFrames, int fixedPoint, arena_t *arena)
+{
+        int count = (taps + 1) / 4;
+        double beta = 0.1102 * (HALFBANDATTENUATION - 8.7);
+        double sum = 0;
+
+        halfband->taps = taps;
+        halfband->channelCount = channelCount;
+        halfband->maxFrames = maxFrames;
+        halfband->phase = 0;
+        halfband->primed = 0;
+        halfband->fixedPoint = fixedPoint;
+        halfband->buffer = NULL;
+        halfband->coefFixed = NULL;
+        halfband->bufferFixed = NULL;
+
+        halfband->coef = arena_alloc(arena, count * sizeof(float));
+        if (fixedPoint)
+        {
+                halfband->coefFixed = arena_alloc(arena, count * sizeof(int16_t));
+                halfband->bufferFixed = arena_alloc(arena, (taps - 1 + maxFrames) * channelCount * sizeof(int16_t));
+                if (!halfband->coefFixed || !halfband->bufferFixed)
+                        return -1;
+                memset(halfband->bufferFixed, 0, (taps - 1) * channelCount * sizeof(int16_t));
+        }
+        else
+        {
+                halfband->buffer = arena_alloc(arena, (taps - 1 + maxFrames) * channelCount * sizeof(float));
+                if (!halfband->buffer)
+                        return -1;
+                memset(halfband->buffer, 0, (taps - 1) * channelCount * sizeof(float));
+        }
+        if (!halfband->coef)
+                return -1;
+
+        /* the ideal halfband filter with a Kaiser window, the coefficient k is at distance 2k+1 from the centre */
+        for (int k = 0; k < count; k++)
+        {
+                double n = 2 * k + 1;
+                double r = n / ((taps - 1) / 2.0);
+                double window = bessel_i0(beta * sqrt(1 - r * r)) / bessel_i0(beta);
+                halfband->coef[k] = sin(M_PI * n / 2) / (M_PI * n) * window;
+                sum += 2 * halfband->coef[k];
+        }
+
+        /* the DC gain is exactly one */
+        for (int k = 0; k < count; k++)
+                halfband->coef[k] *= 0.5 / sum;
+
+        if (fixedPoint)
+        {
+                /* the rounding error of the DC gain is moved to the largest coefficient */
+                int32_t total = 0;
+                for (int k = 0; k < count; k++)
+                {
+                        halfband->coefFixed[k] = lrint(halfband->coef[k] * 32768);
+                        total += 2 * halfband->coefFixed[k];
+                }
+                halfband->coefFixed[0] += (16384 - total) / 2;
+        }
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+KERNEL_INLINE void decimate_kernel(const halfband_t *halfband, unsigned long frames, float *output, const int channelCount)
+{
+        int centre = (halfband->taps - 1) / 2;
+        int count = (halfband->taps + 1) / 4;
+        unsigned long produced = 0;
+
+        for (unsigned long i = halfband->phase; i < frames; i += 2)
+        {
+                /* the filter ends at the new frame i, its centre is half the filter length earlier */
+                const float *x = halfband->buffer + (i + centre) * channelCount;
+                float *restrict y = output + produced * channelCount;
+
+                for (int j = 0; j < channelCount; j++)
+                        y[j] = 0.5f * x[j];
+
+                for (int k = 0; k < count; k++)
+                {
+                        const float c = halfband->coef[k];
+                        const float *before = x - (2 * k + 1) * channelCount;
+                        const float *after = x + (2 * k + 1) * channelCount;
+                        for (int j = 0; j < channelCount; j++)
+                                y[j] += c * (before[j] + after[j]);
+                }
+                produced++;
+        }
+}
+
+/*******************************************************************************************************/
+KERNEL_INLINE void interpolate_kernel(const halfband_t *halfband, unsigned long frames, float *output, const int channelCount)
+{
+        int count = (halfband->taps + 1) / 4;
+
+        for (unsigned long i = 0; i < frames; i++)
+        {
+                /* the new frame i completes the filter for the point halfway between frames i-count and i-count+1,
+                   the even output frame falls on an input frame, where the polyphase component is the centre tap only */
+                const float *x = halfband->buffer + (i + count - 1) * channelCount;
+                float *restrict even = output + 2 * i * channelCount;
+                float *restrict odd = even + channelCount;
+
+                for (int j = 0; j < channelCount; j++)
+                {
+                        even[j] = x[j];
+                        odd[j] = 0;
+                }
+
+                for (int k = 0; k < count; k++)
+                {
+                        const float c = 2 * halfband->coef[k];
+                        const float *before = x - k * channelCount;
+                        const float *after = x + (k + 1) * channelCount;
+                        for (int j = 0; j < channelCount; j++)
+                                odd[j] += c * (before[j] + after[j]);
+                }
+        }
+}
+
+/*******************************************************************************************************/
+KERNEL_INLINE void decimate_fixed_kernel(const halfband_t *halfband, unsigned long frames, int16_t *output, const int channelCount)
+{
+        int centre = (halfband->taps - 1) / 2;
+        int count = (halfband->taps + 1) / 4;
+        unsigned long produced = 0;
+
+        for (unsigned long i = halfband->phase; i < frames; i += 2)
+        {
+                const int16_t *x = halfband->bufferFixed + (i + centre) * channelCount;
+                int16_t *restrict y = output + produced * channelCount;
+                int32_t sum[channelCount];
+
+                /* the centre coefficient of 0.5 is 16384 in Q15, the half of the last bit is for rounding */
+                for (int j = 0; j < channelCount; j++)
+                        sum[j] = 16384 * (int32_t)x[j] + 16384;
+
+                for (int k = 0; k < count; k++)
+                {
+                        const int32_t c = halfband->coefFixed[k];
+                        const int16_t *before = x - (2 * k + 1) * channelCount;
+                        const int16_t *after = x + (2 * k + 1) * channelCount;
+                        for (int j = 0; j < channelCount; j++)
+                                sum[j] += c * ((int32_t)before[j] + after[j]);
+                }
+
+                for (int j = 0; j < channelCount; j++)
+                        y[j] = saturate(sum[j] >> 15);
+                produced++;
+        }
+}
+
+/*******************************************************************************************************/
+KERNEL_INLINE void interpolate_fixed_kernel(const halfband_t *halfband, unsigned long frames, int16_t *output, const int channelCount)
+{
+        int count = (halfband->taps + 1) / 4;
+
+        for (unsigned long i = 0; i < frames; i++)
+        {
+                const int16_t *x = halfband->bufferFixed + (i + count - 1) * channelCount;
+                int16_t *restrict even = output + 2 * i * channelCount;
+                int16_t *restrict odd = even + channelCount;
+                int32_t sum[channelCount];
+
+                for (int j = 0; j < channelCount; j++)
+                {
+                        even[j] = x[j];
+                        sum[j] = 16384;
+                }
+
+                for (int k = 0; k < count; k++)
+                {
+                        const int32_t c = 2 * halfband->coefFixed[k];
+                        const int16_t *before = x - k * channelCount;
+                        const int16_t *after = x + (k + 1) * channelCount;
+                        for (int j = 0; j < channelCount; j++)
+                                sum[j] += c * ((int32_t)before[j] + after[j]);
+                }
+
+                for (int j = 0; j < channelCount; j++)
+                        odd[j] = saturate(sum[j] >> 15);
+        }
+}
+
+/*******************************************************************************************************/
+unsigned long halfband_decimate(halfband_t *halfband, const float *input, unsigned long frames, float *output)
+{
+        int channelCount = halfband->channelCount;
+        int history = halfband->taps - 1;
+
+        if (!halfband->primed && frames > 0)
+                halfband_prime(halfband, (char *)halfband->buffer, (const char *)input, frames, history, channelCount * sizeof(float));
+        memcpy(halfband->buffer + history * channelCount, input, frames * channelCount * sizeof(float));
+
+        KERNEL_DISPATCH(channelCount, decimate_kernel, halfband, frames, output);
+
+        /* every other input frame yields an output frame, starting at the phase */
+        unsigned long produced = (frames + 1 - halfband->phase) / 2;
+        halfband->phase = (halfband->phase + frames) % 2;
+
+        /* keep the most recent frames as history for the next call */
+        memmove(halfband->buffer, halfband->buffer + frames * channelCount, history * channelCount * sizeof(float));
+
+        return produced;
+}
+
+/*******************************************************************************************************/
+unsigned long halfband_interpolate(halfband_t *halfband, const float *input, unsigned long frames, float *output)
+{
+        int channelCount = halfband->channelCount;
+        int count = (halfband->taps + 1) / 4;
+        int history = 2 * count - 1;
+
+        if (!halfband->primed && frames > 0)
+                halfband_prime(halfband, (char *)halfband->buffer, (const char *)input, frames, history, channelCount * sizeof(float));
+        memcpy(halfband->buffer + history * channelCount, input, frames * channelCount * sizeof(float));
+
+        KERNEL_DISPATCH(channelCount, interpolate_kernel, halfband, frames, output);
+
+        /* keep the most recent frames as history for the next call */
+        memmove(halfband->buffer, halfband->buffer + frames * channelCount, history * channelCount * sizeof(float));
+
+        return 2 * frames;
+}
+
+/*******************************************************************************************************/
+unsigned long halfband_decimate_fixed(halfband_t *halfband, const int16_t *input, unsigned long frames, int16_t *output)
+{
+        int channelCount = halfband->channelCount;
+        int history = halfband->taps - 1;
+
+        if (!halfband->primed && frames > 0)
+                halfband_prime(halfband, (char *)halfband->bufferFixed, (const char *)input, frames, history, channelCount * sizeof(int16_t));
+        memcpy(halfband->bufferFixed + history * channelCount, input, frames * channelCount * sizeof(int16_t));
+
+        KERNEL_DISPATCH(channelCount, decimate_fixed_kernel, halfband, frames, output);
+
+        unsigned long produced = (frames + 1 - halfband->phase) / 2;
+        halfband->phase = (halfband->phase + frames) % 2;
+
+        memmove(halfband->bufferFixed, halfband->bufferFixed + frames * channelCount, history * channelCount * sizeof(int16_t));
+
+        return produced;
+}
+
+/*******************************************************************************************************/
+unsigned long halfband_interpolate_fixed(halfband_t *halfband, const int16_t *input, unsigned long frames, int16_t *output)
+{
+        int channelCount = halfband->channelCount;
+        int history = 2 * ((halfband->taps + 1) / 4) - 1;
+
+        if (!halfband->primed && frames > 0)
+                halfband_prime(halfband, (char *)halfband->bufferFixed, (const char *)input, frames, history, channelCount * sizeof(int16_t));
+        memcpy(halfband->bufferFixed + history * channelCount, input, frames * channelCount * sizeof(int16_t));
+
+        KERNEL_DISPATCH(channelCount, interpolate_fixed_kernel, halfband, frames, output);
+
+        memmove(halfband->bufferFixed, halfband->bufferFixed + frames * channelCount, history * channelCount * sizeof(int16_t));
+
+        return 2 * frames;
+}
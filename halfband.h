@@ -0,0 +1,73 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef HALFBAND_H
+#define HALFBAND_H
+
+#include <stdint.h>
+
+#include "arena.h"
+
+#define HALFBANDATTENUATION (90.0)      // stopband attenuation in dB
+#define HALFBANDMAXTAPS     (127)       // the longest filter, for a passband that extends almost to Nyquist
+#define HALFBANDSTAGES      (16)        // maximum number of stages in a cascade
+
+/* A halfband FIR filter that changes the rate by a factor two. Every other coefficient is zero
+   except for the centre one, which is 0.5, so only the odd coefficients on one side are stored.
+   The filter length is chosen for the band that needs to be protected: an early stage in a long
+   cascade only needs to protect a small part of its band and can be very short. The same filter
+   removes the images when interpolating by a factor two.
+
+   In fixed point the samples and the coefficients are in Q15 and the products are summed in 32
+   bits, which cannot overflow since the absolute coefficients of a halfband filter sum to less
+   than 1.3. This is for processors without a floating point unit; the noise floor is that of
+   16 bits, around -96 dB. */
+typedef struct {
+        int taps;                       /* total length, of the form 4k+3 */
+        float *coef;                    /* the (taps+1)/4 non-zero coefficients on one side, excluding the centre */
+        int channelCount;
+        float *buffer;                  /* taps-1 frames of history followed by the new input */
+        unsigned long maxFrames;        /* largest number of input frames in a single call */
+        int phase;                      /* whether the next input frame yields an output frame */
+        int primed;                     /* whether the history has been filled */
+        int fixedPoint;                 /* whether the fixed-point functions are used */
+        int16_t *coefFixed;             /* the coefficients in Q15 */
+        int16_t *bufferFixed;           /* the history and input in Q15 */
+} halfband_t;
+
+/* Return the number of stages by which the rate can be halved while it stays at least twice the output rate. */
+int halfband_depth(double inputRate, double outputRate);
+
+/* Return the number of taps that is needed at the specified input rate to protect the band up to passband. */
+int halfband_taps(double rate, double passband);
+
+/* Return the number of bytes that the filter needs from the arena. */
+size_t halfband_arena_size(int taps, int channelCount, unsigned long maxFrames, int fixedPoint);
+
+/* Set up the filter, either for floating point or for fixed point input and output. */
+int halfband_init(halfband_t *halfband, int taps, int channelCount, unsigned long maxFrames, int fixedPoint, arena_t *arena);
+
+/* Filter and decimate interleaved input by a factor two, this returns the number of output frames.
+   The history of the first call is a reflection of its input, so that there is no transient. The
+   output is delayed by (taps-1)/2 input frames. */
+unsigned long halfband_decimate(halfband_t *halfband, const float *input, unsigned long frames, float *output);
+
+/* Interpolate interleaved input by a factor two, this returns 2*frames output frames. A filter
+   should be used either for decimation or for interpolation, not for both. The output is delayed
+   by (taps+1)/4 input frames. */
+unsigned long halfband_interpolate(halfband_t *halfband, const float *input, unsigned long frames, float *output);
+
+/* The same as halfband_decimate and halfband_interpolate, in fixed point. */
+unsigned long halfband_decimate_fixed(halfband_t *halfband, const int16_t *input, unsigned long frames, int16_t *output);
+unsigned long halfband_interpolate_fixed(halfband_t *halfband, const int16_t *input, unsigned long frames, int16_t *output);
+
+#endif
@@ -0,0 +1,50 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+#ifndef KERNEL_H
+#define KERNEL_H
+
+/* The inner loops over the channels are compiled separately for the channel counts that are
+   common in practice, so that the compiler knows the count and can unroll and vectorize them.
+   A kernel is an inline function with the channel count as its last argument, which is only
+   called through KERNEL_DISPATCH. Other channel counts use the generic version. */
+#if defined __GNUC__ || defined __clang__
+#define KERNEL_INLINE static inline __attribute__((always_inline))
+#elif defined _MSC_VER
+#define KERNEL_INLINE static __forceinline
+#else
+#define KERNEL_INLINE static inline
+#endif
+
+/* GCC completely unrolls a short channel loop of known count before it is vectorized, which
+   leaves scalar code where a loop carries state from one frame to the next. This marks such a
+   loop to be kept, so that it is vectorized instead. */
+#if defined __GNUC__ && !defined __clang__
+#define KERNEL_KEEP_LOOP _Pragma("GCC unroll 1")
+#else
+#define KERNEL_KEEP_LOOP
+#endif
+
+#define KERNEL_DISPATCH(count, kernel, ...) \
+        switch (kernelGeneric ? 0 : (count)) \
+        { \
+        case 1:  kernel(__VA_ARGS__, 1);  break; \
+        case 2:  kernel(__VA_ARGS__, 2);  break; \
+        case 8:  kernel(__VA_ARGS__, 8);  break; \
+        case 32: kernel(__VA_ARGS__, 32); break; \
+        case 64: kernel(__VA_ARGS__, 64); break; \
+        default: kernel(__VA_ARGS__, (count)); break; \
+        }
+
+/* Set this to use the generic kernels for all channel counts, for comparison in the benchmark. */
+extern int kernelGeneric;
+
+#endif
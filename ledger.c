@@ -0,0 +1,68 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdio.h>
+#include <math.h>
+
+#include "ledger.h"
+
+/*******************************************************************************************************/
+void ledger_init(ledger_t *ledger)
+{
+        ledger->input = 0;
+        ledger->output = 0;
+        ledger->whole = 0;
+        ledger->fraction = 0;
+        ledger->ratio = 1;
+}
+
+/*******************************************************************************************************/
+void ledger_add(ledger_t *ledger, uint64_t input, uint64_t output, double ratio)
+{
+        /* only the fraction is carried in floating point, it cannot accumulate a rounding error */
+        double expected = ledger->fraction + input * ratio;
+        double whole = floor(expected);
+
+        ledger->input += input;
+        ledger->output += output;
+        ledger->whole += (uint64_t)whole;
+        ledger->fraction = expected - whole;
+        ledger->ratio = ratio;
+}
+
+/*******************************************************************************************************/
+double ledger_offset(const ledger_t *ledger)
+{
+        /* the difference of the counts is small and can be negative */
+        return (double)(int64_t)(ledger->output - ledger->whole) - ledger->fraction;
+}
+
+/*******************************************************************************************************/
+double ledger_chain(const ledger_t *ledger, int count)
+{
+        double offset = 0;
+        for (int k = 0; k < count; k++)
+                offset = offset * ledger[k].ratio + ledger_offset(&ledger[k]);
+        return offset;
+}
+
+/*******************************************************************************************************/
+void ledger_print(const char **name, const ledger_t *ledger, int count, double nominal)
+{
+        for (int k = 0; k < count; k++)
+                printf("%-12s input = %llu, output = %llu, ratio = %.6f, offset = %.2f\n", name[k],
+                       (unsigned long long)ledger[k].input, (unsigned long long)ledger[k].output, ledger[k].ratio, ledger_offset(&ledger[k]));
+
+        /* the input is not more than about 1e11 frames per month, hence the product is accurate to far below a frame */
+        double drift = (double)ledger[count - 1].output - (double)ledger[0].input * nominal;
+        printf("%-12s offset = %.2f, drift correction = %.2f frames\n", "total", ledger_chain(ledger, count), drift - ledger_chain(ledger, count));
+}
@@ -0,0 +1,50 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef LEDGER_H
+#define LEDGER_H
+
+#include <stdint.h>
+
+/* The frame accounting of a single stage of a pipeline. The counts have 64 bits, so that they do
+   not wrap in a run of days, also where an unsigned long has only 32 bits. The output that the
+   ratio prescribes for the input is kept as a whole number of frames plus a fraction, hence it
+   stays exact however long the run is. The offset of a stage is its actual minus its prescribed
+   output, which consists of its delay plus the frames that it inserted or dropped. It stays
+   bounded as long as nothing is lost. */
+typedef struct {
+        uint64_t input;                 /* frames that entered the stage */
+        uint64_t output;                /* frames that left the stage */
+        uint64_t whole;                 /* whole frames of output that the ratio prescribes */
+        double fraction;                /* and the remaining fraction of a frame */
+        double ratio;                   /* the most recent ratio */
+} ledger_t;
+
+/* Set the counts to zero and the ratio to one. */
+void ledger_init(ledger_t *ledger);
+
+/* Account for the frames that entered and left the stage, the ratio is the one that was applied
+   to the input. This is real-time safe. */
+void ledger_add(ledger_t *ledger, uint64_t input, uint64_t output, double ratio);
+
+/* Return the actual minus the prescribed output of the stage. */
+double ledger_offset(const ledger_t *ledger);
+
+/* Return the offset of a chain of stages in frames at the output of the last one, the offset of
+   each stage is carried through the ratios of the stages that follow it. */
+double ledger_chain(const ledger_t *ledger, int count);
+
+/* Print each stage and the totals of the chain, nominal is the ratio of the last output to the
+   first input that the chain would have without any correction for the clock drift. */
+void ledger_print(const char **name, const ledger_t *ledger, int count, double nominal);
+
+#endif
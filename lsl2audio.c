@@ -13,6 +13,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include <math.h>
 
 #if defined __linux__ || defined __APPLE__
@@ -27,53 +28,161 @@
 #include "portaudio.h"
 #include "samplerate.h"
 #include "lsl_c.h"
+#include "arena.h"
+#include "chanmap.h"
+#include "resampler.h"
+#include "control.h"
+#include "options.h"
+#include "agc.h"
+#include "filterbank.h"
+#include "sonify.h"
+#include "mixer.h"
+#include "recorder.h"
+#include "replay.h"
+#include "planner.h"
+#include "device.h"
+#include "ring.h"
+#include "seqlock.h"
+#include "stretch.h"
+#include "governor.h"
+#include "ledger.h"
+#include "scrub.h"
+#include "thread.h"
+#include "trace.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
 
 #define smooth(old, new, lambda) ((1.0-lambda)*(old) + (lambda)*(new))
 
 #define STRLEN        (80)
-#define SAMPLETYPE    paFloat32
 #define BLOCKSIZE     (0.01)  // in seconds
 #define BUFFERSIZE    (2.00)  // in seconds
 #define DEFAULTRATE   (44100.0)
 #define TIMEOUT       (3.0)   // for LSL
 #define STREAMCOUNT   (32)    //maximum number of LSL streams
 #define HPFILTER      (10.0)
+#define CROSSFADE     (0.05)  // in seconds
+#define CRITICALFILL  (0.1)   // fraction of the output buffer below or above which the ratio makes an excursion
+#define EXCURSION     (0.02)  // relative change of the ratio during an excursion
+#define AGCATTACK     (0.01)  // in seconds
+#define AGCRELEASE    (5.0)   // in seconds
+#define AGCWINDOW     (0.1)   // in seconds, this is also the look-ahead
+#define GAPTHRESHOLD  (4.0)   // in samples, a larger step between timestamps is a gap
+#define GAPFADE       (0.02)  // in seconds, time constant for fading out during a gap
+#define PULLTIMEOUT   (0.1)   // in seconds, a longer wait for the next sample is a stall
+#define RESOLVEFORGET (5.0)   // in seconds, for the continuous resolver
+#define WATCHINTERVAL (0.1)   // in seconds, how often the audio device is checked
+
+/* how the samples that are missing in a gap are replaced */
+#define CONCEAL_FADE        (0)
+#define CONCEAL_HOLD        (1)
+#define CONCEAL_INTERPOLATE (2)
 
 typedef struct {
         float *data;
         unsigned long frames;
 } dataBuffer_t;
 
+/* the samples are passed from the main thread to the output callback through inputRing, the
+   buffers in front of and after the resampler belong to the output callback */
+ring_t inputRing;
 dataBuffer_t inputData, outputData;
+arena_t arena;
 
-SRC_STATE* resampleState = NULL;
+resampler_t resampler;
+plan_t plan;
+chanmap_t chanmap;
 SRC_DATA resampleData;
 int srcErr;
 
-float inputRate, outputRate, resampleRatio;
-short enableResample = 0, enableUpdate = 0, keepRunning = 1;
-int channelCount, inputBlocksize, outputBlocksize, inputBufsize, outputBufsize;
-float outputLimit = 1.;
+/* the statistics that are printed by the main loop */
+typedef struct {
+        double resampleRatio;
+        unsigned long inputFrames;
+        unsigned long outputFrames;
+        unsigned long excursions;
+} stats_t;
+SEQLOCK_FITS(sizeof(stats_t));
+
+/* the frames that pass through the queue from the main thread, the resampler, the halfband stages and the playback */
+#define STAGECOUNT (4)
+SEQLOCK_FITS(STAGECOUNT * sizeof(ledger_t));
+const char *stageName[STAGECOUNT] = {"ingest", "resample", "interpolate", "playback"};
+ledger_t ingest, resample, interpolate, playback;
+
+/* State that is shared between the output callback and the main and control threads. The flags
+   are set by the main thread with release and tested by the callback with acquire. The estimated
+   input rate, the target ratio and the highpass filter are single values without dependent data,
+   hence relaxed. The statistics are published by the callback with a seqlock, the ledgers by the
+   thread that owns them. */
+struct {
+        atomic_int enableResample;
+        atomic_int enableUpdate;
+        _Atomic double inputRate;
+        _Atomic double ratioTarget;
+        _Atomic float hpFilter;
+        seqlock_t stats;
+        seqlock_t inputLedger;          /* ingest, written by the main thread */
+        seqlock_t outputLedger;         /* resample, interpolate and playback */
+} shared;
+
+/* this is set by the main thread before enableResample, after that only by the output callback */
+double resampleRatio;
+unsigned long excursionCounter = 0;
+int critical = 0;
+stretch_t stretch;
+governor_t governor;
+
+/* the estimate of the input rate belongs to the main thread, which copies it to shared.inputRate */
+double inputRate, outputRate;
+double nominalRate;
+short enableSonify = 0, enableMix = 0, enableReplay = 0;
+int channelCount, bufferChannels, deviceChannels, inputBlocksize, outputBlocksize, inputBufsize, outputBufsize;
+agc_t agc;
+filterbank_t filterbank;
+filterstate_t filterState, filterFade;
+sonify_t sonify;
+mixer_t mixer;
+tap_t inputTap, outputTap, ratioTap;
+replay_t replay;
+float *mixData = NULL;
+float *eegdata = NULL, *eegmap = NULL, *eegprev = NULL, *eegfilt = NULL, *eegfade = NULL;
+float *eeglast = NULL, *eeggap = NULL, *eegframe = NULL, *eegraw = NULL;
+int concealMode = CONCEAL_FADE;
+float fadeDecay;
+unsigned long gapCounter = 0, concealCounter = 0, overrunCounter = 0;
+
+/* the non-finite values of the stream are replaced before they reach the filters */
+scrub_t scrub;
+int scrubRecovered = 0;
+int lslChannelCount;
 
 /*******************************************************************************************************/
 int resample_buffers(void)
 {
-        resampleData.src_ratio      = resampleRatio;
+        /* with halfband stages the fractional stage runs at a fraction of the output rate */
+        unsigned long room = (outputBufsize - outputData.frames) >> plan.depth;
+
+        resampleData.src_ratio      = resampleRatio * plan.rate[0] / outputRate;
         resampleData.end_of_input   = 0;
         resampleData.data_in        = inputData.data;
         resampleData.input_frames   = inputData.frames;
-        resampleData.data_out       = outputData.data + outputData.frames * channelCount;
-        resampleData.output_frames  = outputBufsize - outputData.frames;
+        resampleData.data_out       = (plan.depth ? plan.data[0] : outputData.data + outputData.frames * bufferChannels);
+        resampleData.output_frames  = room;
 
         /* check whether there is data in the input buffer */
         if (inputData.frames==0)
                 return 0;
 
         /* check whether there is room for new data in the output buffer */
-        if (outputData.frames==outputBufsize)
+        if (room==0)
                 return 0;
 
-        int srcErr = src_process (resampleState, &resampleData);
+        TRACE_BEGIN("resample");
+        int srcErr = resampler_process (&resampler, &resampleData);
+        TRACE_END("resample");
         if (srcErr)
         {
                 printf("ERROR: Cannot resample the input data\n");
@@ -82,11 +191,16 @@ int resample_buffers(void)
         }
 
         /* the output data buffer increased */
-        outputData.frames += resampleData.output_frames_gen;
+        unsigned long newFrames = resampleData.output_frames_gen;
+        if (plan.depth)
+                newFrames = plan_interpolate(&plan, resampleData.output_frames_gen, outputData.data + outputData.frames * bufferChannels);
+        outputData.frames += newFrames;
+        ledger_add(&resample, resampleData.input_frames_used, resampleData.output_frames_gen, resampleData.src_ratio);
+        ledger_add(&interpolate, resampleData.output_frames_gen, newFrames, 1 << plan.depth);
 
         /* the input data buffer decreased */
-        size_t len = (inputData.frames - resampleData.input_frames_used) * channelCount * sizeof(float);
-        memcpy(inputData.data, inputData.data + resampleData.input_frames_used * channelCount, len);
+        size_t len = (inputData.frames - resampleData.input_frames_used) * bufferChannels * sizeof(float);
+        memcpy(inputData.data, inputData.data + resampleData.input_frames_used * bufferChannels, len);
         inputData.frames -= resampleData.input_frames_used;
 
         return 0;
@@ -95,8 +209,11 @@ int resample_buffers(void)
 /*******************************************************************************************************/
 int update_ratio(void)
 {
-        float nominal = (float)outputRate/inputRate;
-        float estimate = nominal + (0.5*outputBufsize - outputData.frames) / outputBlocksize;
+        double ratioTarget = atomic_load_explicit(&shared.ratioTarget, memory_order_relaxed);
+        double inputRate = atomic_load_explicit(&shared.inputRate, memory_order_relaxed);
+        double nominal = (ratioTarget > 0 ? ratioTarget : outputRate/inputRate);
+        TRACE_COUNTER("output frames", outputData.frames);
+        double estimate = nominal + (0.5*outputBufsize - outputData.frames) / outputBlocksize;
 
         /* do not change the ratio by too much */
         estimate = min(estimate, 1.2*nominal);
@@ -122,11 +239,48 @@ int update_ratio(void)
         else
                 resampleRatio = smooth(resampleRatio, nominal, 10. * BLOCKSIZE);
 
+        /* the smooth adjustment is too slow when the buffer is about to run empty or full,
+           the ratio then immediately makes a small excursion until the buffer has recovered */
+        int previous = critical;
+        if (outputData.frames < CRITICALFILL*outputBufsize)
+        {
+                resampleRatio = max(resampleRatio, (1+EXCURSION)*nominal);
+                critical = 1;
+        }
+        else if (outputData.frames > (1-CRITICALFILL)*outputBufsize)
+        {
+                resampleRatio = min(resampleRatio, (1-EXCURSION)*nominal);
+                critical = 1;
+        }
+        else
+                critical = 0;
+        if (critical && !previous)
+        {
+                TRACE_INSTANT("ratio excursion");
+                excursionCounter++;
+        }
+
         //printf("%lu\t%f\t%f\t%f\n", outputData.frames, nominal, estimate, resampleRatio);
 
         return 0;
 }
 
+/*******************************************************************************************************/
+/* The converter is only changed by the main thread, on request of the user or by the governor. */
+void update_converter(void)
+{
+        int converter = governor_update(&governor, thread_now());
+        if (converter == resampler_get_converter(&resampler))
+                return;
+
+        /* if the previous change is still in progress, this is tried again the next time */
+        int err = resampler_set_converter(&resampler, converter);
+        if (err > 0)
+                printf("ERROR: %s\n", src_strerror(err));
+        else if (err == 0)
+                TRACE_INSTANT("converter");
+}
+
 /*******************************************************************************************************/
 static int output_callback(const void *input,
                            void *output,
@@ -139,139 +293,543 @@ static int output_callback(const void *input,
         dataBuffer_t *outputData = (dataBuffer_t *)userData;
         unsigned int newFrames = min(frameCount, outputData->frames);
 
-        size_t len = newFrames * channelCount * sizeof(float);
-        memcpy(data, outputData->data, len);
+        double start = thread_now();
+        arena_enter_realtime();
+        TRACE_THREAD("output callback");
+        TRACE_BEGIN("output callback");
+        if (statusFlags & paOutputUnderflow)
+                TRACE_INSTANT("output underflow");
+        if (newFrames < frameCount)
+                TRACE_INSTANT("buffer underflow");
+
+        /* the oscillators for the sonification run at the audio rate, hence they are applied here */
+        if (enableMix)
+        {
+                /* the downmix follows the sonification, which needs an intermediate buffer */
+                for (unsigned long i = 0; i < newFrames; i += outputBlocksize)
+                {
+                        unsigned long n = min(outputBlocksize, newFrames - i);
+                        const float *source = outputData->data + i * bufferChannels;
+                        if (enableSonify)
+                        {
+                                sonify_synthesize(&sonify, source, mixData, n);
+                                source = mixData;
+                        }
+                        mixer_process(&mixer, source, data + i * deviceChannels, n);
+                }
+        }
+        else if (enableSonify)
+                sonify_synthesize(&sonify, outputData->data, data, newFrames);
+        else
+                memcpy(data, outputData->data, newFrames * channelCount * sizeof(float));
 
-        len = (frameCount - newFrames) * channelCount * sizeof(float);
-        memset(data + newFrames * channelCount, 0, len);
+        /* a shortage is bridged by repeating the most recent period of the signal */
+        stretch_process(&stretch, data, newFrames, frameCount);
+        ledger_add(&playback, newFrames, frameCount, 1);
 
-        len = (outputData->frames - newFrames) * channelCount * sizeof(float);
-        memcpy(outputData->data, outputData->data + newFrames * channelCount, len);
+        size_t len = (outputData->frames - newFrames) * bufferChannels * sizeof(float);
+        memcpy(outputData->data, outputData->data + newFrames * bufferChannels, len);
 
         outputData->frames -= newFrames;
 
-        for (unsigned int i = 0; i < (newFrames * channelCount); i++)
-                outputLimit = max(outputLimit, fabsf(data[i]));
+        /* take over the samples that the main thread has queued */
+        inputData.frames += ring_read(&inputRing, inputData.data + inputData.frames * bufferChannels, NULL, inputBufsize - inputData.frames);
+
+        /* the stream already runs while the main thread sets up the resampler and the initial ratio */
+        int enableResample = atomic_load_explicit(&shared.enableResample, memory_order_acquire);
 
         if (enableResample)
+        {
                 resample_buffers();
+                if (atomic_load_explicit(&shared.enableUpdate, memory_order_acquire))
+                        update_ratio();
 
-        if (enableUpdate)
-                update_ratio();
+                stats_t stats = {resampleRatio, inputData.frames + ring_count(&inputRing), outputData->frames, excursionCounter};
+                seqlock_write(&shared.stats, &stats, sizeof(stats));
+        }
+        ledger_t ledger[3] = {resample, interpolate, playback};
+        seqlock_write(&shared.outputLedger, ledger, sizeof(ledger));
+
+        tap_write(&outputTap, timeInfo->outputBufferDacTime, data, frameCount);
+        float ratio[2] = {enableResample ? resampleRatio : 0, outputData->frames};
+        tap_write(&ratioTap, timeInfo->outputBufferDacTime, ratio, 1);
+
+        TRACE_END("output callback");
+        arena_leave_realtime();
+        governor_measure(&governor, thread_now() - start, (double)frameCount / outputRate);
 
         return paContinue;
 }
 
 /*******************************************************************************************************/
-void stream_finished(void *userData)
+void condition_sample(void)
+{
+        /* a new channel map starts with a fresh filter state for the channels that changed */
+        if (chanmap_update(&chanmap))
+        {
+                memcpy(eegfade, eegfilt, channelCount * sizeof(float));
+                filterstate_copy(&filterbank, &filterFade, &filterState);
+                chanmap_multiply(&chanmap.matrix[chanmap.active], lslChannelCount, channelCount, eegdata, eegmap, 1);
+                for (int i=0; i<channelCount; i++)
+                        if (chanmap_changed(&chanmap, i)) {
+                                /* the high-pass output starts at zero, the filter bank is at rest */
+                                eegfilt[i] = eegmap[i];
+                                filterstate_reset(&filterbank, &filterState, i, 0);
+                        }
+        }
+
+        /* select or combine the channels first, so that unused channels are not processed */
+        chanmap_multiply(&chanmap.matrix[chanmap.active], lslChannelCount, channelCount, eegdata, eegmap, 1);
+
+        /* the value that was held during non-finite input jumps, hence the filters start again like for a new channel */
+        if (scrubRecovered)
+        {
+                for (int i=0; i<channelCount; i++)
+                        if (chanmap_depends(&chanmap.matrix[chanmap.active], i, scrub.recovered)) {
+                                eegfilt[i] = eegmap[i];
+                                filterstate_reset(&filterbank, &filterState, i, 0);
+                        }
+                scrubRecovered = 0;
+        }
+
+        /* apply a highpass filter by subtracting a smoothed version of the signal */
+        float hpFilter = atomic_load_explicit(&shared.hpFilter, memory_order_relaxed);
+        for (int i=0; i<channelCount; i++) {
+                eegfilt[i] = smooth(eegfilt[i], eegmap[i], hpFilter);
+                eegmap[i] -= eegfilt[i];
+        }
+        filterbank_process(&filterbank, &filterState, eegmap, eegmap, 1);
+
+        if (chanmap_fading(&chanmap))
+        {
+                /* the previous channel map is faded out, it keeps its own filter state */
+                chanmap_multiply(&chanmap.matrix[1 - chanmap.active], lslChannelCount, channelCount, eegdata, eegprev, 1);
+                for (int i=0; i<channelCount; i++) {
+                        eegfade[i] = smooth(eegfade[i], eegprev[i], hpFilter);
+                        eegprev[i] -= eegfade[i];
+                }
+                filterbank_process(&filterbank, &filterFade, eegprev, eegprev, 1);
+                float weight = chanmap_fade(&chanmap);
+                for (int i=0; i<channelCount; i++)
+                        eegmap[i] = weight * eegmap[i] + (1.0 - weight) * eegprev[i];
+        }
+}
+
+/*******************************************************************************************************/
+/* Determine the azimuth of each LSL channel from the electrode location in the stream description,
+   where X points to the right and Y to the front. If no locations are available, the channels are
+   spread from left to right in the order of the stream. */
+void channel_azimuth(lsl_streaminfo info, float *azimuth)
+{
+        lsl_xml_ptr channel;
+        int found = 0;
+
+        for (int i = 0; i < lslChannelCount; i++)
+                azimuth[i] = NAN;
+
+        /* a recording does not have a stream description */
+        for (int i = 0; info && i < lslChannelCount; i++)
+        {
+                if (i == 0)
+                        channel = lsl_child(lsl_child(lsl_get_desc(info), "channels"), "channel");
+
+                lsl_xml_ptr location = lsl_child(channel, "location");
+                const char *x = lsl_child_value_n(location, "X");
+                const char *y = lsl_child_value_n(location, "Y");
+
+                if (!lsl_empty(channel) && strlen(x) && strlen(y))
+                {
+                        azimuth[i] = atan2(atof(x), atof(y));
+                        found++;
+                }
+                channel = lsl_next_sibling_n(channel, "channel");
+        }
+
+        if (found == 0)
+                for (int i = 0; i < lslChannelCount; i++)
+                        azimuth[i] = (lslChannelCount > 1 ? M_PI * i / (lslChannelCount - 1) - M_PI / 2 : 0);
+}
+
+/*******************************************************************************************************/
+/* Get the next sample from LSL or from a recording, this returns the timestamp or 0 on failure
+   or timeout. The sample is received in eegraw and copied to eegdata without non-finite values. */
+double pull_sample(lsl_inlet inlet, double timeout, int32_t *lslErr)
+{
+        double timestamp;
+        if (enableReplay)
+        {
+                *lslErr = 0;
+                if (replay_read(&replay, eegraw, 1, &timestamp) != 1)
+                        timestamp = 0;
+        }
+        else
+        {
+                TRACE_BEGIN("lsl pull");
+                timestamp = lsl_pull_sample_f(inlet, eegraw, lslChannelCount, timeout, lslErr);
+                TRACE_END("lsl pull");
+        }
+
+        if (timestamp != 0 && scrub_copy(&scrub, eegraw, eegdata, 1))
+        {
+                TRACE_INSTANT("scrub recovered");
+                scrubRecovered = 1;
+        }
+        return timestamp;
+}
+
+/*******************************************************************************************************/
+/* Add a sample to the queue for the output callback, received is 0 for a sample that conceals a gap. */
+void append_sample(float *sample, int received)
+{
+        float *dest = eegframe;
+
+        /* the concealment of a gap continues from the last sample before scaling */
+        memcpy(eeglast, sample, channelCount * sizeof(float));
+
+        if (enableSonify)
+        {
+                /* the bands are mixed down to baseband after scaling */
+                agc_process(&agc, sample, sample, 1);
+                sonify_analyze(&sonify, sample, dest, 1);
+        }
+        else
+        {
+                agc_process(&agc, sample, dest, 1);
+        }
+
+        /* only the callback can remove samples, hence the newest one is dropped if the queue is full */
+        int written = ring_write(&inputRing, dest, NULL, 1);
+        if (written == 0)
+        {
+                TRACE_INSTANT("input overrun");
+                overrunCounter++;
+        }
+        ledger_add(&ingest, received, written, 1);
+        seqlock_write(&shared.inputLedger, &ingest, sizeof(ingest));
+}
+
+/*******************************************************************************************************/
+/* Insert the samples that are missing in a gap, next is the first sample after the gap or NULL if
+   it has not arrived yet. Without the next sample, interpolation falls back to fading out. */
+void conceal_gap(long missing, const float *next)
 {
-        keepRunning = 0;
-        return;
+        for (long n = 0; n < missing; n++)
+        {
+                for (int i = 0; i < channelCount; i++)
+                {
+                        if (concealMode == CONCEAL_HOLD)
+                                eeggap[i] = eeglast[i];
+                        else if (concealMode == CONCEAL_INTERPOLATE && next)
+                                eeggap[i] = eeglast[i] + (next[i] - eeglast[i]) / (missing + 1 - n);
+                        else
+                                eeggap[i] = eeglast[i] * fadeDecay;
+                }
+                append_sample(eeggap, 0);
+        }
+        concealCounter += (missing > 0 ? missing : 0);
+}
+
+/*******************************************************************************************************/
+/* Look for another instance of the stream among the streams that the continuous resolver has seen
+   in the background, e.g. after the stream was restarted. It should have the same type, number of
+   channels and source, but another UID. This does not block and returns a new inlet or NULL. */
+lsl_inlet reconnect(lsl_continuous_resolver resolver, const char *type, const char *source, char *uid)
+{
+        lsl_streaminfo found[STREAMCOUNT];
+        lsl_inlet inlet = NULL;
+        int count = lsl_resolver_results(resolver, found, STREAMCOUNT);
+
+        for (int i = 0; i < count; i++)
+        {
+                if (inlet == NULL &&
+                    strcmp(lsl_get_type(found[i]), type) == 0 &&
+                    strcmp(lsl_get_source_id(found[i]), source) == 0 &&
+                    strcmp(lsl_get_uid(found[i]), uid) != 0 &&
+                    lsl_get_channel_count(found[i]) == lslChannelCount)
+                {
+                        /* the stream is opened by the next pull */
+                        inlet = lsl_create_inlet(found[i], 30, LSL_NO_PREFERENCE, 1);
+                        snprintf(uid, STRLEN, "%s", lsl_get_uid(found[i]));
+                }
+                lsl_destroy_streaminfo(found[i]);
+        }
+
+        return inlet;
+}
+
+/*******************************************************************************************************/
+/* Copy the most recent ledgers of the main thread and of the output callback. */
+void read_ledger(ledger_t *ledger)
+{
+        seqlock_read(&shared.inputLedger, ledger, sizeof(ledger_t));
+        seqlock_read(&shared.outputLedger, ledger + 1, 3 * sizeof(ledger_t));
+}
+
+/*******************************************************************************************************/
+int control_handler(const char *command, const char *argument)
+{
+        double inputRate = atomic_load_explicit(&shared.inputRate, memory_order_relaxed);
+
+        if (strcmp(command, "help") == 0)
+        {
+                printf("ratio <value>          set the nominal resampling ratio, 0 for automatic\n");
+                printf("channels <spec>        select or combine input channels, e.g. 3,0:2,4-5,0.5*6+0.5*7\n");
+                printf("converter <name>       switch to the best, medium, fastest, zoh or linear converter\n");
+                printf("highpass <seconds>     change the time constant of the high-pass filter\n");
+                printf("trace <filename>       write the most recent trace events to a JSON file\n");
+                printf("counters               show the frames that passed through each stage\n");
+        }
+        else if (strcmp(command, "ratio") == 0)
+        {
+                double ratioTarget = atof(argument);
+                atomic_store_explicit(&shared.ratioTarget, ratioTarget, memory_order_relaxed);
+                printf("Changed nominal resampleRatio to %f\n", ratioTarget > 0 ? ratioTarget : outputRate/inputRate);
+        }
+        else if (strcmp(command, "highpass") == 0)
+        {
+                if (atof(argument) <= 0)
+                {
+                        printf("ERROR: Invalid high-pass filter time constant.\n");
+                        return -1;
+                }
+                /* the filter coefficient changes gradually, so there is no need for a crossfade */
+                atomic_store_explicit(&shared.hpFilter, 1.0 - pow(0.5, 1.0/(inputRate*atof(argument))), memory_order_relaxed);
+                printf("Changed high-pass filter to %s seconds\n", argument);
+        }
+        else if (strcmp(command, "channels") == 0)
+        {
+                int err = chanmap_set(&chanmap, argument);
+                if (err == -3)
+                        printf("ERROR: The previous change is still in progress.\n");
+                else if (err == -2)
+                        printf("ERROR: Channel number out of range.\n");
+                else if (err)
+                        printf("ERROR: Invalid channel specification.\n");
+                else
+                        printf("Changed channels to %s\n", argument);
+                return err;
+        }
+        else if (strcmp(command, "converter") == 0)
+        {
+                int converter = control_parse_converter(argument);
+                if (converter < 0)
+                {
+                        printf("ERROR: Unknown converter '%s'.\n", argument);
+                        return -1;
+                }
+                /* the main thread changes the converter, the governor may lower the quality below this */
+                governor_select(&governor, converter);
+                printf("Changed to %s rate converter\n", src_get_name(converter));
+                return 0;
+        }
+        else if (strcmp(command, "counters") == 0)
+        {
+                /* the ingest counts samples at the nominal rate of the stream */
+                ledger_t ledger[STAGECOUNT];
+                read_ledger(ledger);
+                ledger_print(stageName, ledger, STAGECOUNT, outputRate / nominalRate);
+        }
+        else if (strcmp(command, "trace") == 0)
+        {
+                if (trace_dump(argument))
+                {
+                        printf("ERROR: Cannot write the trace, tracing requires compiling with TRACE.\n");
+                        return -1;
+                }
+                printf("Wrote the trace to %s\n", argument);
+        }
+        else
+        {
+                printf("ERROR: Unknown command '%s', type 'help' for a list of commands.\n", command);
+                return -1;
+        }
+
+        return 0;
 }
 
 /*******************************************************************************************************/
 int main(int argc, char* argv[]) {
         char line[STRLEN];
-        float bufferSize, blockSize, hpFilter;
+        size_t arenaSize;
+        const char *channelSpec = option_get(argc, argv, "channels");
+        const char *filterSpec = option_get(argc, argv, "filter");
+        const char *sonifySpec = option_get(argc, argv, "sonify");
+        const char *mixSpec = option_get(argc, argv, "mix");
+        const char *recordPrefix = option_get(argc, argv, "record");
+        const char *replayFile = option_get(argc, argv, "replay");
+        float replaySpeed = option_number(argc, argv, "replay-speed", 1);
+        int maxDepth = (option_get(argc, argv, "single-stage") ? 0 : HALFBANDSTAGES);
+        int fixedPoint = (option_get(argc, argv, "fixed-point") != NULL);
+        const char *concealSpec = option_get(argc, argv, "conceal");
+        int enableGovernor = (option_get(argc, argv, "governor") != NULL);
+        chanmap_t mixmap;
+        float *azimuth;
+        float agcAttack = option_number(argc, argv, "agc-attack", AGCATTACK);
+        float agcRelease = option_number(argc, argv, "agc-release", AGCRELEASE);
+        float agcWindow = option_number(argc, argv, "agc-window", AGCWINDOW);
+        int agcLinked = (option_get(argc, argv, "agc-linked") != NULL);
+        float gainLower, gainUpper;
+        float bufferSize, blockSize;
 
         /* variables that are specific for PortAudio */
         unsigned int outputDevice;
-        PaStream *outputStream;
-        PaStreamParameters outputParameters;
+        device_t outputStream = {NULL};
+        device_t *devices[1] = {&outputStream};
+        double lastWatch = 0;
         PaError paErr = paNoError;
         unsigned int numDevices;
         const PaDeviceInfo *deviceInfo;
 
         /* variables that are specific for LSL */
-        unsigned int inputStream;
+        unsigned int inputStream = -1;
         lsl_streaminfo info[STREAMCOUNT];
-        lsl_inlet inlet;
-        int lslErr = 0;
-        float *eegdata = NULL, *eegfilt = NULL;
+        lsl_inlet inlet = NULL;
+        int32_t lslErr = 0;
+        int filterErr = 0;
         double timestamp, timestampPrev, timestampPerSample;
-        unsigned long samplesReceived = 0;
+        double outageStart = 0, now;
+        uint64_t samplesReceived = 0;
+        long concealed = 0;
+        int reconnected = 0;
         const char *type, *name;
+        char streamName[STRLEN], streamType[STRLEN], streamSource[STRLEN], streamUID[STRLEN];
+        lsl_continuous_resolver resolver = NULL;
         int streamCount = 0;
 
         /* STAGE 1: Initialize the EEG input and audio output. */
 
-        printf("LSL version: %s\n", lsl_library_info());
-        printf("Looking for LSL streams...\n");
-
-        streamCount = lsl_resolve_all(info, STREAMCOUNT, TIMEOUT);
+        /* the status lines are passed on as they are printed when running under the supervisor */
+        setvbuf(stdout, NULL, _IOLBF, 0);
 
-        if (streamCount <= 0)
+        if (concealSpec && strcmp(concealSpec, "hold") == 0)
+                concealMode = CONCEAL_HOLD;
+        else if (concealSpec && strcmp(concealSpec, "interpolate") == 0)
+                concealMode = CONCEAL_INTERPOLATE;
+        else if (concealSpec && strcmp(concealSpec, "fade") != 0)
         {
-                printf("ERROR: No LSL streams available.\n");
+                printf("ERROR: Invalid concealment '%s', this should be hold, fade or interpolate.\n", concealSpec);
                 goto error0;
         }
-        printf("Number of LSL streams = %d\n", streamCount);
+
+        printf("LSL version: %s\n", lsl_library_info());
+
+        if (replayFile)
+        {
+                /* the input comes from a recording instead of from LSL */
+                if (replay_open(&replay, replayFile, replaySpeed))
+                {
+                        printf("ERROR: Cannot open recording '%s'.\n", replayFile);
+                        goto error0;
+                }
+                enableReplay = 1;
+        }
+        else
+        {
+                printf("Looking for LSL streams...\n");
+
+                streamCount = lsl_resolve_all(info, STREAMCOUNT, TIMEOUT);
+
+                if (streamCount <= 0)
+                {
+                        printf("ERROR: No LSL streams available.\n");
+                        goto error0;
+                }
+                printf("Number of LSL streams = %d\n", streamCount);
+        }
 
         printf("Buffer size in seconds [%.4f]: ", BUFFERSIZE);
-        fgets(line, STRLEN, stdin);
+        option_prompt(argc, argv, "buffer-size", line, STRLEN);
         if (strlen(line) == 1)
                 bufferSize = BUFFERSIZE;
         else
                 bufferSize = atof(line);
 
         printf("Block size in seconds [%.4f]: ", BLOCKSIZE);
-        fgets(line, STRLEN, stdin);
+        option_prompt(argc, argv, "block-size", line, STRLEN);
         if (strlen(line) == 1)
                 blockSize = BLOCKSIZE;
         else
                 blockSize = atof(line);
 
-        for (int i=0; i<streamCount; i++)
+        if (enableReplay)
         {
-                printf("stream %d - ", i);
-                printf("type = %s, ", lsl_get_type(info[i]));
-                printf("name = %s, ", lsl_get_name(info[i]));
-                printf("channelCount = %d, ", lsl_get_channel_count(info[i]));
-                printf("inputRate = %.4f\n", lsl_get_nominal_srate(info[i]));
+                type = "recording";
+                name = replayFile;
+
+                /* the channelCount and inputRate are global variables */
+                channelCount = replay.header.channelCount;
+                inputRate = replay.header.rate;
         }
-        printf("Select input stream [%d]: ", 0);
-        fgets(line, STRLEN, stdin);
-        if (strlen(line)==1)
-                inputStream = 0;
         else
-                inputStream = atoi(line);
+        {
+                for (int i=0; i<streamCount; i++)
+                {
+                        printf("stream %d - ", i);
+                        printf("type = %s, ", lsl_get_type(info[i]));
+                        printf("name = %s, ", lsl_get_name(info[i]));
+                        printf("channelCount = %d, ", lsl_get_channel_count(info[i]));
+                        printf("inputRate = %.4f\n", lsl_get_nominal_srate(info[i]));
+                }
+                printf("Select input stream [%d]: ", 0);
+                option_prompt(argc, argv, "input-stream", line, STRLEN);
+                if (strlen(line)==1)
+                        inputStream = 0;
+                else if (isdigit(line[0]))
+                        inputStream = atoi(line);
+                else
+                {
+                        /* the order of the streams is not fixed, hence a script selects the stream by name */
+                        line[strlen(line)-1] = 0;
+                        for (inputStream=0; inputStream<streamCount; inputStream++)
+                                if (strcmp(lsl_get_name(info[inputStream]), line) == 0)
+                                        break;
+                }
+                if (inputStream >= (unsigned int)streamCount)
+                {
+                        printf("ERROR: Invalid input stream '%s'.\n", line);
+                        goto error0;
+                }
 
-        /* continute with the selected stream */
-        type = lsl_get_type(info[inputStream]);
-        name = lsl_get_name(info[inputStream]);
+                /* continute with the selected stream */
+                type = lsl_get_type(info[inputStream]);
+                name = lsl_get_name(info[inputStream]);
 
-        /* the channelCount and inputRate are global variables */
-        channelCount = lsl_get_channel_count(info[inputStream]);
-        inputRate = lsl_get_nominal_srate(info[inputStream]);
+                /* the channelCount and inputRate are global variables */
+                channelCount = lsl_get_channel_count(info[inputStream]);
+                inputRate = lsl_get_nominal_srate(info[inputStream]);
+        }
+        lslChannelCount = channelCount;
+        nominalRate = inputRate;
+        fadeDecay = exp(-1.0 / (GAPFADE * nominalRate));
+
+        /* these are needed to find the stream again */
+        snprintf(streamName, STRLEN, "%s", name);
+        snprintf(streamType, STRLEN, "%s", type);
+        if (!enableReplay)
+        {
+                snprintf(streamSource, STRLEN, "%s", lsl_get_source_id(info[inputStream]));
+                snprintf(streamUID, STRLEN, "%s", lsl_get_uid(info[inputStream]));
+        }
 
         printf("type = %s\n", type);
         printf("name = %s\n", name);
         printf("channelCount = %d\n", channelCount);
         printf("inputRate = %f\n", inputRate);
+        atomic_store_explicit(&shared.inputRate, inputRate, memory_order_relaxed);
 
         printf("High-pass filter in seconds [%.0f]: ", HPFILTER);
-        fgets(line, STRLEN, stdin);
+        option_prompt(argc, argv, "highpass", line, STRLEN);
         if (strlen(line) == 1)
                 /* this implements an exponential decay of 1/2 after 10 seconds at 250 Hz */
-                hpFilter = 1.0 - pow(0.5, 1.0/(inputRate*HPFILTER));
+                shared.hpFilter = 1.0 - pow(0.5, 1.0/(inputRate*HPFILTER));
         else
-                hpFilter = 1.0 - pow(0.5, 1.0/(inputRate*atof(line)));
+                shared.hpFilter = 1.0 - pow(0.5, 1.0/(inputRate*atof(line)));
 
         inputBufsize = bufferSize * inputRate;
         inputBlocksize = 1;
 
-        eegdata = malloc(channelCount * sizeof(float));
-        eegfilt = malloc(channelCount * sizeof(float));
-        if (eegdata == NULL || eegfilt == NULL)
-        {
-                printf("ERROR: Cannot allocate memory.");
-                goto error1;
-        }
-
         printf("PortAudio version: 0x%08X\n", Pa_GetVersion());
 
-        outputParameters.device = paNoDevice;
-
         /* Initialize library before making any other calls. */
         paErr = Pa_Initialize();
         if(paErr != paNoError)
@@ -307,49 +865,75 @@ int main(int argc, char* argv[]) {
                                deviceInfo->maxOutputChannels);
         }
         printf("Select output device [%d]: ", Pa_GetDefaultOutputDevice());
-        fgets(line, STRLEN, stdin);
+        option_prompt(argc, argv, "output-device", line, STRLEN);
         if (strlen(line)==1)
                 outputDevice = Pa_GetDefaultOutputDevice();
         else
                 outputDevice = atoi(line);
 
         printf("Output sampling rate [%.0f]: ", DEFAULTRATE);
-        fgets(line, STRLEN, stdin);
+        option_prompt(argc, argv, "output-rate", line, STRLEN);
         if (strlen(line)==1)
                 outputRate = DEFAULTRATE;
         else
                 outputRate = atof(line);
 
         deviceInfo = Pa_GetDeviceInfo(outputDevice);
-        printf("Number of channels [%d]: ", min(channelCount, deviceInfo->maxOutputChannels));
-        fgets(line, STRLEN, stdin);
-        if (strlen(line) == 1)
-                channelCount = min(channelCount, deviceInfo->maxOutputChannels);
+        if (channelSpec)
+        {
+                /* the number of channels follows from the selection or combination */
+                if (chanmap_count(channelSpec, lslChannelCount, &channelCount, NULL) || channelCount == 0 || (!mixSpec && channelCount > deviceInfo->maxOutputChannels))
+                {
+                        printf("ERROR: Invalid channel specification '%s'.\n", channelSpec);
+                        goto error1;
+                }
+        }
+        else if (mixSpec)
+        {
+                /* all channels are mixed into the outputs */
+                channelCount = lslChannelCount;
+        }
         else
-                channelCount = min(channelCount, atoi(line));
+        {
+                printf("Number of channels [%d]: ", min(channelCount, deviceInfo->maxOutputChannels));
+                option_prompt(argc, argv, "output-channels", line, STRLEN);
+                if (strlen(line) == 1)
+                        channelCount = min(channelCount, deviceInfo->maxOutputChannels);
+                else
+                        channelCount = min(channelCount, atoi(line));
+        }
+
+        deviceChannels = channelCount;
+        if (mixSpec)
+        {
+                /* the number of outputs follows from the pan law or from the mixing matrix */
+                if (strncmp(mixSpec, "pan", 3) == 0)
+                        deviceChannels = (mixSpec[3] == ':' ? atoi(mixSpec + 4) : 2);
+                else if (chanmap_count(mixSpec, channelCount, &deviceChannels, NULL))
+                        deviceChannels = 0;
+                if (deviceChannels < 1 || deviceChannels > deviceInfo->maxOutputChannels)
+                {
+                        printf("ERROR: Invalid mixing specification '%s'.\n", mixSpec);
+                        goto error1;
+                }
+                enableMix = 1;
+        }
 
         printf("outputDevice = %d\n", outputDevice);
         printf("outputRate = %f\n", outputRate);
         printf("channelCount = %d\n", channelCount);
-
-        outputParameters.device = outputDevice;
-        outputParameters.channelCount = channelCount;
-        outputParameters.sampleFormat = SAMPLETYPE;
-        outputParameters.suggestedLatency = Pa_GetDeviceInfo(outputParameters.device)->defaultLowOutputLatency;
-        outputParameters.hostApiSpecificStreamInfo = NULL;
+        printf("deviceChannels = %d\n", deviceChannels);
 
         outputBufsize = bufferSize * outputRate;
         outputBlocksize = blockSize * outputRate;
 
-        paErr = Pa_OpenStream(
-                &outputStream,
-                NULL,
-                &outputParameters,
-                outputRate,
-                outputBlocksize,
-                paNoFlag,
-                output_callback,
-                &outputData);
+        /* a large upsampling ratio is mostly done by halfband stages after the fractional stage */
+        plan_interpolation(&plan, inputRate, outputRate, outputBufsize, maxDepth);
+        plan.fixedPoint = fixedPoint;
+        plan_print(&plan);
+
+        /* the device is remembered by name, so that it can be found again after it is replugged */
+        paErr = device_open(&outputStream, outputDevice, 0, deviceChannels, outputRate, outputBlocksize, output_callback, &outputData);
         if(paErr != paNoError)
         {
                 printf("ERROR: Cannot open output stream.\n");
@@ -357,24 +941,176 @@ int main(int argc, char* argv[]) {
                 goto error1;
         }
 
-        printf("Opened output stream with %d channels at %.0f Hz.\n", channelCount, outputRate);
-        Pa_SetStreamFinishedCallback(&outputStream, stream_finished);
+        printf("Opened output stream with %d channels at %.0f Hz.\n", deviceChannels, outputRate);
 
         /* STAGE 2: Initialize the inputData and outputData for use by the callbacks. */
 
+        /* the filter bank is designed before the arena, as it determines the size of the filter state */
+        filterErr = filterbank_init(&filterbank, filterSpec, channelCount, inputRate);
+        if (filterErr == -2)
+        {
+                printf("ERROR: Filter frequency out of range or too many filter sections.\n");
+                goto error2;
+        }
+        else if (filterErr)
+        {
+                printf("ERROR: Invalid filter specification.\n");
+                goto error2;
+        }
+
+        /* with sonification the resampler processes the baseband signal of each band */
+        bufferChannels = channelCount;
+        if (sonifySpec)
+        {
+                filterErr = sonify_init(&sonify, sonifySpec, channelCount, inputRate, outputRate);
+                if (filterErr == -2)
+                {
+                        printf("ERROR: Sonification frequency out of range or too many bands.\n");
+                        goto error2;
+                }
+                else if (filterErr)
+                {
+                        printf("ERROR: Invalid sonification specification.\n");
+                        goto error2;
+                }
+                enableSonify = 1;
+                bufferChannels = sonify_width(&sonify);
+                printf("Sonification of %d bands, the resampler processes %d channels\n", sonify.bandCount, bufferChannels);
+        }
+
+        /* all buffers are carved from a single arena, which is zeroed upon initialization */
+        arenaSize  = arena_round(inputBufsize * bufferChannels * sizeof(float));
+        arenaSize += ring_arena_size(bufferChannels, inputBufsize, 0);
+        arenaSize += stretch_arena_size(deviceChannels, outputRate);
+        arenaSize += arena_round(bufferChannels * sizeof(float));
+        arenaSize += arena_round(outputBufsize * bufferChannels * sizeof(float));
+        arenaSize += 2 * arena_round(lslChannelCount * sizeof(float));
+        arenaSize += scrub_arena_size(lslChannelCount);
+        arenaSize += 6 * arena_round(channelCount * sizeof(float));
+        arenaSize += chanmap_arena_size(lslChannelCount, channelCount);
+        arenaSize += agc_arena_size(channelCount, agcWindow * inputRate);
+        arenaSize += 2 * filterstate_arena_size(&filterbank);
+        arenaSize += resampler_arena_size(bufferChannels, plan.maxFrames[0], plan.rate[0] / inputRate);
+        arenaSize += plan_arena_size(&plan, bufferChannels);
+        arenaSize += (enableSonify ? sonify_arena_size(&sonify) : 0);
+        arenaSize += (enableMix ? mixer_arena_size(channelCount, deviceChannels) : 0);
+        arenaSize += (enableMix ? arena_round(outputBlocksize * channelCount * sizeof(float)) : 0);
+        arenaSize += (enableMix ? chanmap_arena_size(channelCount, deviceChannels) : 0);
+        arenaSize += (enableMix ? arena_round(lslChannelCount * sizeof(float)) : 0);
+        if (recordPrefix)
+        {
+                arenaSize += tap_arena_size(lslChannelCount, inputRate);
+                arenaSize += tap_arena_size(deviceChannels, outputRate);
+                arenaSize += tap_arena_size(2, 1.0 / blockSize);
+        }
+        if (arena_init(&arena, arenaSize))
+        {
+                printf("ERROR: Cannot allocate memory.\n");
+                goto error2;
+        }
+
         inputData.frames = 0;
-        inputData.data = NULL;
-        if ((inputData.data = malloc(inputBufsize * channelCount * sizeof(float))) == NULL)
+        if ((inputData.data = arena_alloc(&arena, inputBufsize * bufferChannels * sizeof(float))) == NULL)
                 goto error2;
-        else
-                memset(inputData.data, 0, inputBufsize * channelCount * sizeof(float));
+
+        /* the main thread prepares each sample in eegframe before it is queued */
+        if (ring_init(&inputRing, bufferChannels, inputBufsize, 0, &arena))
+                goto error2;
+        if (stretch_init(&stretch, deviceChannels, outputRate, &arena))
+                goto error2;
+        if ((eegframe = arena_alloc(&arena, bufferChannels * sizeof(float))) == NULL)
+                goto error2;
+        seqlock_init(&shared.stats);
+        seqlock_init(&shared.inputLedger);
+        seqlock_init(&shared.outputLedger);
+        ledger_init(&ingest);
+        ledger_init(&resample);
+        ledger_init(&interpolate);
+        ledger_init(&playback);
 
         outputData.frames = 0;
-        outputData.data = NULL;
-        if ((outputData.data = malloc(outputBufsize * channelCount * sizeof(float))) == NULL)
+        if ((outputData.data = arena_alloc(&arena, outputBufsize * bufferChannels * sizeof(float))) == NULL)
+                goto error2;
+
+        if (plan_init(&plan, bufferChannels, &arena))
+                goto error2;
+
+        /* these hold a single sample with all channels of the LSL stream, as received and after scrubbing */
+        if ((eegraw = arena_alloc(&arena, lslChannelCount * sizeof(float))) == NULL)
+                goto error2;
+        if ((eegdata = arena_alloc(&arena, lslChannelCount * sizeof(float))) == NULL)
+                goto error2;
+        if (scrub_init(&scrub, lslChannelCount, &arena))
+                goto error2;
+
+        /* these hold a single sample and the filter state of the channels that are sent to the audio output */
+        if ((eegmap = arena_alloc(&arena, channelCount * sizeof(float))) == NULL)
+                goto error2;
+        if ((eegprev = arena_alloc(&arena, channelCount * sizeof(float))) == NULL)
+                goto error2;
+        if ((eegfilt = arena_alloc(&arena, channelCount * sizeof(float))) == NULL)
+                goto error2;
+        if ((eegfade = arena_alloc(&arena, channelCount * sizeof(float))) == NULL)
+                goto error2;
+        if ((eeglast = arena_alloc(&arena, channelCount * sizeof(float))) == NULL)
+                goto error2;
+        if ((eeggap = arena_alloc(&arena, channelCount * sizeof(float))) == NULL)
+                goto error2;
+
+        if (chanmap_init(&chanmap, channelSpec, lslChannelCount, channelCount, CROSSFADE * inputRate, &arena))
+                goto error2;
+
+        /* the filter bank after the channel map has a second state for the crossfade */
+        if (filterstate_init(&filterbank, &filterState, &arena) || filterstate_init(&filterbank, &filterFade, &arena))
+                goto error2;
+
+        if (enableSonify && sonify_alloc(&sonify, &arena))
+                goto error2;
+
+        /* the downmix is applied after the resampling, on the output of the sonification */
+        if (enableMix)
+        {
+                if (mixer_init(&mixer, channelCount, deviceChannels, &arena))
+                        goto error2;
+                if ((mixData = arena_alloc(&arena, outputBlocksize * channelCount * sizeof(float))) == NULL)
+                        goto error2;
+
+                if (strncmp(mixSpec, "pan", 3) == 0)
+                {
+                        /* each channel is panned according to the first LSL channel it is made of, the
+                           intermediate buffer is not yet in use and holds the azimuth of each channel */
+                        if ((azimuth = arena_alloc(&arena, lslChannelCount * sizeof(float))) == NULL)
+                                goto error2;
+                        channel_azimuth(enableReplay ? NULL : info[inputStream], azimuth);
+                        chanmat_t *matrix = &chanmap.matrix[chanmap.active];
+                        for (int i=0; i<channelCount; i++)
+                                mixData[i] = (matrix->start[i+1] > matrix->start[i] ? azimuth[matrix->index[matrix->start[i]]] : NAN);
+                        mixer_set_pan(&mixer, mixData);
+                }
+                else
+                {
+                        if (chanmap_init(&mixmap, mixSpec, channelCount, deviceChannels, 0, &arena))
+                                goto error2;
+                        mixer_set_matrix(&mixer, &mixmap.matrix[mixmap.active]);
+                }
+        }
+
+        /* the LSL samples with their timestamps, the audio output and the resampling ratio with the buffer size are recorded */
+        if (recordPrefix)
+        {
+                if (tap_open(&inputTap, recordPrefix, "input", lslChannelCount, inputRate, &arena) ||
+                    tap_open(&outputTap, recordPrefix, "output", deviceChannels, outputRate, &arena) ||
+                    tap_open(&ratioTap, recordPrefix, "ratio", 2, 1.0 / blockSize, &arena))
+                {
+                        printf("ERROR: Cannot open the recording files.\n");
+                        goto error2;
+                }
+                recorder_start();
+        }
+
+        /* the gain is determined per channel, or over all channels if they are linked */
+        if (agc_init(&agc, channelCount, agcLinked, inputRate, agcAttack, agcRelease, agcWindow, &arena))
                 goto error2;
-        else
-                memset(outputData.data, 0, outputBufsize * channelCount * sizeof(float));
 
         /* STAGE 3: Initialize the resampling. */
 
@@ -382,17 +1118,23 @@ int main(int argc, char* argv[]) {
                src_get_name (SRC_SINC_MEDIUM_QUALITY),
                src_get_description (SRC_SINC_MEDIUM_QUALITY));
 
-        resampleState = src_new (SRC_SINC_MEDIUM_QUALITY, channelCount, &srcErr);
-        if (resampleState == NULL)
+        srcErr = resampler_init (&resampler, SRC_SINC_MEDIUM_QUALITY, bufferChannels, plan.maxFrames[0], plan.rate[0] / inputRate, CROSSFADE * plan.rate[0], &arena);
+        if (srcErr)
         {
                 printf("ERROR: Cannot set up resample state.\n");
                 printf("ERROR: %s\n", src_strerror(srcErr));
                 goto error3;
         }
 
+        /* the quality can be lowered when the output callback uses too much of its time */
+        governor_init(&governor, SRC_SINC_MEDIUM_QUALITY, enableGovernor);
+
+        /* all memory has been allocated, nothing can be added after the streams start */
+        arena_seal(&arena);
+
         /* STAGE 4: Start the streams. */
 
-        paErr = Pa_StartStream(outputStream);
+        paErr = device_start(&outputStream);
         if(paErr != paNoError)
         {
                 printf("ERROR: Cannot start output stream.\n");
@@ -400,17 +1142,24 @@ int main(int argc, char* argv[]) {
                 goto error3;
         }
 
-        inlet = lsl_create_inlet(info[inputStream], 30, LSL_NO_PREFERENCE, 1);
-        lsl_open_stream(inlet, TIMEOUT, &lslErr);
-        if (lslErr != 0)
+        if (!enableReplay)
         {
-                printf("ERROR: Cannot open input stream\n");
-                //printf("ERROR: %s\n", lsl_last_error());
-                goto error4;
+                inlet = lsl_create_inlet(info[inputStream], 30, LSL_NO_PREFERENCE, 1);
+
+                /* this keeps looking for the stream in the background, so that it can be found quickly when it is restarted */
+                resolver = lsl_create_continuous_resolver_byprop("name", streamName, RESOLVEFORGET);
+
+                lsl_open_stream(inlet, TIMEOUT, &lslErr);
+                if (lslErr != 0)
+                {
+                        printf("ERROR: Cannot open input stream\n");
+                        //printf("ERROR: %s\n", lsl_last_error());
+                        goto error4;
+                }
         }
 
         /* get the first sample */
-        timestamp = lsl_pull_sample_f(inlet, eegdata, lsl_get_channel_count(info[inputStream]), TIMEOUT, &lslErr);
+        timestamp = pull_sample(inlet, TIMEOUT, &lslErr);
         if (timestamp == 0 || lslErr)
         {
                 printf("ERROR: Cannot pull sample.\n");
@@ -419,12 +1168,10 @@ int main(int argc, char* argv[]) {
         }
 
         /* initialize an exponential smoothing filter */
-        for (int i=0; i<channelCount; i++) {
-                eegfilt[i] = eegdata[i];
-        }
+        chanmap_multiply(&chanmap.matrix[chanmap.active], lslChannelCount, channelCount, eegdata, eegfilt, 1);
 
         printf("Filling buffer...\n");
-        timestampPrev = lsl_pull_sample_f(inlet, eegdata, lsl_get_channel_count(info[inputStream]), TIMEOUT, &lslErr);
+        timestampPrev = pull_sample(inlet, TIMEOUT, &lslErr);
         if (timestampPrev == 0 || lslErr)
         {
                 printf("ERROR: Cannot pull sample.\n");
@@ -435,7 +1182,7 @@ int main(int argc, char* argv[]) {
         /* wait one second to fill the input buffer halfway */
         while (samplesReceived<inputBufsize/2)
         {
-                timestamp = lsl_pull_sample_f(inlet, eegdata, lsl_get_channel_count(info[inputStream]), TIMEOUT, &lslErr);
+                timestamp = pull_sample(inlet, TIMEOUT, &lslErr);
                 if (timestamp == 0 || lslErr)
                 {
                         printf("ERROR: Cannot pull sample.\n");
@@ -443,20 +1190,13 @@ int main(int argc, char* argv[]) {
                         goto error4;
                 }
                 samplesReceived++;
+                tap_write(&inputTap, timestamp, eegraw, 1);
 
-                /* apply a highpass filter by subtracting a smoothed version of the signal */
-                for (int i=0; i<channelCount; i++) {
-                        eegfilt[i] = smooth(eegfilt[i], eegdata[i], hpFilter);
-                        eegdata[i] -= eegfilt[i];
-                }
+                /* select the channels and apply the highpass filter */
+                condition_sample();
 
-                /* add the current sample to the input buffer and increment the counter */
-                for (unsigned int i = 0; i < channelCount; i++)
-                {
-                        outputLimit = max(outputLimit, fabsf(eegdata[i]));
-                        inputData.data[inputData.frames * channelCount + i] = eegdata[i] / outputLimit;
-                }
-                inputData.frames++;
+                /* scale the current sample, add it to the input buffer and increment the counter */
+                append_sample(eegmap, 1);
         }
 
         printf("Nominal inputRate = %f\n", inputRate);
@@ -464,85 +1204,152 @@ int main(int argc, char* argv[]) {
         /* estimate the input sample rate */
         timestampPerSample = (timestamp - timestampPrev)/samplesReceived;
         inputRate = 1.0/timestampPerSample;
+        atomic_store_explicit(&shared.inputRate, inputRate, memory_order_relaxed);
         printf("Estimated inputRate = %f\n", inputRate);
         timestampPrev = timestamp;
 
         resampleRatio = outputRate / inputRate;
         printf("Initial resampleRatio = %f\n", resampleRatio);
 
-        srcErr = src_set_ratio (resampleState, resampleRatio);
+        srcErr = resampler_set_ratio (&resampler, resampleRatio * plan.rate[0] / outputRate);
         if (srcErr)
         {
                 printf("ERROR: Cannot set resampling ratio.\n");
                 printf("ERROR: %s\n", src_strerror(srcErr));
                 goto error4;
         }
+        printf("Group delay of the halfband stages and the resampler is %.2f ms\n", 1000 * plan_delay(&plan, plan.depth, resampler_delay(SRC_SINC_MEDIUM_QUALITY, resampleRatio * plan.rate[0] / outputRate)));
 
+        TRACE_THREAD("main");
         printf("Processing data...\n");
+        printf("Type 'help' for a list of commands to change the settings.\n");
+        control_start(control_handler);
 
-        enableResample = 1;
-        enableUpdate = 1;
+        atomic_store_explicit(&shared.enableResample, 1, memory_order_release);
+        atomic_store_explicit(&shared.enableUpdate, 1, memory_order_release);
 
         while (1)
         {
-                timestamp = lsl_pull_sample_f(inlet, eegdata, lsl_get_channel_count(info[inputStream]), TIMEOUT, &lslErr);
-                if (timestamp == 0 || lslErr)
+                /* the audio stream is reopened if the device was replugged */
+                now = lsl_local_clock();
+                if (now - lastWatch >= WATCHINTERVAL)
                 {
-                        printf("ERROR: Cannot pull sample.\n");
-                        //printf("ERROR: %s\n", lsl_last_error());
-                        goto error4;
+                        device_watch(devices, 1);
+                        update_converter();
+                        lastWatch = now;
                 }
-                samplesReceived++;
 
-                /* apply a highpass filter by subtracting a smoothed version of the signal */
-                for (int i=0; i<channelCount; i++) {
-                        eegfilt[i] = smooth(eegfilt[i], eegdata[i], hpFilter);
-                        eegdata[i] -= eegfilt[i];
+                /* do not wait long, so that a gap can be concealed before the output runs dry */
+                timestamp = pull_sample(inlet, PULLTIMEOUT, &lslErr);
+                if (timestamp == 0 && enableReplay)
+                {
+                        printf("End of the recording.\n");
+                        goto error4;
+                }
+                else if (timestamp == 0)
+                {
+                        /* the stream stalled or disappeared, the output is kept going with the concealment */
+                        now = lsl_local_clock();
+                        if (outageStart == 0)
+                        {
+                                printf("WARNING: No data from the input stream, concealing the gap.\n");
+                                outageStart = now - PULLTIMEOUT;
+                                atomic_store_explicit(&shared.enableUpdate, 0, memory_order_release);
+                        }
+                        /* at most a buffer is inserted at a time, only what was inserted counts as concealed */
+                        long missing = (now - outageStart) * inputRate - concealed;
+                        long n = min(missing, inputBufsize);
+                        conceal_gap(n, NULL);
+                        concealed += n;
+
+                        /* liblsl recovers by itself if the same stream comes back, a restarted stream has another UID */
+                        lsl_inlet found = reconnect(resolver, streamType, streamSource, streamUID);
+                        if (found)
+                        {
+                                printf("Reconnected to the input stream with UID %s.\n", streamUID);
+                                lsl_destroy_inlet(inlet);
+                                inlet = found;
+                                reconnected = 1;
+                        }
+                        continue;
                 }
+                samplesReceived++;
+                tap_write(&inputTap, timestamp, eegraw, 1);
 
-                /* update the estimated input sample rate, smooth over 100 seconds */
-                timestampPerSample = smooth(timestampPerSample, timestamp - timestampPrev, 0.01/lsl_get_nominal_srate(info[inputStream]));
-                timestampPrev = timestamp;
-                inputRate = 1.0/timestampPerSample;
+                /* select the channels and apply the highpass filter */
+                condition_sample();
 
-                if (inputData.frames == inputBufsize) {
-                        /* input buffer overrun, drop the oldest sample */
-                        size_t len = (inputData.frames - 1) * channelCount * sizeof(float);
-                        memcpy(inputData.data, inputData.data + 1 * channelCount, len);
-                        inputData.frames--;
+                if (outageStart > 0 || timestamp - timestampPrev > GAPTHRESHOLD * timestampPerSample)
+                {
+                        /* the rate estimate ignores the gap, the remaining missing samples are concealed unless the
+                           timestamps of a new stream cannot be compared to those of the old one */
+                        long missing = lround((timestamp - timestampPrev) / timestampPerSample) - 1 - concealed;
+                        if (!reconnected)
+                                conceal_gap(min(missing, inputBufsize), eegmap);
+                        gapCounter++;
+                        outageStart = 0;
+                        concealed = 0;
+                        reconnected = 0;
+                        atomic_store_explicit(&shared.enableUpdate, 1, memory_order_release);
                 }
-
-                /* add the current sample to the input buffer and increment the counter */
-                for (unsigned int i = 0; i < channelCount; i++)
+                else
                 {
-                        outputLimit = max(outputLimit, fabsf(eegdata[i]));
-                        inputData.data[inputData.frames * channelCount + i] = eegdata[i] / outputLimit;
+                        /* update the estimated input sample rate, smooth over 100 seconds */
+                        timestampPerSample = smooth(timestampPerSample, timestamp - timestampPrev, 0.01/nominalRate);
+                        inputRate = 1.0/timestampPerSample;
+                        atomic_store_explicit(&shared.inputRate, inputRate, memory_order_relaxed);
                 }
-                inputData.frames++;
+                timestampPrev = timestamp;
 
-                if ((samplesReceived % (unsigned long)lsl_get_nominal_srate(info[inputStream])) == 0)
+                /* scale the current sample, add it to the input buffer and increment the counter */
+                append_sample(eegmap, 1);
+
+                if ((samplesReceived % (uint64_t)nominalRate) == 0)
                 {
+                        stats_t stats;
+                        ledger_t ledger[STAGECOUNT];
+                        seqlock_read(&shared.stats, &stats, sizeof(stats));
+                        read_ledger(ledger);
                         printf("inputRate = %8.4f, ", inputRate);
-                        printf("resampleRatio = %8.4f, ", resampleRatio);
-                        printf("outputLimit = %8.4f, ", outputLimit);
-                        printf("inputData = %4lu, ", inputData.frames);
-                        printf("outputData = %6lu", outputData.frames);
+                        printf("resampleRatio = %8.4f, ", stats.resampleRatio);
+                        agc_range(&agc, &gainLower, &gainUpper);
+                        printf("gain = %.3g-%.3g, ", gainLower, gainUpper);
+                        printf("limited = %lu, ", agc.limited);
+                        printf("gaps = %lu, ", gapCounter);
+                        printf("concealed = %lu, ", concealCounter);
+                        if (overrunCounter)
+                                printf("overruns = %lu, ", overrunCounter);
+                        if (scrub.total)
+                                printf("scrubbed = %lu (%lu recoveries), ", scrub.total, scrub.recoveries);
+                        printf("inputData = %4lu, ", stats.inputFrames);
+                        printf("outputData = %6lu", stats.outputFrames);
+                        printf(", offset = %.1f", ledger_chain(ledger, STAGECOUNT));
+                        printf(", load = %.0f%%", 100 * governor.load);
+                        if (stats.excursions)
+                                printf(", excursions = %lu", stats.excursions);
+                        if (atomic_load_explicit(&stretch.stretches, memory_order_relaxed))
+                                printf(", stretches = %lu (%lu frames)", atomic_load_explicit(&stretch.stretches, memory_order_relaxed), atomic_load_explicit(&stretch.stretchedFrames, memory_order_relaxed));
+                        if (atomic_load_explicit(&stretch.silences, memory_order_relaxed))
+                                printf(", silences = %lu", atomic_load_explicit(&stretch.silences, memory_order_relaxed));
                         printf("\n");
                 }
         }
 
 error4:
-        lsl_destroy_inlet(inlet); \
+        if (enableReplay)
+                replay_close(&replay);
+        else
+                lsl_destroy_inlet(inlet);
+        if (resolver)
+                lsl_destroy_continuous_resolver(resolver);
 
 error3:
-        if (resampleState)
-                src_delete (resampleState);
+        device_close(&outputStream);
+        resampler_free (&resampler);
 
 error2:
-        if (eegdata)
-                free(eegdata);
-        if (eegfilt)
-                free(eegfilt);
+        recorder_stop();
+        arena_free(&arena);
 
 error1:
         Pa_Terminate();
@@ -0,0 +1,149 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "mixer.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*******************************************************************************************************/
+size_t mixer_arena_size(int inputCount, int outputCount)
+{
+        return arena_round(inputCount * outputCount * sizeof(float));
+}
+
+/*******************************************************************************************************/
+int mixer_init(mixer_t *mixer, int inputCount, int outputCount, arena_t *arena)
+{
+        mixer->inputCount = inputCount;
+        mixer->outputCount = outputCount;
+        mixer->gain = arena_alloc(arena, inputCount * outputCount * sizeof(float));
+        if (!mixer->gain)
+                return -1;
+        memset(mixer->gain, 0, inputCount * outputCount * sizeof(float));
+        return 0;
+}
+
+/*******************************************************************************************************/
+void mixer_set_matrix(mixer_t *mixer, const chanmat_t *matrix)
+{
+        memset(mixer->gain, 0, mixer->inputCount * mixer->outputCount * sizeof(float));
+        for (int j = 0; j < mixer->outputCount; j++)
+                for (int k = matrix->start[j]; k < matrix->start[j+1]; k++)
+                        mixer->gain[matrix->index[k] * mixer->outputCount + j] += matrix->gain[k];
+}
+
+/*******************************************************************************************************/
+void mixer_set_pan(mixer_t *mixer, const float *azimuth)
+{
+        int outputCount = mixer->outputCount;
+        float largest = 0;
+
+        memset(mixer->gain, 0, mixer->inputCount * outputCount * sizeof(float));
+
+        for (int i = 0; i < mixer->inputCount; i++)
+        {
+                float *gain = mixer->gain + i * outputCount;
+                float angle = (isnan(azimuth[i]) ? 0 : azimuth[i]);
+
+                if (outputCount == 1)
+                {
+                        gain[0] = 1;
+                }
+                else if (outputCount == 2)
+                {
+                        /* the position runs from 0 for left to 1 for right */
+                        float position = fminf(fmaxf(angle / M_PI + 0.5, 0), 1);
+                        gain[0] = cos(position * M_PI / 2);
+                        gain[1] = sin(position * M_PI / 2);
+                }
+                else
+                {
+                        /* pan between the two nearest speakers on the circle */
+                        float position = fmodf(angle / (2 * M_PI) + 1, 1) * outputCount;
+                        int speaker = (int)position % outputCount;
+                        float fraction = position - floorf(position);
+                        gain[speaker] = cos(fraction * M_PI / 2);
+                        gain[(speaker + 1) % outputCount] = sin(fraction * M_PI / 2);
+                }
+        }
+
+        /* the sum of the gains over all inputs determines the largest possible output */
+        for (int j = 0; j < outputCount; j++)
+        {
+                float sum = 0;
+                for (int i = 0; i < mixer->inputCount; i++)
+                        sum += mixer->gain[i * outputCount + j];
+                largest = fmaxf(largest, sum);
+        }
+        if (largest > 1)
+                for (int k = 0; k < mixer->inputCount * outputCount; k++)
+                        mixer->gain[k] /= largest;
+}
+
+/*******************************************************************************************************/
+void mixer_process(mixer_t *mixer, const float *input, float *output, unsigned long frames)
+{
+        int inputCount = mixer->inputCount;
+        int outputCount = mixer->outputCount;
+        unsigned long i = 0;
+
+        /* a block of four frames is processed together, so that each row of the gain matrix is
+           loaded once per block, the inner loops over the outputs are vectorized; the four rows
+           are written out below, hence the block size is not a parameter */
+        for (; i + 4 <= frames; i += 4)
+        {
+                const float *in = input + i * inputCount;
+                float *restrict y0 = output + i * outputCount;
+                float *restrict y1 = y0 + outputCount;
+                float *restrict y2 = y1 + outputCount;
+                float *restrict y3 = y2 + outputCount;
+
+                memset(y0, 0, 4 * outputCount * sizeof(float));
+                for (int c = 0; c < inputCount; c++)
+                {
+                        const float *restrict gain = mixer->gain + c * outputCount;
+                        const float x0 = in[c];
+                        const float x1 = in[c + inputCount];
+                        const float x2 = in[c + 2 * inputCount];
+                        const float x3 = in[c + 3 * inputCount];
+                        for (int j = 0; j < outputCount; j++)
+                        {
+                                y0[j] += x0 * gain[j];
+                                y1[j] += x1 * gain[j];
+                                y2[j] += x2 * gain[j];
+                                y3[j] += x3 * gain[j];
+                        }
+                }
+        }
+
+        /* the remaining frames */
+        for (; i < frames; i++)
+        {
+                const float *in = input + i * inputCount;
+                float *restrict y = output + i * outputCount;
+
+                memset(y, 0, outputCount * sizeof(float));
+                for (int c = 0; c < inputCount; c++)
+                {
+                        const float *restrict gain = mixer->gain + c * outputCount;
+                        for (int j = 0; j < outputCount; j++)
+                                y[j] += in[c] * gain[j];
+                }
+        }
+}
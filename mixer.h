@@ -0,0 +1,47 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef MIXER_H
+#define MIXER_H
+
+#include "arena.h"
+#include "chanmap.h"
+
+/* Mix many channels into a few outputs with a dense gain matrix. The matrix is stored with one
+   row of outputCount gains per input channel, so that the product with a block of interleaved
+   frames is a small matrix multiplication in which the inner loop runs over the outputs. */
+typedef struct {
+        int inputCount;
+        int outputCount;
+        float *gain;
+} mixer_t;
+
+/* Return the number of bytes that the mixer needs from the arena. */
+size_t mixer_arena_size(int inputCount, int outputCount);
+
+/* Set up the mixer, all gains start at zero. */
+int mixer_init(mixer_t *mixer, int inputCount, int outputCount, arena_t *arena);
+
+/* Copy the gains from a sparse channel matrix with one row per output. */
+void mixer_set_matrix(mixer_t *mixer, const chanmat_t *matrix);
+
+/* Pan each input according to its azimuth in radians, where 0 is to the front and positive is to
+   the right. Inputs with an unknown azimuth (NAN) are placed in the centre. For stereo the azimuth
+   between -90 and +90 degrees is mapped onto the left-right axis, more outputs are assumed to be
+   placed on a circle, starting at the front and going clockwise. The gains follow a constant
+   power pan law and are scaled such that the outputs cannot clip. */
+void mixer_set_pan(mixer_t *mixer, const float *azimuth);
+
+/* Mix interleaved input into interleaved output. */
+void mixer_process(mixer_t *mixer, const float *input, float *output, unsigned long frames);
+
+#endif
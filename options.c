@@ -0,0 +1,60 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "options.h"
+
+/*******************************************************************************************************/
+const char *option_get(int argc, char *argv[], const char *name)
+{
+        size_t len = strlen(name);
+
+        for (int i = 1; i < argc; i++)
+        {
+                if (strncmp(argv[i], "--", 2) || strncmp(argv[i] + 2, name, len))
+                        continue;
+                if (argv[i][len + 2] == '=')
+                        return argv[i] + len + 3;
+                if (argv[i][len + 2] == 0)
+                        return argv[i] + len + 2;
+        }
+
+        return NULL;
+}
+
+/*******************************************************************************************************/
+double option_number(int argc, char *argv[], const char *name, double value)
+{
+        const char *str = option_get(argc, argv, name);
+
+        if (str == NULL || *str == 0)
+                return value;
+        else
+                return atof(str);
+}
+
+/*******************************************************************************************************/
+char *option_prompt(int argc, char *argv[], const char *name, char *line, int size)
+{
+        const char *str = option_get(argc, argv, name);
+
+        if (str == NULL)
+                return fgets(line, size, stdin);
+
+        /* echo the answer after the question */
+        snprintf(line, size, "%s\n", str);
+        printf("%s", line);
+        return line;
+}
@@ -0,0 +1,28 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+/* Return the value of a command-line option like --name=value, or NULL if it is not given.
+   An option without a value like --name returns an empty string. */
+const char *option_get(int argc, char *argv[], const char *name);
+
+/* Return the numeric value of a command-line option, or the default if it is not given. */
+double option_number(int argc, char *argv[], const char *name, double value);
+
+/* Answer an interactive question with the command-line option --name=value if it is given, so that
+   the applications can be started from a script, otherwise read the answer from stdin. The line
+   ends with a newline like the one from fgets, an empty answer selects the default. */
+char *option_prompt(int argc, char *argv[], const char *name, char *line, int size);
+
+#endif
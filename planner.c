@@ -0,0 +1,195 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "planner.h"
+
+#define min(x, y) ((x)<(y) ? x : y)
+#define max(x, y) ((x)>(y) ? x : y)
+
+/*******************************************************************************************************/
+static void to_fixed(const float *input, int16_t *output, unsigned long count)
+{
+        for (unsigned long i = 0; i < count; i++)
+        {
+                float value = input[i] * 32768.f;
+                value = (value > 32767.f ? 32767.f : (value < -32768.f ? -32768.f : value));
+                output[i] = lrintf(value);
+        }
+}
+
+/*******************************************************************************************************/
+static void to_float(const int16_t *input, float *output, unsigned long count)
+{
+        for (unsigned long i = 0; i < count; i++)
+                output[i] = input[i] * (1.f / 32768.f);
+}
+
+/*******************************************************************************************************/
+void plan_decimation(plan_t *plan, double inputRate, const double *outputRate, int *depth, int count, unsigned long maxFrames, int maxDepth)
+{
+        memset(plan, 0, sizeof(plan_t));
+
+        for (int i = 0; i < count; i++)
+        {
+                depth[i] = min(halfband_depth(inputRate, outputRate[i]), maxDepth);
+                plan->depth = max(plan->depth, depth[i]);
+        }
+
+        plan->rate[0] = inputRate;
+        plan->maxFrames[0] = maxFrames;
+        for (int s = 0; s < plan->depth; s++)
+        {
+                /* each stage only protects the band of the outputs that tap the tree further down */
+                double passband = 0;
+                for (int i = 0; i < count; i++)
+                        if (depth[i] > s)
+                                passband = max(passband, outputRate[i] / 2);
+                plan->taps[s] = halfband_taps(plan->rate[s], passband);
+                plan->rate[s+1] = plan->rate[s] / 2;
+                plan->maxFrames[s+1] = plan->maxFrames[s] / 2 + 1;
+        }
+}
+
+/*******************************************************************************************************/
+void plan_interpolation(plan_t *plan, double inputRate, double outputRate, unsigned long maxFrames, int maxDepth)
+{
+        memset(plan, 0, sizeof(plan_t));
+        plan->interpolate = 1;
+        plan->inputRate = inputRate;
+        plan->depth = min(halfband_depth(outputRate, inputRate), maxDepth);
+
+        plan->rate[plan->depth] = outputRate;
+        plan->maxFrames[plan->depth] = maxFrames;
+        for (int s = plan->depth - 1; s >= 0; s--)
+        {
+                /* the images of the input band should be removed, each stage is designed at its output rate */
+                plan->taps[s] = halfband_taps(plan->rate[s+1], inputRate / 2);
+                plan->rate[s] = plan->rate[s+1] / 2;
+                plan->maxFrames[s] = plan->maxFrames[s+1] / 2;
+        }
+}
+
+/*******************************************************************************************************/
+size_t plan_arena_size(const plan_t *plan, int channelCount)
+{
+        size_t size = 0;
+        for (int s = 0; s < plan->depth; s++)
+                size += halfband_arena_size(plan->taps[s], channelCount, plan->maxFrames[s], plan->fixedPoint);
+
+        /* the output of an interpolation is written elsewhere */
+        for (int s = 0; s <= plan->depth - plan->interpolate; s++)
+                size += arena_round(plan->maxFrames[s] * channelCount * sizeof(float));
+
+        /* but in fixed point it is first written to the last level */
+        if (plan->fixedPoint && plan->depth)
+                for (int s = 0; s <= plan->depth; s++)
+                        size += arena_round(plan->maxFrames[s] * channelCount * sizeof(int16_t));
+
+        return size;
+}
+
+/*******************************************************************************************************/
+int plan_init(plan_t *plan, int channelCount, arena_t *arena)
+{
+        plan->channelCount = channelCount;
+
+        for (int s = 0; s < plan->depth; s++)
+                if (halfband_init(&plan->stage[s], plan->taps[s], channelCount, plan->maxFrames[s], plan->fixedPoint, arena))
+                        return -1;
+
+        for (int s = 0; s <= plan->depth - plan->interpolate; s++)
+        {
+                plan->frames[s] = 0;
+                if ((plan->data[s] = arena_alloc(arena, plan->maxFrames[s] * channelCount * sizeof(float))) == NULL)
+                        return -1;
+        }
+
+        if (plan->fixedPoint && plan->depth)
+                for (int s = 0; s <= plan->depth; s++)
+                        if ((plan->fixed[s] = arena_alloc(arena, plan->maxFrames[s] * channelCount * sizeof(int16_t))) == NULL)
+                                return -1;
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+void plan_decimate(plan_t *plan, unsigned long frames)
+{
+        plan->frames[0] = frames;
+
+        if (plan->fixedPoint && plan->depth)
+        {
+                to_fixed(plan->data[0], plan->fixed[0], frames * plan->channelCount);
+                for (int s = 0; s < plan->depth; s++)
+                {
+                        plan->frames[s+1] = halfband_decimate_fixed(&plan->stage[s], plan->fixed[s], plan->frames[s], plan->fixed[s+1]);
+                        to_float(plan->fixed[s+1], plan->data[s+1], plan->frames[s+1] * plan->channelCount);
+                }
+                return;
+        }
+
+        for (int s = 0; s < plan->depth; s++)
+                plan->frames[s+1] = halfband_decimate(&plan->stage[s], plan->data[s], plan->frames[s], plan->data[s+1]);
+}
+
+/*******************************************************************************************************/
+unsigned long plan_interpolate(plan_t *plan, unsigned long frames, float *output)
+{
+        plan->frames[0] = frames;
+
+        if (plan->fixedPoint && plan->depth)
+        {
+                to_fixed(plan->data[0], plan->fixed[0], frames * plan->channelCount);
+                for (int s = 0; s < plan->depth; s++)
+                        plan->frames[s+1] = halfband_interpolate_fixed(&plan->stage[s], plan->fixed[s], plan->frames[s], plan->fixed[s+1]);
+                to_float(plan->fixed[plan->depth], output, plan->frames[plan->depth] * plan->channelCount);
+                return plan->frames[plan->depth];
+        }
+
+        for (int s = 0; s < plan->depth; s++)
+        {
+                float *dest = (s == plan->depth - 1 ? output : plan->data[s+1]);
+                plan->frames[s+1] = halfband_interpolate(&plan->stage[s], plan->data[s], plan->frames[s], dest);
+        }
+
+        return plan->frames[plan->depth];
+}
+
+/*******************************************************************************************************/
+double plan_delay(const plan_t *plan, int depth, double fractional)
+{
+        /* the fractional stage comes after the cascade of a decimation and before that of an interpolation */
+        double delay = fractional / (plan->interpolate ? plan->inputRate : plan->rate[depth]);
+        for (int s = 0; s < depth && s < plan->depth; s++)
+        {
+                /* both are expressed in frames at the input rate of the stage */
+                if (plan->interpolate)
+                        delay += (plan->taps[s] + 1) / 4 / plan->rate[s];
+                else
+                        delay += (plan->taps[s] - 1) / 2 / plan->rate[s];
+        }
+        return delay;
+}
+
+/*******************************************************************************************************/
+void plan_print(const plan_t *plan)
+{
+        for (int s = 0; s < plan->depth; s++)
+                printf("Halfband stage %d from %.1f to %.1f Hz with %d taps%s\n", s + 1, plan->rate[s], plan->rate[s + 1], plan->taps[s], plan->fixedPoint ? " in fixed point" : "");
+        if (plan->depth)
+                printf("Group delay of the halfband stages is %.2f ms\n", 1000 * plan_delay(plan, plan->depth, 0));
+}
@@ -0,0 +1,73 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include "arena.h"
+#include "halfband.h"
+
+/* A conversion over a large ratio, like 44100 to 250 Hz, is split into a cascade of halfband
+   stages that each change the rate by a factor two, and a single fractional stage with
+   libsamplerate that arrives at the exact rate and that carries the drift correction. The
+   fractional stage then only changes the rate by a factor between two and four. For decimation
+   the cascade comes first and level 0 is the input, for interpolation the cascade comes last and
+   level 0 is the output of the fractional stage.
+
+   With fixedPoint the halfband stages run in Q15 on a copy of each level. The float levels are
+   still written, since the outputs and libsamplerate read them. */
+typedef struct {
+        int depth;                              /* number of halfband stages */
+        int interpolate;
+        int channelCount;
+        int taps[HALFBANDSTAGES];
+        double rate[HALFBANDSTAGES + 1];        /* the rate at each level */
+        double inputRate;                       /* the input rate of the fractional stage of an interpolation */
+        unsigned long maxFrames[HALFBANDSTAGES + 1];
+        halfband_t stage[HALFBANDSTAGES];
+        float *data[HALFBANDSTAGES + 1];        /* the frames at each level */
+        unsigned long frames[HALFBANDSTAGES + 1];
+        int fixedPoint;                         /* set this after planning and before plan_arena_size */
+        int16_t *fixed[HALFBANDSTAGES + 1];     /* the frames at each level in Q15 */
+} plan_t;
+
+/* Plan a decimation tree for one or more output rates. Each output taps the tree at depth[i],
+   the stages that it passes protect its band. The number of stages is limited to maxDepth, use
+   0 for a single fractional stage. maxFrames is the largest number of input frames per call. */
+void plan_decimation(plan_t *plan, double inputRate, const double *outputRate, int *depth, int count, unsigned long maxFrames, int maxDepth);
+
+/* Plan an interpolation, maxFrames is the largest number of output frames per call. */
+void plan_interpolation(plan_t *plan, double inputRate, double outputRate, unsigned long maxFrames, int maxDepth);
+
+/* Return the number of bytes that the plan needs from the arena. */
+size_t plan_arena_size(const plan_t *plan, int channelCount);
+
+/* Set up the filters and the buffers for the levels, level 0 of a decimation and the levels
+   below the output of an interpolation. */
+int plan_init(plan_t *plan, int channelCount, arena_t *arena);
+
+/* Decimate the frames that were written to data[0], the result is available at each level. */
+void plan_decimate(plan_t *plan, unsigned long frames);
+
+/* Interpolate the frames that were written to data[0] and write them to output, this returns
+   the number of output frames. Without any stages the fractional stage should write to the
+   output directly. */
+unsigned long plan_interpolate(plan_t *plan, unsigned long frames, float *output);
+
+/* Return the group delay in seconds of the first depth stages and of the fractional stage, which
+   holds back the specified number of frames at its input, see resampler_delay. */
+double plan_delay(const plan_t *plan, int depth, double fractional);
+
+/* Print the stages. */
+void plan_print(const plan_t *plan);
+
+#endif
@@ -0,0 +1,168 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "recorder.h"
+#include "thread.h"
+
+static tap_t *recorderTap[RECORDTAPS];
+static int recorderCount = 0;
+static atomic_int recorderRunning = 0;
+static thread_t recorderThread;
+
+/*******************************************************************************************************/
+static size_t tap_capacity(int channelCount, double rate)
+{
+        /* in the worst case every record contains a single frame */
+        size_t size = RECORDBACKLOG * rate * (sizeof(taprecord_t) + channelCount * sizeof(float));
+        size_t capacity = 1;
+        while (capacity < size)
+                capacity *= 2;
+        return capacity;
+}
+
+/*******************************************************************************************************/
+size_t tap_arena_size(int channelCount, double rate)
+{
+        return arena_round(tap_capacity(channelCount, rate));
+}
+
+/*******************************************************************************************************/
+int tap_open(tap_t *tap, const char *prefix, const char *name, int channelCount, double rate, arena_t *arena)
+{
+        tapheader_t header = {"TAPFILE", channelCount, 0, rate};
+        char filename[FILENAME_MAX];
+
+        if (recorderCount == RECORDTAPS)
+                return -1;
+
+        tap->capacity = tap_capacity(channelCount, rate);
+        tap->channelCount = channelCount;
+        tap->missed = 0;
+        atomic_store(&tap->head, 0);
+        atomic_store(&tap->tail, 0);
+        atomic_store(&tap->dropped, 0);
+
+        if ((tap->buffer = arena_alloc(arena, tap->capacity)) == NULL)
+                return -1;
+
+        snprintf(filename, FILENAME_MAX, "%s-%s.tap", prefix, name);
+        if ((tap->file = fopen(filename, "wb")) == NULL)
+        {
+                tap->buffer = NULL;
+                return -1;
+        }
+        fwrite(&header, sizeof(header), 1, tap->file);
+
+        recorderTap[recorderCount++] = tap;
+        return 0;
+}
+
+/*******************************************************************************************************/
+static void copy_in(tap_t *tap, size_t position, const void *data, size_t size)
+{
+        size_t offset = position & (tap->capacity - 1);
+        size_t first = (size < tap->capacity - offset ? size : tap->capacity - offset);
+        memcpy(tap->buffer + offset, data, first);
+        memcpy(tap->buffer, (const char *)data + first, size - first);
+}
+
+/*******************************************************************************************************/
+void tap_write(tap_t *tap, double time, const float *data, unsigned long frames)
+{
+        taprecord_t record;
+        size_t bytes = frames * tap->channelCount * sizeof(float);
+
+        if (tap->buffer == NULL || frames == 0)
+                return;
+
+        size_t head = atomic_load_explicit(&tap->head, memory_order_relaxed);
+        size_t tail = atomic_load_explicit(&tap->tail, memory_order_acquire);
+        if (tap->capacity - (head - tail) < sizeof(record) + bytes)
+        {
+                /* the disk does not keep up, the block is dropped rather than waiting */
+                tap->missed++;
+                atomic_fetch_add_explicit(&tap->dropped, 1, memory_order_relaxed);
+                return;
+        }
+
+        record.time = time;
+        record.frames = frames;
+        record.dropped = tap->missed;
+        tap->missed = 0;
+
+        copy_in(tap, head, &record, sizeof(record));
+        copy_in(tap, head + sizeof(record), data, bytes);
+
+        /* the record becomes visible to the writer thread only when it is complete */
+        atomic_store_explicit(&tap->head, head + sizeof(record) + bytes, memory_order_release);
+}
+
+/*******************************************************************************************************/
+/* Write everything that is queued, with at most two sequential writes per tap. */
+static void drain(tap_t *tap)
+{
+        size_t tail = atomic_load_explicit(&tap->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&tap->head, memory_order_acquire);
+        size_t size = head - tail;
+        size_t offset = tail & (tap->capacity - 1);
+        size_t first = (size < tap->capacity - offset ? size : tap->capacity - offset);
+
+        if (size == 0)
+                return;
+
+        fwrite(tap->buffer + offset, 1, first, tap->file);
+        fwrite(tap->buffer, 1, size - first, tap->file);
+        fflush(tap->file);
+
+        atomic_store_explicit(&tap->tail, head, memory_order_release);
+}
+
+/*******************************************************************************************************/
+static void *recorder_thread(void *arg)
+{
+        while (atomic_load(&recorderRunning))
+        {
+                for (int i = 0; i < recorderCount; i++)
+                        drain(recorderTap[i]);
+                thread_sleep(RECORDINTERVAL);
+        }
+        return NULL;
+}
+
+/*******************************************************************************************************/
+int recorder_start(void)
+{
+        if (recorderCount == 0)
+                return 0;
+        atomic_store(&recorderRunning, 1);
+        return thread_create(&recorderThread, recorder_thread, NULL);
+}
+
+/*******************************************************************************************************/
+void recorder_stop(void)
+{
+        if (atomic_exchange(&recorderRunning, 0))
+                thread_join(recorderThread);
+
+        for (int i = 0; i < recorderCount; i++)
+        {
+                drain(recorderTap[i]);
+                if (atomic_load(&recorderTap[i]->dropped))
+                        printf("WARNING: %lu blocks were dropped from the recording.\n", atomic_load(&recorderTap[i]->dropped));
+                fclose(recorderTap[i]->file);
+        }
+        recorderCount = 0;
+}
@@ -0,0 +1,72 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "arena.h"
+
+#define RECORDTAPS      (8)     // maximum number of taps
+#define RECORDBACKLOG   (4.0)   // in seconds, data that can be queued while the disk stalls
+#define RECORDINTERVAL  (100)   // in milliseconds, how often the writer thread wakes up
+
+/* Each tap file starts with this header. */
+typedef struct {
+        char magic[8];                  /* "TAPFILE" */
+        int32_t channelCount;
+        int32_t reserved;
+        double rate;                    /* nominal sampling rate */
+} tapheader_t;
+
+/* Followed by records with this header, each with frames*channelCount interleaved floats. */
+typedef struct {
+        double time;                    /* timestamp of the first frame in seconds */
+        uint32_t frames;
+        uint32_t dropped;               /* number of records that were dropped before this one */
+} taprecord_t;
+
+/* A tap copies blocks from the real-time thread into a lock-free single-producer single-consumer
+   queue, a background thread writes them to disk. If the queue is full the block is dropped and
+   counted, the real-time thread never waits for the disk. */
+typedef struct {
+        FILE *file;
+        char *buffer;
+        size_t capacity;                /* a power of two */
+        atomic_size_t head;             /* written by the producer */
+        atomic_size_t tail;             /* written by the writer thread */
+        atomic_ulong dropped;           /* total number of dropped records */
+        uint32_t missed;                /* dropped since the last record, only used by the producer */
+        int channelCount;
+} tap_t;
+
+/* Return the number of bytes that a tap needs from the arena. */
+size_t tap_arena_size(int channelCount, double rate);
+
+/* Open the file <prefix>-<name>.tap and set up the queue, a tap that is not opened ignores all
+   data. The rate is the number of frames or, for a tap that receives one frame per block, the
+   number of blocks per second, it determines the size of the queue. */
+int tap_open(tap_t *tap, const char *prefix, const char *name, int channelCount, double rate, arena_t *arena);
+
+/* Queue a block of interleaved samples, this is real-time safe. */
+void tap_write(tap_t *tap, double time, const float *data, unsigned long frames);
+
+/* Start the background thread that writes all taps to disk. */
+int recorder_start(void);
+
+/* Write the remaining data and close the files. */
+void recorder_stop(void);
+
+#endif
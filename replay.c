@@ -0,0 +1,83 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "replay.h"
+#include "thread.h"
+
+/*******************************************************************************************************/
+int replay_open(replay_t *replay, const char *filename, double speed)
+{
+        replay->speed = speed;
+        replay->started = 0;
+        replay->position = 0;
+        replay->record.frames = 0;
+
+        if ((replay->file = fopen(filename, "rb")) == NULL)
+                return -1;
+
+        if (fread(&replay->header, sizeof(tapheader_t), 1, replay->file) != 1 || memcmp(replay->header.magic, "TAPFILE", 8) || replay->header.channelCount < 1 || replay->header.rate <= 0)
+        {
+                fclose(replay->file);
+                replay->file = NULL;
+                return -1;
+        }
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+unsigned long replay_read(replay_t *replay, float *data, unsigned long maxFrames, double *time)
+{
+        unsigned long frames;
+
+        /* skip to the next record that contains data */
+        while (replay->position == replay->record.frames)
+        {
+                if (fread(&replay->record, sizeof(taprecord_t), 1, replay->file) != 1)
+                        return 0;
+                replay->position = 0;
+        }
+
+        frames = replay->record.frames - replay->position;
+        frames = (frames < maxFrames ? frames : maxFrames);
+        if (fread(data, replay->header.channelCount * sizeof(float), frames, replay->file) != frames)
+                return 0;
+
+        /* records can be split, the timestamp is shifted according to the nominal rate */
+        *time = replay->record.time + replay->position / replay->header.rate;
+        replay->position += frames;
+
+        if (!replay->started)
+        {
+                replay->start = thread_now();
+                replay->first = *time;
+                replay->started = 1;
+        }
+
+        /* the deadline is relative to the start, so that errors in the individual sleeps do not accumulate */
+        if (replay->speed > 0)
+                thread_sleep_until(replay->start + (*time - replay->first) / replay->speed);
+
+        return frames;
+}
+
+/*******************************************************************************************************/
+void replay_close(replay_t *replay)
+{
+        if (replay->file)
+                fclose(replay->file);
+        replay->file = NULL;
+}
@@ -0,0 +1,44 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdio.h>
+
+#include "recorder.h"
+
+/* Read a tap file that was written by the recorder, and return its data at the pace at which it
+   was recorded, or faster. The pace follows from the original timestamps, which are returned
+   unchanged. */
+typedef struct {
+        FILE *file;
+        tapheader_t header;
+        taprecord_t record;             /* the current record */
+        unsigned long position;         /* number of frames of the current record that have been read */
+        double speed;                   /* 1 for real time, N for N times faster, 0 for as fast as possible */
+        double start;                   /* clock time at which the first frame was returned */
+        double first;                   /* timestamp of the first frame */
+        int started;
+} replay_t;
+
+/* Open the file and check the header. */
+int replay_open(replay_t *replay, const char *filename, double speed);
+
+/* Wait until the next frames are due and return at most maxFrames of them, together with the
+   timestamp of the first one. This returns 0 at the end of the file. */
+unsigned long replay_read(replay_t *replay, float *data, unsigned long maxFrames, double *time);
+
+/* Close the file. */
+void replay_close(replay_t *replay);
+
+#endif
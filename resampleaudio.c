@@ -26,28 +26,86 @@
 
 #include "portaudio.h"
 #include "samplerate.h"
+#include "arena.h"
+#include "chanmap.h"
+#include "resampler.h"
+#include "control.h"
+#include "options.h"
+#include "recorder.h"
+#include "device.h"
+#include "ring.h"
+#include "seqlock.h"
+#include "stretch.h"
+#include "governor.h"
+#include "ledger.h"
+#include "thread.h"
+#include "trace.h"
 
 #define STRLEN 80
 #define smooth(old, new, lambda) ((1.0-lambda)*(old) + (lambda)*(new))
 
-#define SAMPLETYPE          paFloat32
 #define BLOCKSIZE           (0.01) // in seconds
 #define BUFFERSIZE          (2.00) // in seconds
 #define DEFAULTRATE         (44100.0)
+#define CROSSFADE           (0.05) // in seconds
+#define CRITICALFILL        (0.1)  // fraction of the output buffer below or above which the ratio makes an excursion
+#define EXCURSION           (0.02) // relative change of the ratio during an excursion
 
 typedef struct {
         float *data;
         unsigned long frames;
 } dataBuffer_t;
 
+/* the input buffer and the staging buffer for the output of the resampler belong to the input callback */
 dataBuffer_t inputData, outputData;
-
-SRC_STATE* resampleState = NULL;
+ring_t outputRing;
+stretch_t stretch;
+governor_t governor;
+arena_t arena;
+
+resampler_t resampler;
+chanmap_t chanmap;
+tap_t inputTap, outputTap, ratioTap;
 SRC_DATA resampleData;
 int srcErr;
 
-float inputRate, outputRate, resampleRatio;
-short enableResample = 0, enableUpdate = 0, keepRunning = 1;
+/* the statistics that are printed by the main loop */
+typedef struct {
+        double resampleRatio;
+        unsigned long inputFrames;
+        unsigned long outputFrames;
+        unsigned long excursions;
+} stats_t;
+SEQLOCK_FITS(sizeof(stats_t));
+
+/* the frames that pass through the capture, the resampler and the playback */
+#define STAGECOUNT (3)
+SEQLOCK_FITS(STAGECOUNT * sizeof(ledger_t));
+const char *stageName[STAGECOUNT] = {"capture", "resample", "playback"};
+ledger_t capture, resample, playback;
+
+/* State that is shared between the callbacks and the main and control threads. The flags are set
+   by the main thread with release and tested by the input callback with acquire. The target ratio
+   and keepRunning, which the quit command clears, are single values without dependent data, hence
+   relaxed. The frames are passed from the input to the output callback through outputRing, and
+   the statistics and the ledgers are published with a seqlock by the callback that owns them. */
+struct {
+        atomic_int keepRunning;
+        atomic_int enableResample;
+        atomic_int enableUpdate;
+        _Atomic double ratioTarget;
+        seqlock_t stats;
+        seqlock_t inputLedger;          /* capture and resample */
+        seqlock_t outputLedger;         /* playback */
+} shared;
+
+/* these are only changed by the input callback once the streams are running */
+double resampleRatio;
+unsigned long excursionCounter = 0;
+int critical = 0;
+
+double inputRate, outputRate;
+short duplex = 0;
 int channelCount, inputBlocksize, outputBlocksize, inputBufsize, outputBufsize;
 
 /*******************************************************************************************************/
@@ -57,18 +115,20 @@ int resample_buffers(void)
         resampleData.end_of_input   = 0;
         resampleData.data_in        = inputData.data;
         resampleData.input_frames   = inputData.frames;
-        resampleData.data_out       = outputData.data + outputData.frames * channelCount;
-        resampleData.output_frames  = outputBufsize - outputData.frames;
+        resampleData.data_out       = outputData.data;
+        resampleData.output_frames  = ring_space(&outputRing);
 
         /* check whether there is data in the input buffer */
         if (inputData.frames==0)
                 return 0;
 
         /* check whether there is room for new data in the output buffer */
-        if (outputData.frames==outputBufsize)
+        if (resampleData.output_frames==0)
                 return 0;
 
-        int srcErr = src_process (resampleState, &resampleData);
+        TRACE_BEGIN("resample");
+        int srcErr = resampler_process (&resampler, &resampleData);
+        TRACE_END("resample");
         if (srcErr)
         {
                 printf("ERROR: Cannot resample the input data\n");
@@ -76,8 +136,9 @@ int resample_buffers(void)
                 exit(srcErr);
         }
 
-        /* the output data buffer increased */
-        outputData.frames += resampleData.output_frames_gen;
+        /* the output is handed over to the output callback, the space can only have increased */
+        ring_write(&outputRing, outputData.data, NULL, resampleData.output_frames_gen);
+        ledger_add(&resample, resampleData.input_frames_used, resampleData.output_frames_gen, resampleData.src_ratio);
 
         /* the input data buffer decreased */
         size_t len = (inputData.frames - resampleData.input_frames_used) * channelCount * sizeof(float);
@@ -90,8 +151,11 @@ int resample_buffers(void)
 /*******************************************************************************************************/
 int update_ratio(void)
 {
-        float nominal = (float)outputRate/inputRate;
-        float estimate = nominal + (0.5*outputBufsize - outputData.frames) / inputBlocksize;
+        double ratioTarget = atomic_load_explicit(&shared.ratioTarget, memory_order_relaxed);
+        unsigned long outputFrames = ring_count(&outputRing);
+        TRACE_COUNTER("output frames", outputFrames);
+        double nominal = (ratioTarget > 0 ? ratioTarget : outputRate/inputRate);
+        double estimate = nominal + (0.5*outputBufsize - outputFrames) / inputBlocksize;
 
         /* do not change the ratio by too much */
         estimate = min(estimate, 1.1*nominal);
@@ -102,18 +166,55 @@ int update_ratio(void)
         float lower = (0.49*outputBufsize);
         float upper = (0.51*outputBufsize);
 
-        if (outputData.frames<lower || outputData.frames>upper)
+        if (outputFrames<lower || outputFrames>upper)
                 /* increase or decrease the ratio to the value that appears to be needed */
                 resampleRatio = smooth(resampleRatio, estimate, 0.001);
         else
                 /* change the ratio towards the nominal value */
                 resampleRatio = smooth(resampleRatio, nominal, 0.1);
 
-        //printf("%lu\t%f\t%f\t%f\n", outputData.frames, nominal, estimate, resampleRatio);
+        /* the smooth adjustment is too slow when the buffer is about to run empty or full,
+           the ratio then immediately makes a small excursion until the buffer has recovered */
+        int previous = critical;
+        if (outputFrames < CRITICALFILL*outputBufsize)
+        {
+                resampleRatio = max(resampleRatio, (1+EXCURSION)*nominal);
+                critical = 1;
+        }
+        else if (outputFrames > (1-CRITICALFILL)*outputBufsize)
+        {
+                resampleRatio = min(resampleRatio, (1-EXCURSION)*nominal);
+                critical = 1;
+        }
+        else
+                critical = 0;
+        if (critical && !previous)
+        {
+                TRACE_INSTANT("ratio excursion");
+                excursionCounter++;
+        }
+
+        //printf("%lu\t%f\t%f\t%f\n", outputFrames, nominal, estimate, resampleRatio);
 
         return 0;
 }
 
+/*******************************************************************************************************/
+/* The converter is only changed by the main thread, on request of the user or by the governor. */
+void update_converter(void)
+{
+        int converter = governor_update(&governor, thread_now());
+        if (converter == resampler_get_converter(&resampler))
+                return;
+
+        /* if the previous change is still in progress, this is tried again the next time */
+        int err = resampler_set_converter(&resampler, converter);
+        if (err > 0)
+                printf("ERROR: %s\n", src_strerror(err));
+        else if (err == 0)
+                TRACE_INSTANT("converter");
+}
+
 /*******************************************************************************************************/
 static int input_callback( const void *input,
                            void *output,
@@ -126,15 +227,36 @@ static int input_callback( const void *input,
         dataBuffer_t *inputData = (dataBuffer_t *)userData;
         unsigned int newFrames = min(frameCount, inputBufsize - inputData->frames);
 
-        size_t len = newFrames * channelCount * sizeof(float);
-        memcpy(inputData->data + inputData->frames * channelCount, data, len);
+        double start = thread_now();
+        arena_enter_realtime();
+        TRACE_THREAD("input callback");
+        TRACE_BEGIN("input callback");
+        if (statusFlags & paInputOverflow)
+                TRACE_INSTANT("input overflow");
+
+        tap_write(&inputTap, timeInfo->inputBufferAdcTime, data, frameCount);
+
+        chanmap_apply(&chanmap, data, inputData->data + inputData->frames * channelCount, newFrames);
         inputData->frames += newFrames;
+        ledger_add(&capture, frameCount, newFrames, 1);
 
-        if (enableResample)
+        if (atomic_load_explicit(&shared.enableResample, memory_order_acquire))
                 resample_buffers();
-        if (enableUpdate)
+        if (atomic_load_explicit(&shared.enableUpdate, memory_order_acquire))
                 update_ratio();
 
+        stats_t stats = {resampleRatio, inputData->frames, ring_count(&outputRing), excursionCounter};
+        seqlock_write(&shared.stats, &stats, sizeof(stats));
+        ledger_t ledger[2] = {capture, resample};
+        seqlock_write(&shared.inputLedger, ledger, sizeof(ledger));
+
+        float ratio[2] = {resampleRatio, stats.outputFrames};
+        tap_write(&ratioTap, timeInfo->inputBufferAdcTime, ratio, 1);
+
+        TRACE_END("input callback");
+        arena_leave_realtime();
+        governor_measure(&governor, thread_now() - start, (double)frameCount / inputRate);
+
         return paContinue;
 }
 
@@ -147,63 +269,187 @@ static int output_callback( const void *input,
                             void *userData )
 {
         float *data = (float *)output;
-        dataBuffer_t *outputData = (dataBuffer_t *)userData;
-        unsigned int newFrames = min(frameCount, outputData->frames);
+        ring_t *outputRing = (ring_t *)userData;
 
-        size_t len = newFrames * channelCount * sizeof(float);
-        memcpy(data, outputData->data, len);
+        arena_enter_realtime();
+        TRACE_THREAD("output callback");
+        TRACE_BEGIN("output callback");
+        if (statusFlags & paOutputUnderflow)
+                TRACE_INSTANT("output underflow");
 
-        len = (frameCount - newFrames) * channelCount * sizeof(float);
-        memset(data + newFrames * channelCount, 0, len);
+        unsigned long newFrames = ring_read(outputRing, data, NULL, frameCount);
+        if (newFrames < frameCount)
+                TRACE_INSTANT("buffer underflow");
 
-        len = (outputData->frames - newFrames) * channelCount * sizeof(float);
-        memcpy(outputData->data, outputData->data + newFrames * channelCount, len);
+        /* a shortage is bridged by repeating the most recent period of the signal */
+        stretch_process(&stretch, data, newFrames, frameCount);
+        ledger_add(&playback, newFrames, frameCount, 1);
+        seqlock_write(&shared.outputLedger, &playback, sizeof(playback));
 
-        outputData->frames -= newFrames;
+        tap_write(&outputTap, timeInfo->outputBufferDacTime, data, frameCount);
+
+        TRACE_END("output callback");
+        arena_leave_realtime();
 
         return paContinue;
 }
 
 /*******************************************************************************************************/
-void stream_finished(void *userData)
+/* In a full-duplex stream the input and output share the clock and the rate, hence the channels
+   are mapped directly from the input to the output, without buffering and without resampling. */
+static int duplex_callback( const void *input,
+                            void *output,
+                            unsigned long frameCount,
+                            const PaStreamCallbackTimeInfo* timeInfo,
+                            PaStreamCallbackFlags statusFlags,
+                            void *userData )
 {
-        keepRunning = 0;
-        return;
+        arena_enter_realtime();
+        TRACE_THREAD("duplex callback");
+        TRACE_BEGIN("duplex callback");
+        if (statusFlags & (paInputOverflow | paOutputUnderflow))
+                TRACE_INSTANT("xrun");
+
+        tap_write(&inputTap, timeInfo->inputBufferAdcTime, input, frameCount);
+        chanmap_apply(&chanmap, (const float *)input, (float *)output, frameCount);
+        tap_write(&outputTap, timeInfo->outputBufferDacTime, output, frameCount);
+
+        ledger_add(&capture, frameCount, frameCount, 1);
+        ledger_add(&playback, frameCount, frameCount, 1);
+        ledger_t ledger[2] = {capture, resample};
+        seqlock_write(&shared.inputLedger, ledger, sizeof(ledger));
+        seqlock_write(&shared.outputLedger, &playback, sizeof(playback));
+
+        TRACE_END("duplex callback");
+        arena_leave_realtime();
+
+        return paContinue;
+}
+
+/*******************************************************************************************************/
+/* Copy the most recent ledgers of both callbacks. */
+void read_ledger(ledger_t *ledger)
+{
+        seqlock_read(&shared.inputLedger, ledger, 2 * sizeof(ledger_t));
+        seqlock_read(&shared.outputLedger, ledger + 2, sizeof(ledger_t));
+}
+
+/*******************************************************************************************************/
+int control_handler(const char *command, const char *argument)
+{
+        if (strcmp(command, "help") == 0)
+        {
+                printf("ratio <value>          set the nominal resampling ratio, 0 for automatic\n");
+                printf("channels <spec>        select or combine input channels, e.g. 3,0:2,4-5,0.5*6+0.5*7\n");
+                printf("converter <name>       switch to the best, medium, fastest, zoh or linear converter\n");
+                printf("trace <filename>       write the most recent trace events to a JSON file\n");
+                printf("counters               show the frames that passed through each stage\n");
+                printf("quit                   stop the streams and exit\n");
+        }
+        else if (strcmp(command, "quit") == 0)
+        {
+                atomic_store_explicit(&shared.keepRunning, 0, memory_order_relaxed);
+        }
+        else if (duplex && (strcmp(command, "ratio") == 0 || strcmp(command, "converter") == 0))
+        {
+                printf("ERROR: There is no resampling in a full-duplex stream.\n");
+                return -1;
+        }
+        else if (strcmp(command, "ratio") == 0)
+        {
+                double ratioTarget = atof(argument);
+                atomic_store_explicit(&shared.ratioTarget, ratioTarget, memory_order_relaxed);
+                printf("Changed nominal resampleRatio to %f\n", ratioTarget > 0 ? ratioTarget : outputRate/inputRate);
+        }
+        else if (strcmp(command, "channels") == 0)
+        {
+                int err = chanmap_set(&chanmap, argument);
+                if (err == -3)
+                        printf("ERROR: The previous change is still in progress.\n");
+                else if (err == -2)
+                        printf("ERROR: Channel number out of range.\n");
+                else if (err)
+                        printf("ERROR: Invalid channel specification.\n");
+                else
+                        printf("Changed channels to %s\n", argument);
+                return err;
+        }
+        else if (strcmp(command, "converter") == 0)
+        {
+                int converter = control_parse_converter(argument);
+                if (converter < 0)
+                {
+                        printf("ERROR: Unknown converter '%s'.\n", argument);
+                        return -1;
+                }
+                /* the main thread changes the converter, the governor may lower the quality below this */
+                governor_select(&governor, converter);
+                printf("Changed to %s rate converter\n", src_get_name(converter));
+                return 0;
+        }
+        else if (strcmp(command, "counters") == 0)
+        {
+                ledger_t ledger[STAGECOUNT];
+                read_ledger(ledger);
+                ledger_print(stageName, ledger, STAGECOUNT, outputRate / inputRate);
+        }
+        else if (strcmp(command, "trace") == 0)
+        {
+                if (trace_dump(argument))
+                {
+                        printf("ERROR: Cannot write the trace, tracing requires compiling with TRACE.\n");
+                        return -1;
+                }
+                printf("Wrote the trace to %s\n", argument);
+        }
+        else
+        {
+                printf("ERROR: Unknown command '%s', type 'help' for a list of commands.\n", command);
+                return -1;
+        }
+
+        return 0;
 }
 
 /*******************************************************************************************************/
 int main(int argc, char *argv[]) {
         char line[STRLEN];
+        size_t arenaSize;
+        const char *channelSpec = option_get(argc, argv, "channels");
+        const char *recordPrefix = option_get(argc, argv, "record");
+        int inputChannelCount;
         float bufferSize, blockSize;
 
         int inputDevice, outputDevice;
-        PaStream *inputStream, *outputStream;
-        PaStreamParameters inputParameters, outputParameters;
+        device_t inputStream = {NULL}, outputStream = {NULL};
+        device_t *devices[2] = {&inputStream, &outputStream};
+        duplex = (option_get(argc, argv, "duplex") != NULL);
+        int enableGovernor = (option_get(argc, argv, "governor") != NULL);
         PaError paErr = paNoError;
         int numDevices;
         const PaDeviceInfo *deviceInfo;
 
         /* STAGE 1: Initialize the audio input and output. */
 
+        /* the status lines are passed on as they are printed when running under the supervisor */
+        setvbuf(stdout, NULL, _IOLBF, 0);
+
         printf("PortAudio version: 0x%08X\n", Pa_GetVersion());
 
         printf("Buffer size in seconds [%.4f]: ", BUFFERSIZE);
-        fgets(line, STRLEN, stdin);
+        option_prompt(argc, argv, "buffer-size", line, STRLEN);
         if (strlen(line) == 1)
             bufferSize = BUFFERSIZE;
         else
             bufferSize = atof(line);
 
         printf("Block size in seconds [%.4f]: ", BLOCKSIZE);
-        fgets(line, STRLEN, stdin);
+        option_prompt(argc, argv, "block-size", line, STRLEN);
         if (strlen(line) == 1)
             blockSize = BLOCKSIZE;
         else
             blockSize = atof(line);
 
-        inputParameters.device = paNoDevice;
-        outputParameters.device = paNoDevice;
-
         /* Initialize library before making any other calls. */
         paErr = Pa_Initialize();
         if( paErr != paNoError )
@@ -240,14 +486,14 @@ int main(int argc, char *argv[]) {
         }
 
         printf("Select input device [%d]: ", Pa_GetDefaultInputDevice());
-        fgets(line, STRLEN, stdin);
+        option_prompt(argc, argv, "input-device", line, STRLEN);
         if (strlen(line)==1)
                 inputDevice = Pa_GetDefaultInputDevice();
         else
                 inputDevice = atoi(line);
 
         printf("Input sampling rate [%.0f]: ", DEFAULTRATE);
-        fgets(line, STRLEN, stdin);
+        option_prompt(argc, argv, "input-rate", line, STRLEN);
         if (strlen(line)==1)
                 inputRate = DEFAULTRATE;
         else
@@ -255,134 +501,195 @@ int main(int argc, char *argv[]) {
 
         deviceInfo = Pa_GetDeviceInfo(inputDevice);
         printf("Number of channels [%d]: ", deviceInfo->maxInputChannels);
-        fgets(line, STRLEN, stdin);
+        option_prompt(argc, argv, "input-channels", line, STRLEN);
         if (strlen(line) == 1)
-            channelCount = deviceInfo->maxInputChannels;
+            inputChannelCount = deviceInfo->maxInputChannels;
         else
-            channelCount = atoi(line);
+            inputChannelCount = atoi(line);
 
-        inputParameters.device = inputDevice;
-        inputParameters.channelCount = channelCount;
-        inputParameters.sampleFormat = SAMPLETYPE;
-        inputParameters.suggestedLatency = Pa_GetDeviceInfo( inputParameters.device )->defaultLowInputLatency;
-        inputParameters.hostApiSpecificStreamInfo = NULL;
+        /* the channel selection or combination is applied before resampling */
+        if (channelSpec == NULL)
+                channelCount = inputChannelCount;
+        else if (chanmap_count(channelSpec, inputChannelCount, &channelCount, NULL) || channelCount == 0)
+        {
+                printf("ERROR: Invalid channel specification '%s'.\n", channelSpec);
+                goto error1;
+        }
 
         inputBufsize = bufferSize * inputRate;
         inputBlocksize = blockSize * inputRate;
 
-        paErr = Pa_OpenStream(
-                &inputStream,
-                &inputParameters,
-                NULL,
-                inputRate,
-                inputBlocksize,
-                paNoFlag,
-                input_callback,
-                &inputData );
-        if( paErr != paNoError )
+        if (!duplex)
         {
-                printf("ERROR: Cannot open input stream.\n");
-                printf("ERROR: %s\n", Pa_GetErrorText( paErr ) );
-                goto error1;
+                /* the device is remembered by name, so that it can be found again after it is replugged */
+                paErr = device_open(&inputStream, inputDevice, 1, inputChannelCount, inputRate, inputBlocksize, input_callback, &inputData);
+                if( paErr != paNoError )
+                {
+                        printf("ERROR: Cannot open input stream.\n");
+                        printf("ERROR: %s\n", Pa_GetErrorText( paErr ) );
+                        goto error1;
+                }
+
+                printf("Opened input stream with %d channels at %.0f Hz.\n", inputChannelCount, inputRate);
         }
 
-        printf("Opened input stream with %d channels at %.0f Hz.\n", channelCount, inputRate);
-        Pa_SetStreamFinishedCallback(&inputStream, stream_finished);
-
         printf("Select output device [%d]: ", Pa_GetDefaultOutputDevice());
-        fgets(line, STRLEN, stdin);
+        option_prompt(argc, argv, "output-device", line, STRLEN);
         if (strlen(line)==1)
                 outputDevice = Pa_GetDefaultOutputDevice();
         else
                 outputDevice = atoi(line);
 
-        printf("Output sampling rate [%.0f]: ", DEFAULTRATE);
-        fgets(line, STRLEN, stdin);
-        if (strlen(line)==1)
-                outputRate = DEFAULTRATE;
+        if (duplex)
+        {
+                /* both devices are driven by the same clock, which requires them to be on the same host API */
+                outputRate = inputRate;
+                printf("Output sampling rate is %.0f Hz.\n", outputRate);
+        }
         else
-                outputRate = atof(line);
-
-        outputParameters.device = outputDevice;
-        outputParameters.channelCount = channelCount;
-        outputParameters.sampleFormat = SAMPLETYPE;
-        outputParameters.suggestedLatency = Pa_GetDeviceInfo( outputParameters.device )->defaultLowOutputLatency;
-        outputParameters.hostApiSpecificStreamInfo = NULL;
+        {
+                printf("Output sampling rate [%.0f]: ", DEFAULTRATE);
+                option_prompt(argc, argv, "output-rate", line, STRLEN);
+                if (strlen(line)==1)
+                        outputRate = DEFAULTRATE;
+                else
+                        outputRate = atof(line);
+        }
 
         outputBufsize = bufferSize * outputRate;
         outputBlocksize = blockSize * outputRate;
 
-        paErr = Pa_OpenStream(
-                &outputStream,
-                NULL,
-                &outputParameters,
-                outputRate,
-                outputBlocksize,
-                paNoFlag,
-                output_callback,
-                &outputData );
-        if( paErr != paNoError )
+        if (duplex)
         {
-                printf("ERROR: Cannot open output stream.\n");
-                printf("ERROR: %s\n", Pa_GetErrorText( paErr ) );
-                goto error1;
+                paErr = device_open_duplex(&inputStream, inputDevice, inputChannelCount, outputDevice, channelCount, inputRate, inputBlocksize, duplex_callback, NULL);
+                if( paErr != paNoError )
+                {
+                        printf("ERROR: Cannot open full-duplex stream.\n");
+                        printf("ERROR: %s\n", Pa_GetErrorText( paErr ) );
+                        goto error1;
+                }
+
+                printf("Opened full-duplex stream with %d input and %d output channels at %.0f Hz.\n", inputChannelCount, channelCount, inputRate);
+        }
+        else
+        {
+                paErr = device_open(&outputStream, outputDevice, 0, channelCount, outputRate, outputBlocksize, output_callback, &outputRing);
+                if( paErr != paNoError )
+                {
+                        printf("ERROR: Cannot open output stream.\n");
+                        printf("ERROR: %s\n", Pa_GetErrorText( paErr ) );
+                        goto error1;
+                }
+
+                printf("Opened output stream with %d channels at %.0f Hz.\n", channelCount, outputRate);
         }
-
-        printf("Opened output stream with %d channels at %.0f Hz.\n", channelCount, outputRate);
-        Pa_SetStreamFinishedCallback(&outputStream, stream_finished);
 
         /* STAGE 2: Initialize the inputData and outputData for use by the callbacks. */
 
+        /* all buffers are carved from a single arena, which is zeroed upon initialization */
+        arenaSize  = arena_round(inputBufsize * channelCount * sizeof(float));
+        arenaSize += arena_round(outputBufsize * channelCount * sizeof(float));
+        arenaSize += ring_arena_size(channelCount, outputBufsize, 0);
+        arenaSize += stretch_arena_size(channelCount, outputRate);
+        arenaSize += chanmap_arena_size(inputChannelCount, channelCount);
+        arenaSize += resampler_arena_size(channelCount, outputBufsize, outputRate / inputRate);
+        if (recordPrefix)
+        {
+                arenaSize += tap_arena_size(inputChannelCount, inputRate);
+                arenaSize += tap_arena_size(channelCount, outputRate);
+                arenaSize += tap_arena_size(2, 1.0 / blockSize);
+        }
+        if (arena_init(&arena, arenaSize))
+        {
+                printf("ERROR: Cannot allocate memory.\n");
+                goto error2;
+        }
+
         inputData.frames = 0;
-        inputData.data = NULL;
-        if ((inputData.data = malloc(inputBufsize * channelCount * sizeof(float))) == NULL)
+        if ((inputData.data = arena_alloc(&arena, inputBufsize * channelCount * sizeof(float))) == NULL)
                 goto error2;
-        else
-                memset(inputData.data, 0, inputBufsize * channelCount * sizeof(float));
 
         outputData.frames = 0;
-        outputData.data = NULL;
-        if ((outputData.data = malloc(outputBufsize * channelCount * sizeof(float))) == NULL)
+        if ((outputData.data = arena_alloc(&arena, outputBufsize * channelCount * sizeof(float))) == NULL)
                 goto error2;
-        else
-                memset(outputData.data, 0, outputBufsize * channelCount * sizeof(float));
-
-        /* STAGE 3: Initialize the resampling. */
-
-        resampleRatio = outputRate / inputRate;
-        printf("Nominal resampleRatio = %f\n", resampleRatio);
 
-        printf("Setting up %s rate converter with %s\n",
-               src_get_name (SRC_SINC_MEDIUM_QUALITY),
-               src_get_description (SRC_SINC_MEDIUM_QUALITY));
+        if (ring_init(&outputRing, channelCount, outputBufsize, 0, &arena))
+                goto error2;
+        if (stretch_init(&stretch, channelCount, outputRate, &arena))
+                goto error2;
+        atomic_init(&shared.keepRunning, 1);
+        seqlock_init(&shared.stats);
+        seqlock_init(&shared.inputLedger);
+        seqlock_init(&shared.outputLedger);
+        ledger_init(&capture);
+        ledger_init(&resample);
+        ledger_init(&playback);
+
+        if (chanmap_init(&chanmap, channelSpec, inputChannelCount, channelCount, CROSSFADE * inputRate, &arena))
+                goto error2;
 
-        resampleState = src_new (SRC_SINC_MEDIUM_QUALITY, channelCount, &srcErr);
-        if (resampleState == NULL)
+        /* the raw input, the output and the resampling ratio with the buffer size are recorded */
+        if (recordPrefix)
         {
-                printf("ERROR: Cannot set up resample state.\n");
-                printf("ERROR: %s\n", src_strerror(srcErr));
-                goto error3;
+                if (tap_open(&inputTap, recordPrefix, "input", inputChannelCount, inputRate, &arena) ||
+                    tap_open(&outputTap, recordPrefix, "output", channelCount, outputRate, &arena) ||
+                    tap_open(&ratioTap, recordPrefix, "ratio", 2, 1.0 / blockSize, &arena))
+                {
+                        printf("ERROR: Cannot open the recording files.\n");
+                        goto error2;
+                }
+                recorder_start();
         }
 
-        srcErr = src_set_ratio (resampleState, resampleRatio);
-        if (srcErr)
+        /* STAGE 3: Initialize the resampling. */
+
+        /* a full-duplex stream runs without resampling and without adjustment of the ratio */
+        if (!duplex)
         {
-                printf("ERROR: Cannot set resampling ratio.\n");
-                printf("ERROR: %s\n", src_strerror(srcErr));
-                goto error3;
+                resampleRatio = outputRate / inputRate;
+                printf("Nominal resampleRatio = %f\n", resampleRatio);
+
+                printf("Setting up %s rate converter with %s\n",
+                       src_get_name (SRC_SINC_MEDIUM_QUALITY),
+                       src_get_description (SRC_SINC_MEDIUM_QUALITY));
+
+                srcErr = resampler_init (&resampler, SRC_SINC_MEDIUM_QUALITY, channelCount, outputBufsize, resampleRatio, CROSSFADE * outputRate, &arena);
+                if (srcErr)
+                {
+                        printf("ERROR: Cannot set up resample state.\n");
+                        printf("ERROR: %s\n", src_strerror(srcErr));
+                        goto error3;
+                }
+
+                srcErr = resampler_set_ratio (&resampler, resampleRatio);
+                if (srcErr)
+                {
+                        printf("ERROR: Cannot set resampling ratio.\n");
+                        printf("ERROR: %s\n", src_strerror(srcErr));
+                        goto error3;
+                }
+
+                /* the quality can be lowered when the input callback uses too much of its time */
+                governor_init(&governor, SRC_SINC_MEDIUM_QUALITY, enableGovernor);
         }
 
+        /* all memory has been allocated, nothing can be added after the streams start */
+        arena_seal(&arena);
+
         /* STAGE 4: Start the streams. */
 
-        paErr = Pa_StartStream( outputStream );
-        if( paErr != paNoError )
+        if (!duplex)
         {
-                printf("ERROR: Cannot start output stream.\n");
-                printf("ERROR: %s\n", Pa_GetErrorText( paErr ) );
-                goto error3;
+                paErr = device_start( &outputStream );
+                if( paErr != paNoError )
+                {
+                        printf("ERROR: Cannot start output stream.\n");
+                        printf("ERROR: %s\n", Pa_GetErrorText( paErr ) );
+                        goto error3;
+                }
         }
 
-        paErr = Pa_StartStream( inputStream );
+        paErr = device_start( &inputStream );
         if( paErr != paNoError )
         {
                 printf("ERROR: Cannot start input stream.\n");
@@ -390,42 +697,66 @@ int main(int argc, char *argv[]) {
                 goto error3;
         }
 
-        printf("Filling buffer...\n");
+        if (!duplex)
+        {
+                printf("Filling buffer...\n");
 
-        /* Wait one second to fill the input buffer halfway */
-        Pa_Sleep(1000);
-        enableResample = 1;
+                /* Wait one second to fill the input buffer halfway */
+                Pa_Sleep(1000);
+                atomic_store_explicit(&shared.enableResample, 1, memory_order_release);
 
-        /* Wait one second to enable the updating of the resampling ratio */
-        Pa_Sleep(1000);
-        enableUpdate = 1;
+                /* Wait one second to enable the updating of the resampling ratio */
+                Pa_Sleep(1000);
+                atomic_store_explicit(&shared.enableUpdate, 1, memory_order_release);
+        }
 
         printf("Processing data...\n");
+        printf("Type 'help' for a list of commands to change the settings.\n");
+        control_start(control_handler);
 
-        while (keepRunning)
+        while (atomic_load_explicit(&shared.keepRunning, memory_order_relaxed))
         {
-                Pa_Sleep(1000);
+                for (int i = 0; i < 10 && atomic_load_explicit(&shared.keepRunning, memory_order_relaxed); i++)
+                {
+                        Pa_Sleep(100);
+
+                        /* the buffers and the resampler are kept, the streams continue when the devices are back */
+                        device_watch(devices, duplex ? 1 : 2);
+                        if (!duplex)
+                                update_converter();
+                }
+                if (duplex)
+                        continue;
+                stats_t stats;
+                ledger_t ledger[STAGECOUNT];
+                seqlock_read(&shared.stats, &stats, sizeof(stats));
+                read_ledger(ledger);
                 printf("inputRate = %8.4f, ", inputRate);
-                printf("resampleRatio = %8.4f, ", resampleRatio);
-                printf("inputData = %4lu, ", inputData.frames);
-                printf("outputData = %6lu", outputData.frames);
+                printf("resampleRatio = %8.4f, ", stats.resampleRatio);
+                printf("inputData = %4lu, ", stats.inputFrames);
+                printf("outputData = %6lu", stats.outputFrames);
+                printf(", offset = %.1f", ledger_chain(ledger, STAGECOUNT));
+                printf(", load = %.0f%%", 100 * governor.load);
+                if (stats.excursions)
+                        printf(", excursions = %lu", stats.excursions);
+                if (atomic_load_explicit(&stretch.stretches, memory_order_relaxed))
+                        printf(", stretches = %lu (%lu frames)", atomic_load_explicit(&stretch.stretches, memory_order_relaxed), atomic_load_explicit(&stretch.stretchedFrames, memory_order_relaxed));
+                if (atomic_load_explicit(&stretch.silences, memory_order_relaxed))
+                        printf(", silences = %lu", atomic_load_explicit(&stretch.silences, memory_order_relaxed));
                 printf("\n");
         }
 
-        paErr = Pa_StopStream( outputStream );
+        paErr = device_close( &inputStream );
         if( paErr != paNoError ) goto error3;
-        paErr = Pa_CloseStream( outputStream );
+        paErr = device_close( &outputStream );
         if( paErr != paNoError ) goto error3;
 
 error3:
-        if (resampleState)
-                src_delete (resampleState);
+        resampler_free (&resampler);
 
 error2:
-        if (inputData.data)
-                free(inputData.data);
-        if (outputData.data)
-                free(outputData.data);
+        recorder_stop();
+        arena_free(&arena);
 
 error1:
         Pa_Terminate();
@@ -0,0 +1,458 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <limits.h>
+
+#include "resampler.h"
+
+#define min(x, y) ((x)<(y) ? x : y)
+
+/*******************************************************************************************************/
+/* The ring holds the pre-history, the input of a single call, and as much pre-history again for
+   the input that arrives while the control thread primes a new state. */
+static unsigned long past_frames(unsigned long maxFrames, double ratio)
+{
+        return 2 * RESAMPLERPRIME / min(ratio, 1) + maxFrames / ratio + 1;
+}
+
+/*******************************************************************************************************/
+/* The padding after a switch is at most the difference in delay between the best and the fastest
+   converter, the queue in front of the output holds twice that. */
+static unsigned long front_frames(double ratio)
+{
+        return 2 * resampler_delay(SRC_SINC_BEST_QUALITY, ratio) * ratio + RESAMPLERPIECE;
+}
+
+/*******************************************************************************************************/
+size_t resampler_arena_size(int channelCount, unsigned long maxFrames, double ratio)
+{
+        size_t size = arena_round(maxFrames * channelCount * sizeof(float));
+        size += arena_round(RESAMPLERPIECE * channelCount * sizeof(float));
+        size += arena_round(past_frames(maxFrames, ratio) * channelCount * sizeof(float));
+        size += arena_round(front_frames(ratio) * channelCount * sizeof(float));
+        return size;
+}
+
+/*******************************************************************************************************/
+double resampler_delay(int converter, double ratio)
+{
+        /* the half length of the sinc filters is their number of coefficients divided by the oversampling,
+           the linear interpolator looks one frame ahead and the zero order hold does not look ahead */
+        static const double half[] = {142.9, 45.7, 19.3, 0, 1};
+
+        if (converter < SRC_SINC_BEST_QUALITY || converter > SRC_LINEAR)
+                return 0;
+        else if (converter <= SRC_SINC_FASTEST && ratio < 1)
+                return half[converter] / ratio;
+        else
+                return half[converter];
+}
+
+/*******************************************************************************************************/
+/* Return the input frame that is used for the frame that lies k frames before the start, the input
+   is reflected back and forth if it is shorter than that. */
+static unsigned long reflect(unsigned long k, unsigned long frames)
+{
+        unsigned long period = 2 * (frames - 1);
+        if (frames < 2)
+                return 0;
+        k %= period;
+        return (k < frames ? k : period - k);
+}
+
+/*******************************************************************************************************/
+/* Convert with one of the states and keep track of its lag. */
+static int resampler_convert(resampler_t *resampler, int index, SRC_DATA *data)
+{
+        int srcErr = src_process(resampler->state[index], data);
+        if (!srcErr)
+                resampler->lag[index] += data->input_frames_used - data->output_frames_gen / data->src_ratio;
+        return srcErr;
+}
+
+/*******************************************************************************************************/
+/* Pass the input through the state while priming, the output goes around the ring in front. */
+static int resampler_feed(resampler_t *resampler, int index, const float *input, unsigned long frames, double ratio)
+{
+        int channelCount = resampler->channelCount;
+        SRC_DATA feed = {0};
+        int srcErr;
+
+        feed.src_ratio    = ratio;
+        feed.data_in      = input;
+        feed.input_frames = frames;
+        while (feed.input_frames > 0)
+        {
+                feed.data_out      = resampler->front + resampler->cursor * channelCount;
+                feed.output_frames = resampler->frontFrames - resampler->cursor;
+                if ((srcErr = resampler_convert(resampler, index, &feed)))
+                        return srcErr;
+                if (feed.input_frames_used == 0 && feed.output_frames_gen == 0)
+                        break;
+                feed.data_in += feed.input_frames_used * channelCount;
+                feed.input_frames -= feed.input_frames_used;
+                resampler->cursor = (resampler->cursor + feed.output_frames_gen) % resampler->frontFrames;
+                resampler->generated += feed.output_frames_gen;
+        }
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+/* Pass the frames from first up to last in the ring with the input through the state. */
+static int resampler_catch_up(resampler_t *resampler, int index, unsigned long first, unsigned long last, double ratio)
+{
+        int srcErr;
+
+        while (first < last)
+        {
+                unsigned long offset = first % resampler->pastFrames;
+                unsigned long frames = min(last - first, resampler->pastFrames - offset);
+                if ((srcErr = resampler_feed(resampler, index, resampler->past + offset * resampler->channelCount, frames, ratio)))
+                        return srcErr;
+                first += frames;
+        }
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+/* Pass a reflection of the first input through the state. The sinc filter is stretched when
+   downsampling, so the pre-history is longer. */
+static int resampler_prime(resampler_t *resampler, int index, const SRC_DATA *data)
+{
+        int channelCount = resampler->channelCount;
+        unsigned long length = RESAMPLERPRIME / (data->src_ratio < 1 ? data->src_ratio : 1);
+        int srcErr;
+
+        while (length > 0)
+        {
+                unsigned long frames = min(length, RESAMPLERPIECE);
+                for (unsigned long i = 0; i < frames; i++)
+                        memcpy(resampler->history + i * channelCount, data->data_in + reflect(length - i, data->input_frames) * channelCount, channelCount * sizeof(float));
+                length -= frames;
+
+                if ((srcErr = resampler_feed(resampler, index, resampler->history, frames, data->src_ratio)))
+                        return srcErr;
+        }
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+/* Pad the output with the last frames that were produced while priming, these lie between the
+   output of the previous state and the first output of this one. The scratch buffer is free at
+   the start of a crossfade and is used to unroll the ring. */
+static void resampler_pad(resampler_t *resampler)
+{
+        int channelCount = resampler->channelCount;
+        size_t size = channelCount * sizeof(float);
+
+        if (resampler->adjust <= 0)
+                return;
+
+        long frames = min(resampler->adjust, (long)min(resampler->frontFrames, resampler->scratchFrames));
+        long known = min(frames, (long)min(resampler->generated, resampler->frontFrames));
+        for (long i = 0; i < known; i++)
+        {
+                unsigned long k = (resampler->cursor + resampler->frontFrames - known + i) % resampler->frontFrames;
+                memcpy(resampler->scratch + (frames - known + i) * channelCount, resampler->front + k * channelCount, size);
+        }
+
+        /* if too little was produced, the first of them is repeated */
+        for (long i = 0; i < frames - known; i++)
+        {
+                if (known)
+                        memcpy(resampler->scratch + i * channelCount, resampler->scratch + (frames - known) * channelCount, size);
+                else
+                        memset(resampler->scratch + i * channelCount, 0, size);
+        }
+
+        memcpy(resampler->front, resampler->scratch, frames * size);
+        resampler->frontCount = frames;
+        resampler->adjust -= frames;
+}
+
+/*******************************************************************************************************/
+/* Write the input to the ring, from which the next state is primed. The write is announced before
+   it checks what the control thread reads, and the control thread does the reverse, so either it is
+   skipped or the control thread sees it and tries again later. */
+static void resampler_keep(resampler_t *resampler, const float *input, unsigned long frames)
+{
+        int channelCount = resampler->channelCount;
+        unsigned long written = atomic_load_explicit(&resampler->written, memory_order_relaxed);
+
+        atomic_store(&resampler->writing, written + frames);
+        unsigned long reading = atomic_load(&resampler->reading);
+        int skip = (reading != ULONG_MAX && written + frames - reading > resampler->pastFrames);
+        if (skip)
+                resampler->intact = written + frames;
+
+        for (unsigned long i = 0; i < frames && !skip; )
+        {
+                unsigned long offset = (written + i) % resampler->pastFrames;
+                unsigned long n = min(frames - i, resampler->pastFrames - offset);
+                memcpy(resampler->past + offset * channelCount, input + i * channelCount, n * channelCount * sizeof(float));
+                i += n;
+        }
+
+        atomic_store_explicit(&resampler->written, written + frames, memory_order_release);
+}
+
+/*******************************************************************************************************/
+int resampler_init(resampler_t *resampler, int converter, int channelCount, unsigned long maxFrames, double ratio, unsigned long fadeFrames, arena_t *arena)
+{
+        int srcErr = 0;
+
+        resampler->active = 0;
+        resampler->channelCount = channelCount;
+        resampler->converter[0] = converter;
+        resampler->converter[1] = -1;
+        resampler->state[0] = src_new(converter, channelCount, &srcErr);
+        resampler->state[1] = NULL;
+        resampler->fadeFrames = fadeFrames;
+        resampler->fadePosition = fadeFrames;
+        resampler->scratchFrames = maxFrames;
+        resampler->scratchCount = 0;
+        resampler->primed[0] = 0;
+        resampler->primed[1] = 0;
+        resampler->lag[0] = 0;
+        resampler->lag[1] = 0;
+        resampler->delay = 0;
+        resampler->position = 0;
+        resampler->prepared = 0;
+        resampler->adjust = 0;
+        resampler->ratio = ratio;
+        resampler->pastFrames = past_frames(maxFrames, ratio);
+        resampler->fed = 0;
+        resampler->intact = 0;
+        resampler->frontFrames = front_frames(ratio);
+        resampler->frontCount = 0;
+        resampler->cursor = 0;
+        resampler->generated = 0;
+        atomic_init(&resampler->pending, 0);
+        atomic_init(&resampler->fading, 0);
+        atomic_init(&resampler->written, 0);
+        atomic_init(&resampler->writing, 0);
+        atomic_init(&resampler->reading, ULONG_MAX);
+
+        if (resampler->state[0] == NULL)
+                return srcErr;
+
+        resampler->scratch = arena_alloc(arena, maxFrames * channelCount * sizeof(float));
+        resampler->history = arena_alloc(arena, RESAMPLERPIECE * channelCount * sizeof(float));
+        resampler->past = arena_alloc(arena, resampler->pastFrames * channelCount * sizeof(float));
+        resampler->front = arena_alloc(arena, resampler->frontFrames * channelCount * sizeof(float));
+        if (!resampler->scratch || !resampler->history || !resampler->past || !resampler->front)
+                return 1; /* this corresponds to SRC_ERR_MALLOC_FAILED */
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+int resampler_set_ratio(resampler_t *resampler, double ratio)
+{
+        resampler->ratio = ratio;
+        return src_set_ratio(resampler->state[resampler->active], ratio);
+}
+
+/*******************************************************************************************************/
+int resampler_set_converter(resampler_t *resampler, int converter)
+{
+        int srcErr = 0;
+
+        /* the first block primes the first state, after that the input is kept in the ring */
+        unsigned long written = atomic_load_explicit(&resampler->written, memory_order_acquire);
+        if (written == 0)
+                return -1;
+
+        /* the previous change must have been completed, this includes the queue in front */
+        if (atomic_load_explicit(&resampler->pending, memory_order_acquire) || atomic_load_explicit(&resampler->fading, memory_order_acquire))
+                return -1;
+
+        /* the real-time thread does not touch the inactive state, so it can be replaced */
+        int inactive = 1 - resampler->active;
+        if (resampler->state[inactive])
+                src_delete(resampler->state[inactive]);
+        resampler->state[inactive] = src_new(converter, resampler->channelCount, &srcErr);
+        resampler->converter[inactive] = converter;
+        resampler->prepared = inactive;
+        resampler->primed[inactive] = 0;
+        resampler->lag[inactive] = 0;
+        resampler->cursor = 0;
+        resampler->generated = 0;
+        if (resampler->state[inactive] == NULL)
+                return srcErr;
+
+        /* prime it with the most recent input, unless the real-time thread is already overwriting that */
+        unsigned long length = min((unsigned long)(RESAMPLERPRIME / min(resampler->ratio, 1)), written);
+        atomic_store(&resampler->reading, written - length);
+        if (atomic_load(&resampler->writing) - (written - length) > resampler->pastFrames)
+        {
+                atomic_store_explicit(&resampler->reading, ULONG_MAX, memory_order_release);
+                return -1;
+        }
+        srcErr = resampler_catch_up(resampler, inactive, written - length, written, resampler->ratio);
+        atomic_store_explicit(&resampler->reading, ULONG_MAX, memory_order_release);
+        if (srcErr)
+                return srcErr;
+        resampler->primed[inactive] = 1;
+        resampler->fed = written;
+
+        /* hand it over to the real-time thread */
+        atomic_store_explicit(&resampler->pending, 1, memory_order_release);
+        return 0;
+}
+
+/*******************************************************************************************************/
+int resampler_get_converter(resampler_t *resampler)
+{
+        /* the pending one will be in use at the start of the next block */
+        if (atomic_load_explicit(&resampler->pending, memory_order_acquire))
+                return resampler->converter[resampler->prepared];
+        else
+                return resampler->converter[resampler->active];
+}
+
+/*******************************************************************************************************/
+int resampler_process(resampler_t *resampler, SRC_DATA *data)
+{
+        int channelCount = resampler->channelCount;
+        size_t size = channelCount * sizeof(float);
+        int srcErr;
+
+        if (atomic_load_explicit(&resampler->pending, memory_order_acquire))
+        {
+                int next = 1 - resampler->active;
+                unsigned long written = atomic_load_explicit(&resampler->written, memory_order_relaxed);
+
+                /* the new state still needs the input that came after it was primed, if that is no longer
+                   in the ring the change is abandoned and the control thread tries again */
+                if (resampler->fed >= resampler->intact && written - resampler->fed <= resampler->pastFrames)
+                {
+                        src_set_ratio(resampler->state[next], data->src_ratio);
+                        if ((srcErr = resampler_catch_up(resampler, next, resampler->fed, written, data->src_ratio)))
+                        {
+                                atomic_store_explicit(&resampler->pending, 0, memory_order_release);
+                                return srcErr;
+                        }
+
+                        /* swap the states at the block boundary, align the new output with the old one and start the crossfade */
+                        resampler->adjust = lround((written - resampler->lag[next] - resampler->position) * data->src_ratio);
+                        resampler_pad(resampler);
+                        resampler->active = next;
+                        resampler->fadePosition = 0;
+                        resampler->scratchCount = 0;
+                        atomic_store_explicit(&resampler->fading, 1, memory_order_relaxed);
+                }
+                atomic_store_explicit(&resampler->pending, 0, memory_order_release);
+        }
+
+        if (!resampler->primed[resampler->active] && data->input_frames > 0)
+        {
+                int active = resampler->active;
+
+                /* only the first state is primed here, this sets the delay of the output */
+                if ((srcErr = resampler_prime(resampler, active, data)))
+                        return srcErr;
+                resampler->primed[active] = 1;
+                resampler->delay = resampler_delay(resampler->converter[active], data->src_ratio);
+                resampler->position = -resampler->delay;
+                resampler->adjust = lround((resampler->delay - resampler->lag[active]) * data->src_ratio);
+                resampler_pad(resampler);
+
+                /* the control thread waits with a change until the padding has been written */
+                if (resampler->frontCount)
+                        atomic_store_explicit(&resampler->fading, 1, memory_order_relaxed);
+        }
+
+        /* the queued frames go in front of the converted frames */
+        long front = min(resampler->frontCount, data->output_frames);
+        memcpy(data->data_out, resampler->front, front * size);
+        memmove(resampler->front, resampler->front + front * channelCount, (resampler->frontCount - front) * size);
+        resampler->frontCount -= front;
+
+        SRC_DATA convert = *data;
+        convert.data_out      += front * channelCount;
+        convert.output_frames -= front;
+        if ((srcErr = resampler_convert(resampler, resampler->active, &convert)))
+                return srcErr;
+        data->input_frames_used = convert.input_frames_used;
+        data->output_frames_gen = convert.output_frames_gen + front;
+        resampler_keep(resampler, data->data_in, data->input_frames_used);
+
+        /* the frames that are dropped are those at the start */
+        if (resampler->adjust < 0)
+        {
+                long drop = min(-resampler->adjust, data->output_frames_gen);
+                memmove(data->data_out, data->data_out + drop * channelCount, (data->output_frames_gen - drop) * size);
+                data->output_frames_gen -= drop;
+                resampler->adjust += drop;
+        }
+
+        if (resampler->fadePosition < resampler->fadeFrames)
+        {
+                /* the old converter processes the same input, its output is queued in the scratch buffer */
+                SRC_DATA fade = *data;
+                fade.input_frames  = data->input_frames_used;
+                fade.data_out      = resampler->scratch + resampler->scratchCount * channelCount;
+                fade.output_frames = resampler->scratchFrames - resampler->scratchCount;
+                if ((srcErr = resampler_convert(resampler, 1 - resampler->active, &fade)))
+                        return srcErr;
+                resampler->scratchCount += fade.output_frames_gen;
+
+                /* the frames of both are paired, the output is limited to what both have produced */
+                long frames = min(data->output_frames_gen, resampler->scratchCount);
+                for (long i = 0; i < frames && resampler->fadePosition < resampler->fadeFrames; i++)
+                {
+                        float weight = (float)resampler->fadePosition / resampler->fadeFrames;
+                        for (int j = 0; j < channelCount; j++)
+                        {
+                                unsigned long k = i * channelCount + j;
+                                data->data_out[k] = weight * data->data_out[k] + (1.0f - weight) * resampler->scratch[k];
+                        }
+                        resampler->fadePosition++;
+                }
+                memmove(resampler->scratch, resampler->scratch + frames * channelCount, (resampler->scratchCount - frames) * size);
+                resampler->scratchCount -= frames;
+
+                /* the new frames that the old converter did not reach yet go in front of the next output */
+                long ahead = min(data->output_frames_gen - frames, (long)resampler->frontFrames - resampler->frontCount);
+                memmove(resampler->front + ahead * channelCount, resampler->front, resampler->frontCount * size);
+                memcpy(resampler->front, data->data_out + frames * channelCount, ahead * size);
+                resampler->frontCount += ahead;
+                data->output_frames_gen = frames;
+        }
+
+        resampler->position += data->output_frames_gen / data->src_ratio;
+
+        /* the next change can be prepared once the queue in front is empty */
+        if (resampler->fadePosition >= resampler->fadeFrames && resampler->frontCount == 0 && atomic_load_explicit(&resampler->fading, memory_order_relaxed))
+                atomic_store_explicit(&resampler->fading, 0, memory_order_release);
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+void resampler_free(resampler_t *resampler)
+{
+        for (int i = 0; i < 2; i++)
+        {
+                if (resampler->state[i])
+                        src_delete(resampler->state[i]);
+                resampler->state[i] = NULL;
+        }
+}
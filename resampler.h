@@ -0,0 +1,99 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdatomic.h>
+
+#include "samplerate.h"
+#include "arena.h"
+
+#define RESAMPLERPRIME (160)    // in input frames, at least half the length of the longest sinc filter
+#define RESAMPLERPIECE (256)    // in input frames, the pre-history is passed in pieces of this size
+
+/* The resampler keeps two converter states. The control thread prepares the inactive one, the
+   real-time thread swaps them at the start of a block and crossfades from the old to the new
+   output, after which the control thread is allowed to prepare the next change.
+
+   The first state is primed before its first output with a reflection of its first input, so that
+   the output starts at steady state rather than with the ramp-in from the zeros that the sinc
+   filter otherwise sees. The real-time thread keeps the most recent input, with which the control
+   thread primes a new state. At the swap the real-time thread only passes it the input that came
+   after that.
+
+   libsamplerate holds back about half a filter of input, hence its output lags the input. The lag
+   of each state is followed from the frames that go in and out, and the output is padded or
+   trimmed so that it lags by exactly resampler_delay input frames, also after a switch to a
+   converter with another filter length. The padding consists of the last frames that the state
+   produced while it was primed. During the crossfade the output of the state that is ahead is
+   queued until the other one catches up. */
+typedef struct {
+        SRC_STATE *state[2];
+        int converter[2];
+        int active;
+        int channelCount;
+        atomic_int pending;             /* a new state is ready, written by control and cleared by real-time thread */
+        atomic_int fading;              /* the old state is still in use, cleared by real-time thread */
+        unsigned long fadeFrames;
+        unsigned long fadePosition;
+        int primed[2];
+        float *scratch;                 /* queue with the output of the old state during a crossfade */
+        unsigned long scratchFrames;
+        long scratchCount;
+        float *history;                 /* RESAMPLERPIECE frames of the reflected pre-history */
+        double lag[2];                  /* input frames that each state has not yet converted */
+        double delay;                   /* input frames by which the output lags the input */
+        double position;                /* input frame that corresponds to the next output frame */
+        long adjust;                    /* output frames to pad when positive or to drop when negative */
+        double ratio;                   /* the nominal ratio, used for priming by the control thread */
+        float *past;                    /* ring with the most recent input, written by the real-time thread */
+        unsigned long pastFrames;
+        atomic_ulong written;           /* total number of frames written to the ring */
+        atomic_ulong writing;           /* the frames up to which the real-time thread is writing */
+        atomic_ulong reading;           /* the first frame that the control thread is reading, or ULONG_MAX */
+        int prepared;                   /* the state that the control thread prepared last */
+        unsigned long intact;           /* the first frame after the last write that was skipped */
+        unsigned long fed;              /* the frames in the ring up to which the new state has been primed */
+        float *front;                   /* ring with the output while priming, then queue with the frames that go in front of the next output */
+        unsigned long frontFrames;
+        long frontCount;
+        unsigned long cursor;           /* position in the ring while priming */
+        unsigned long generated;        /* number of frames written to the ring while priming */
+} resampler_t;
+
+/* Return the number of input frames that libsamplerate holds back, this is half the length of the
+   filter, which is stretched when downsampling. */
+double resampler_delay(int converter, double ratio);
+
+/* Return the number of bytes that the resampler needs from the arena. */
+size_t resampler_arena_size(int channelCount, unsigned long maxFrames, double ratio);
+
+/* Set up the resampler, maxFrames is the largest number of output frames in a single call and
+   ratio is the nominal ratio, which determines how much input is kept for priming. */
+int resampler_init(resampler_t *resampler, int converter, int channelCount, unsigned long maxFrames, double ratio, unsigned long fadeFrames, arena_t *arena);
+
+/* Set the ratio without smoothing, this should only be called before the streams start. */
+int resampler_set_ratio(resampler_t *resampler, double ratio);
+
+/* Prepare a switch to another converter, this is called from the control thread. */
+int resampler_set_converter(resampler_t *resampler, int converter);
+
+/* Return the converter that is currently in use. */
+int resampler_get_converter(resampler_t *resampler);
+
+/* Drop-in replacement for src_process, this is called from the real-time thread. */
+int resampler_process(resampler_t *resampler, SRC_DATA *data);
+
+void resampler_free(resampler_t *resampler);
+
+#endif
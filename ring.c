@@ -0,0 +1,96 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+#include <string.h>
+
+#include "ring.h"
+
+#define min(x, y) ((x)<(y) ? x : y)
+
+/*******************************************************************************************************/
+size_t ring_arena_size(int channelCount, unsigned long size, int timed)
+{
+        return arena_round(size * channelCount * sizeof(float)) + (timed ? arena_round(size * sizeof(double)) : 0);
+}
+
+/*******************************************************************************************************/
+int ring_init(ring_t *ring, int channelCount, unsigned long size, int timed, arena_t *arena)
+{
+        ring->channelCount = channelCount;
+        ring->size = size;
+        atomic_init(&ring->head, 0);
+        atomic_init(&ring->tail, 0);
+        ring->data = arena_alloc(arena, size * channelCount * sizeof(float));
+        ring->time = (timed ? arena_alloc(arena, size * sizeof(double)) : NULL);
+        return (ring->data == NULL || (timed && ring->time == NULL) ? -1 : 0);
+}
+
+/*******************************************************************************************************/
+unsigned long ring_count(ring_t *ring)
+{
+        /* the tail is loaded first, hence the difference cannot be negative */
+        unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        unsigned long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        return head - tail;
+}
+
+/*******************************************************************************************************/
+unsigned long ring_space(ring_t *ring)
+{
+        return ring->size - ring_count(ring);
+}
+
+/*******************************************************************************************************/
+unsigned long ring_write(ring_t *ring, const float *data, const double *time, unsigned long frames)
+{
+        unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        int channelCount = ring->channelCount;
+
+        frames = min(frames, ring->size - (head - tail));
+
+        /* the copy may be split in two where the buffer wraps around */
+        unsigned long offset = head % ring->size;
+        unsigned long first = min(frames, ring->size - offset);
+        memcpy(ring->data + offset * channelCount, data, first * channelCount * sizeof(float));
+        memcpy(ring->data, data + first * channelCount, (frames - first) * channelCount * sizeof(float));
+        if (ring->time && time)
+        {
+                memcpy(ring->time + offset, time, first * sizeof(double));
+                memcpy(ring->time, time + first, (frames - first) * sizeof(double));
+        }
+
+        atomic_store_explicit(&ring->head, head + frames, memory_order_release);
+        return frames;
+}
+
+/*******************************************************************************************************/
+unsigned long ring_read(ring_t *ring, float *data, double *time, unsigned long frames)
+{
+        unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        unsigned long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        int channelCount = ring->channelCount;
+
+        frames = min(frames, head - tail);
+
+        unsigned long offset = tail % ring->size;
+        unsigned long first = min(frames, ring->size - offset);
+        memcpy(data, ring->data + offset * channelCount, first * channelCount * sizeof(float));
+        memcpy(data + first * channelCount, ring->data, (frames - first) * channelCount * sizeof(float));
+        if (ring->time && time)
+        {
+                memcpy(time, ring->time + offset, first * sizeof(double));
+                memcpy(time + first, ring->time, (frames - first) * sizeof(double));
+        }
+
+        atomic_store_explicit(&ring->tail, tail + frames, memory_order_release);
+        return frames;
+}
@@ -0,0 +1,54 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+
+#include "arena.h"
+
+/* A single-producer single-consumer queue of interleaved frames between two threads, e.g. between
+   the input and the output callback. The counters only increase, the position in the buffer is
+   the counter modulo the size. The producer publishes the frames with a release store of the
+   head, the consumer releases the space with a release store of the tail, and each side reads the
+   counter of the other with acquire. Neither side ever blocks. A ring can optionally carry a
+   timestamp with every frame, which is passed along with the frames. */
+typedef struct {
+        float *data;
+        double *time;                   /* the timestamp of each frame, NULL if the ring is not timed */
+        int channelCount;
+        unsigned long size;             /* in frames */
+        atomic_ulong head;              /* total number of frames written, only changed by the producer */
+        atomic_ulong tail;              /* total number of frames read, only changed by the consumer */
+} ring_t;
+
+/* Return the number of bytes that the ring needs from the arena. */
+size_t ring_arena_size(int channelCount, unsigned long size, int timed);
+
+/* Set up an empty ring, with a timestamp for every frame if timed is nonzero. */
+int ring_init(ring_t *ring, int channelCount, unsigned long size, int timed, arena_t *arena);
+
+/* Return the number of frames that can be read, this can be called from either side. */
+unsigned long ring_count(ring_t *ring);
+
+/* Return the number of frames that can be written, this can be called from either side. */
+unsigned long ring_space(ring_t *ring);
+
+/* Append at most the specified number of frames, this returns the number that was written. The
+   timestamps are only stored if both the ring and the time argument have them, time can be NULL. */
+unsigned long ring_write(ring_t *ring, const float *data, const double *time, unsigned long frames);
+
+/* Remove at most the specified number of frames, this returns the number that was read. The
+   timestamps are only copied if both the ring and the time argument have them, time can be NULL. */
+unsigned long ring_read(ring_t *ring, float *data, double *time, unsigned long frames);
+
+#endif
@@ -0,0 +1,179 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "ring.h"
+#include "seqlock.h"
+#include "chanmap.h"
+#include "thread.h"
+
+/* This runs the ring, the seqlock and the channel map swaps between threads in the same way as the
+   applications do, with a simulated backend instead of the audio devices. The input thread plays
+   the input callback: it applies the channel map and writes blocks of varying size to the ring,
+   with the number of each frame as its timestamp. The output thread plays the output callback and
+   reads them. The control thread keeps changing the channel map, and the main thread reads the
+   statistics of both sides. All channels of the input carry the same ramp, which every
+   specification below maps onto itself, hence each frame that leaves the ring can be checked,
+   also during the crossfades. Build it with TSAN to have ThreadSanitizer check the memory ordering. */
+
+#define CHANNELS   (2)
+#define RINGFRAMES (1000)       // deliberately not a power of two
+#define MAXBLOCK   (64)
+#define FRAMES     (1000000)
+#define FADEFRAMES (100)
+#define RAMP       (4096)       // the ramp wraps before the float loses precision
+
+typedef struct {
+        unsigned long frames;
+        unsigned long twice;
+        double half;
+} stats_t;
+SEQLOCK_FITS(sizeof(stats_t));
+
+const char *spec[] = {"0,1", "1,0", "0.5*0+0.5*1,1", "1,0.25*0+0.75*1", "0,0"};
+
+ring_t ring;
+chanmap_t chanmap;
+seqlock_t inputStats, outputStats;
+atomic_int inputDone, outputDone;
+atomic_ulong swaps, errors;
+
+/*******************************************************************************************************/
+void publish(seqlock_t *lock, unsigned long frames)
+{
+        stats_t stats = {frames, 2 * frames, 0.5 * frames};
+        seqlock_write(lock, &stats, sizeof(stats));
+}
+
+/*******************************************************************************************************/
+int consistent(seqlock_t *lock)
+{
+        stats_t stats;
+        seqlock_read(lock, &stats, sizeof(stats));
+        return (stats.twice == 2 * stats.frames && stats.half == 0.5 * stats.frames);
+}
+
+/*******************************************************************************************************/
+void *input_thread(void *arg)
+{
+        float input[MAXBLOCK * CHANNELS], output[MAXBLOCK * CHANNELS];
+        double time[MAXBLOCK];
+        unsigned long written = 0;
+
+        for (unsigned long block = 0; written < FRAMES; block++)
+        {
+                unsigned long frames = block % MAXBLOCK + 1, space = ring_space(&ring);
+                if (frames > FRAMES - written)
+                        frames = FRAMES - written;
+                if (frames > space)
+                        frames = space;
+
+                for (unsigned long i = 0; i < frames; i++)
+                {
+                        for (int j = 0; j < CHANNELS; j++)
+                                input[i * CHANNELS + j] = (written + i) % RAMP;
+                        time[i] = written + i;
+                }
+
+                chanmap_apply(&chanmap, input, output, frames);
+                written += ring_write(&ring, output, time, frames);
+                publish(&inputStats, written);
+        }
+
+        atomic_store_explicit(&inputDone, 1, memory_order_release);
+        return NULL;
+}
+
+/*******************************************************************************************************/
+void *output_thread(void *arg)
+{
+        float output[MAXBLOCK * CHANNELS];
+        double time[MAXBLOCK];
+        unsigned long read = 0;
+
+        for (unsigned long block = 0; read < FRAMES; block++)
+        {
+                unsigned long frames = ring_read(&ring, output, time, (block * 7) % MAXBLOCK + 1);
+                for (unsigned long i = 0; i < frames; i++)
+                {
+                        for (int j = 0; j < CHANNELS; j++)
+                                if (fabsf(output[i * CHANNELS + j] - (read + i) % RAMP) > 0.01f)
+                                        atomic_fetch_add(&errors, 1);
+                        if (time[i] != read + i)
+                                atomic_fetch_add(&errors, 1);
+                }
+                read += frames;
+                publish(&outputStats, read);
+        }
+
+        atomic_store_explicit(&outputDone, 1, memory_order_release);
+        return NULL;
+}
+
+/*******************************************************************************************************/
+void *control_thread(void *arg)
+{
+        for (unsigned long i = 0; !atomic_load_explicit(&inputDone, memory_order_acquire); )
+        {
+                /* a change is refused while the previous one is still in progress */
+                if (chanmap_set(&chanmap, spec[i % (sizeof(spec) / sizeof(spec[0]))]) == 0)
+                {
+                        atomic_fetch_add(&swaps, 1);
+                        i++;
+                }
+                thread_sleep(0);
+        }
+        return NULL;
+}
+
+/*******************************************************************************************************/
+int main(int argc, char *argv[])
+{
+        thread_t thread[3];
+        unsigned long reads = 0;
+        arena_t arena;
+
+        if (arena_init(&arena, ring_arena_size(CHANNELS, RINGFRAMES, 1) + chanmap_arena_size(CHANNELS, CHANNELS)) ||
+            ring_init(&ring, CHANNELS, RINGFRAMES, 1, &arena) ||
+            chanmap_init(&chanmap, NULL, CHANNELS, CHANNELS, FADEFRAMES, &arena))
+        {
+                printf("ERROR: Cannot set up the ring and the channel map.\n");
+                return EXIT_FAILURE;
+        }
+        seqlock_init(&inputStats);
+        seqlock_init(&outputStats);
+
+        if (thread_create(&thread[0], input_thread, NULL) || thread_create(&thread[1], output_thread, NULL) || thread_create(&thread[2], control_thread, NULL))
+        {
+                printf("ERROR: Cannot start the threads.\n");
+                return EXIT_FAILURE;
+        }
+
+        /* the monitoring loop */
+        while (!atomic_load_explicit(&outputDone, memory_order_acquire))
+        {
+                if (!consistent(&inputStats) || !consistent(&outputStats))
+                        atomic_fetch_add(&errors, 1);
+                reads++;
+        }
+
+        for (int i = 0; i < 3; i++)
+                thread_join(thread[i]);
+        arena_free(&arena);
+
+        printf("%d frames, %lu channel map swaps, %lu snapshots, %lu errors\n", FRAMES, atomic_load(&swaps), reads, atomic_load(&errors));
+        printf("%s\n", atomic_load(&errors) ? "FAILED" : "PASSED");
+        return (atomic_load(&errors) ? EXIT_FAILURE : EXIT_SUCCESS);
+}
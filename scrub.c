@@ -0,0 +1,111 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#include <string.h>
+
+#include "scrub.h"
+#include "kernel.h"
+
+/*******************************************************************************************************/
+KERNEL_INLINE void scrub_kernel(const uint32_t *restrict input, uint32_t *restrict output, uint32_t *restrict last,
+                                int32_t *restrict bad, int32_t *restrict recovered, int32_t *restrict replaced,
+                                unsigned long frames, const int channelCount)
+{
+        /* the state is kept in local arrays, which the compiler can keep in registers for a known channel count */
+        uint32_t held[channelCount];
+        int32_t wasBad[channelCount], back[channelCount], count[channelCount];
+        for (int j = 0; j < channelCount; j++)
+        {
+                held[j] = last[j];
+                wasBad[j] = bad[j];
+                back[j] = 0;
+                count[j] = 0;
+        }
+
+        for (unsigned long i = 0; i < frames; i++)
+        {
+                const uint32_t *x = input + i * channelCount;
+                uint32_t *y = output + i * channelCount;
+                for (int j = 0; j < channelCount; j++)
+                {
+                        /* a value is not finite if all bits of its exponent are set, the bits are
+                           selected with a mask rather than with a branch so that the loop vectorizes */
+                        int32_t finite = ((x[j] & 0x7f800000u) != 0x7f800000u);
+                        uint32_t mask = -(uint32_t)finite;
+                        held[j] = (x[j] & mask) | (held[j] & ~mask);
+                        y[j] = held[j];
+                        back[j] |= wasBad[j] & finite;
+                        wasBad[j] = !finite;
+                        count[j] += !finite;
+                }
+        }
+
+        for (int j = 0; j < channelCount; j++)
+        {
+                last[j] = held[j];
+                bad[j] = wasBad[j];
+                recovered[j] = back[j];
+                replaced[j] = count[j];
+        }
+}
+
+/*******************************************************************************************************/
+size_t scrub_arena_size(int channelCount)
+{
+        return arena_round(channelCount * sizeof(float)) + 3 * arena_round(channelCount * sizeof(int32_t)) + arena_round(channelCount * sizeof(unsigned long));
+}
+
+/*******************************************************************************************************/
+int scrub_init(scrub_t *scrub, int channelCount, arena_t *arena)
+{
+        scrub->channelCount = channelCount;
+        scrub->total = 0;
+        scrub->recoveries = 0;
+
+        scrub->last      = arena_alloc(arena, channelCount * sizeof(float));
+        scrub->bad       = arena_alloc(arena, channelCount * sizeof(int32_t));
+        scrub->recovered = arena_alloc(arena, channelCount * sizeof(int32_t));
+        scrub->replaced  = arena_alloc(arena, channelCount * sizeof(int32_t));
+        scrub->count     = arena_alloc(arena, channelCount * sizeof(unsigned long));
+        if (!scrub->last || !scrub->bad || !scrub->recovered || !scrub->replaced || !scrub->count)
+                return -1;
+
+        memset(scrub->last, 0, channelCount * sizeof(float));
+        memset(scrub->bad, 0, channelCount * sizeof(int32_t));
+        memset(scrub->count, 0, channelCount * sizeof(unsigned long));
+        return 0;
+}
+
+/*******************************************************************************************************/
+int scrub_copy(scrub_t *scrub, const float *input, float *output, unsigned long frames)
+{
+        int channelCount = scrub->channelCount;
+        int recoveries = 0;
+
+        /* the values are handled as bits, which are the same for float and uint32_t */
+        KERNEL_DISPATCH(channelCount, scrub_kernel, (const uint32_t *)input, (uint32_t *)output, (uint32_t *)scrub->last,
+                        scrub->bad, scrub->recovered, scrub->replaced, frames);
+
+        /* the totals are only updated for the channels that had non-finite values */
+        for (int j = 0; j < channelCount; j++)
+        {
+                if (scrub->replaced[j])
+                {
+                        scrub->count[j] += scrub->replaced[j];
+                        scrub->total += scrub->replaced[j];
+                }
+                recoveries += scrub->recovered[j];
+        }
+        scrub->recoveries += recoveries;
+
+        return recoveries;
+}
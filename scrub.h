@@ -0,0 +1,46 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef SCRUB_H
+#define SCRUB_H
+
+#include <stdint.h>
+
+#include "arena.h"
+
+/* An EEG amplifier can send NaN or Inf, for example while an electrode is disconnected. A single
+   non-finite value would persist in the state of every recursive filter that it passes through,
+   hence these values are replaced by the most recent finite value of the channel while the frames
+   are copied. The test looks at the exponent bits rather than using isfinite, so that the loop
+   over the channels vectorizes and the copy runs at close to the speed of memcpy. */
+typedef struct {
+        int channelCount;
+        float *last;                    /* the most recent finite value of each channel */
+        int32_t *bad;                   /* whether the most recent value of each channel was replaced */
+        int32_t *recovered;             /* whether the channel became finite again in the most recent call */
+        int32_t *replaced;              /* number of values replaced in the most recent call */
+        unsigned long *count;           /* total number of values replaced in each channel */
+        unsigned long total;            /* total number of values replaced in all channels */
+        unsigned long recoveries;       /* number of times that a channel became finite again */
+} scrub_t;
+
+/* Return the number of bytes that the scrubber needs from the arena. */
+size_t scrub_arena_size(int channelCount);
+
+/* Set up the scrubber, the values start at zero. */
+int scrub_init(scrub_t *scrub, int channelCount, arena_t *arena);
+
+/* Copy interleaved frames and replace the non-finite values, this returns the number of channels
+   that became finite again, for which the state of the filters downstream should be reset. */
+int scrub_copy(scrub_t *scrub, const float *input, float *output, unsigned long frames);
+
+#endif
@@ -0,0 +1,68 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+#include <string.h>
+#include <assert.h>
+
+#include "seqlock.h"
+
+#define WORDS(size) (((size) + sizeof(unsigned long) - 1) / sizeof(unsigned long))
+#define MAXSIZE     (SEQLOCKWORDS * sizeof(unsigned long))
+
+/*******************************************************************************************************/
+void seqlock_init(seqlock_t *lock)
+{
+        atomic_init(&lock->sequence, 0);
+        for (int i = 0; i < SEQLOCKWORDS; i++)
+                atomic_init(&lock->word[i], 0);
+}
+
+/*******************************************************************************************************/
+void seqlock_write(seqlock_t *lock, const void *data, size_t size)
+{
+        unsigned long word[SEQLOCKWORDS] = {0};
+        unsigned int sequence = atomic_load_explicit(&lock->sequence, memory_order_relaxed);
+
+        assert(size <= MAXSIZE);
+        if (size > MAXSIZE)
+                size = MAXSIZE;
+        memcpy(word, data, size);
+
+        /* the odd sequence number must be visible before any of the words changes */
+        atomic_store_explicit(&lock->sequence, sequence + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        for (size_t i = 0; i < WORDS(size); i++)
+                atomic_store_explicit(&lock->word[i], word[i], memory_order_relaxed);
+        atomic_store_explicit(&lock->sequence, sequence + 2, memory_order_release);
+}
+
+/*******************************************************************************************************/
+void seqlock_read(seqlock_t *lock, void *data, size_t size)
+{
+        unsigned long word[SEQLOCKWORDS];
+        unsigned int before, after;
+
+        assert(size <= MAXSIZE);
+        if (size > MAXSIZE)
+                size = MAXSIZE;
+
+        do
+        {
+                before = atomic_load_explicit(&lock->sequence, memory_order_acquire);
+                for (size_t i = 0; i < WORDS(size); i++)
+                        word[i] = atomic_load_explicit(&lock->word[i], memory_order_relaxed);
+                /* the words must have been read before the sequence number is checked again */
+                atomic_thread_fence(memory_order_acquire);
+                after = atomic_load_explicit(&lock->sequence, memory_order_relaxed);
+        } while ((before & 1) || before != after);
+
+        memcpy(data, word, size);
+}
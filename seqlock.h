@@ -0,0 +1,43 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define SEQLOCKWORDS (32)       // the largest snapshot, in multiples of an unsigned long
+
+/* Check at compile time that a snapshot of the specified size fits, use this next to the type. */
+#define SEQLOCK_FITS(size) _Static_assert((size) <= SEQLOCKWORDS * sizeof(unsigned long), "the snapshot does not fit in a seqlock")
+
+/* A snapshot of statistics that is published by a real-time thread and read by the monitoring
+   loop. The writer never waits; it makes the sequence number odd, updates the words and makes it
+   even again. The reader retries until it sees the same even sequence number before and after
+   copying, so that all values in the snapshot belong together. The words themselves are atomic,
+   hence there is no data race even when the reader copies a snapshot that is being overwritten. */
+typedef struct {
+        atomic_uint sequence;
+        atomic_ulong word[SEQLOCKWORDS];
+} seqlock_t;
+
+/* Set up the seqlock with a snapshot that is all zeros. */
+void seqlock_init(seqlock_t *lock);
+
+/* Publish a snapshot, this should only be called from a single thread. A snapshot that is larger
+   than SEQLOCKWORDS words is a programming error, it is truncated when assertions are disabled. */
+void seqlock_write(seqlock_t *lock, const void *data, size_t size);
+
+/* Copy the most recent complete snapshot. */
+void seqlock_read(seqlock_t *lock, void *data, size_t size);
+
+#endif
@@ -0,0 +1,194 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "sonify.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*******************************************************************************************************/
+static const char *skip_space(const char *str)
+{
+        while (*str == ' ')
+                str++;
+        return str;
+}
+
+/*******************************************************************************************************/
+static void nco_init(nco_t *nco, double frequency, double rate)
+{
+        nco->re = 1;
+        nco->im = 0;
+        nco->stepRe = cos(2 * M_PI * frequency / rate);
+        nco->stepIm = sin(2 * M_PI * frequency / rate);
+}
+
+/*******************************************************************************************************/
+static void nco_advance(nco_t *nco)
+{
+        double re = nco->re * nco->stepRe - nco->im * nco->stepIm;
+        double im = nco->re * nco->stepIm + nco->im * nco->stepRe;
+
+        /* keep the amplitude at one, the rounding errors would otherwise accumulate */
+        double scale = (3.0 - (re * re + im * im)) / 2.0;
+        nco->re = re * scale;
+        nco->im = im * scale;
+}
+
+/*******************************************************************************************************/
+int sonify_init(sonify_t *sonify, const char *spec, int channelCount, float inputRate, float outputRate)
+{
+        const char *str = skip_space(spec);
+        char *end;
+        char lowpass[32];
+
+        sonify->channelCount = channelCount;
+        sonify->bandCount = 0;
+
+        while (*str)
+        {
+                double low, high, target;
+
+                if (sonify->bandCount == SONIFYBANDS)
+                        return -2;
+
+                low = strtod(str, &end);
+                if (end == str)
+                        return -1;
+                str = skip_space(end);
+                if (*str != '-')
+                        return -1;
+                str = skip_space(str + 1);
+                high = strtod(str, &end);
+                if (end == str)
+                        return -1;
+                str = skip_space(end);
+                if (*str != ':')
+                        return -1;
+                str = skip_space(str + 1);
+                target = strtod(str, &end);
+                if (end == str)
+                        return -1;
+                str = skip_space(end);
+
+                /* the band must fit in the EEG and the shifted band in the audio */
+                if (low < 0 || high <= low || high >= inputRate / 2)
+                        return -2;
+                if (target - (high - low) / 2 <= 0 || target + (high - low) / 2 >= outputRate / 2)
+                        return -2;
+
+                int b = sonify->bandCount++;
+                sonify->centre[b] = (low + high) / 2;
+                sonify->target[b] = target;
+                nco_init(&sonify->down[b], -sonify->centre[b], inputRate);
+                nco_init(&sonify->up[b], target, outputRate);
+
+                /* the low-pass filter removes the image at twice the centre frequency */
+                snprintf(lowpass, sizeof(lowpass), "lp:%g:4", (high - low) / 2);
+                if (filterbank_init(&sonify->lowpass[b], lowpass, 2 * channelCount, inputRate))
+                        return -2;
+
+                if (*str == ',')
+                        str = skip_space(str + 1);
+                else if (*str)
+                        return -1;
+        }
+
+        return (sonify->bandCount ? 0 : -1);
+}
+
+/*******************************************************************************************************/
+int sonify_width(sonify_t *sonify)
+{
+        return 2 * sonify->bandCount * sonify->channelCount;
+}
+
+/*******************************************************************************************************/
+size_t sonify_arena_size(sonify_t *sonify)
+{
+        size_t size = 0;
+        for (int b = 0; b < sonify->bandCount; b++)
+                size += filterstate_arena_size(&sonify->lowpass[b]);
+        return size;
+}
+
+/*******************************************************************************************************/
+int sonify_alloc(sonify_t *sonify, arena_t *arena)
+{
+        for (int b = 0; b < sonify->bandCount; b++)
+                if (filterstate_init(&sonify->lowpass[b], &sonify->state[b], arena))
+                        return -1;
+        return 0;
+}
+
+/*******************************************************************************************************/
+void sonify_analyze(sonify_t *sonify, const float *input, float *output, unsigned long frames)
+{
+        int channelCount = sonify->channelCount;
+
+        for (unsigned long i = 0; i < frames; i++)
+        {
+                const float *in = input + i * channelCount;
+                float *out = output + i * sonify_width(sonify);
+
+                for (int b = 0; b < sonify->bandCount; b++)
+                {
+                        float *restrict re = out + 2 * b * channelCount;
+                        float *restrict im = re + channelCount;
+                        const float cosine = sonify->down[b].re;
+                        const float sine = sonify->down[b].im;
+
+                        for (int j = 0; j < channelCount; j++)
+                        {
+                                re[j] = in[j] * cosine;
+                                im[j] = in[j] * sine;
+                        }
+                        filterbank_process(&sonify->lowpass[b], &sonify->state[b], re, re, 1);
+                        nco_advance(&sonify->down[b]);
+                }
+        }
+}
+
+/*******************************************************************************************************/
+void sonify_synthesize(sonify_t *sonify, const float *input, float *output, unsigned long frames)
+{
+        int channelCount = sonify->channelCount;
+
+        for (unsigned long i = 0; i < frames; i++)
+        {
+                const float *in = input + i * sonify_width(sonify);
+                float *restrict out = output + i * channelCount;
+
+                for (int j = 0; j < channelCount; j++)
+                        out[j] = 0;
+
+                for (int b = 0; b < sonify->bandCount; b++)
+                {
+                        const float *re = in + 2 * b * channelCount;
+                        const float *im = re + channelCount;
+
+                        /* mixing down halved the amplitude, as the negative frequencies were removed */
+                        const float cosine = 2 * sonify->up[b].re;
+                        const float sine = 2 * sonify->up[b].im;
+
+                        for (int j = 0; j < channelCount; j++)
+                                out[j] += re[j] * cosine - im[j] * sine;
+                        nco_advance(&sonify->up[b]);
+                }
+        }
+}
@@ -0,0 +1,66 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef SONIFY_H
+#define SONIFY_H
+
+#include "arena.h"
+#include "filterbank.h"
+
+#define SONIFYBANDS (8)   // maximum number of frequency bands
+
+/* A numerically controlled oscillator, the phasor is rotated by a fixed step every sample. */
+typedef struct {
+        double re, im;
+        double stepRe, stepIm;
+} nco_t;
+
+/* Single-sideband frequency shift of EEG bands into the audible range. Each band is mixed down
+   to complex baseband at the EEG rate and low-pass filtered, which gives the analytic signal of
+   the band. The in-phase and quadrature components are resampled to the audio rate like any other
+   channel, and are mixed up again to the target frequency. Since only the narrow baseband signal
+   passes through the resampler, the shift comes at no additional cost in the resampler.
+   Per sample the baseband layout is band-major, with first all in-phase and then all quadrature
+   components of the channels. */
+typedef struct {
+        int channelCount;
+        int bandCount;
+        float centre[SONIFYBANDS];              /* centre of each EEG band */
+        float target[SONIFYBANDS];              /* frequency to which the centre is shifted */
+        nco_t down[SONIFYBANDS];                /* at the EEG rate */
+        nco_t up[SONIFYBANDS];                  /* at the audio rate */
+        filterbank_t lowpass[SONIFYBANDS];      /* for the in-phase and quadrature components */
+        filterstate_t state[SONIFYBANDS];
+} sonify_t;
+
+/* Set up the bands from a comma-separated specification like "8-12:1000,13-30:2000", where each
+   band is given as low-high:target in Hz. This returns -1 for a syntax error and -2 for
+   frequencies that are out of range. */
+int sonify_init(sonify_t *sonify, const char *spec, int channelCount, float inputRate, float outputRate);
+
+/* Return the number of baseband channels that pass through the resampler. */
+int sonify_width(sonify_t *sonify);
+
+/* Return the number of bytes that the filter state needs from the arena. */
+size_t sonify_arena_size(sonify_t *sonify);
+
+/* Allocate the filter state. */
+int sonify_alloc(sonify_t *sonify, arena_t *arena);
+
+/* Mix the interleaved EEG down to baseband, this is called at the EEG rate. */
+void sonify_analyze(sonify_t *sonify, const float *input, float *output, unsigned long frames);
+
+/* Mix the resampled baseband up to the target frequencies and sum the bands, this is called at
+   the audio rate. */
+void sonify_synthesize(sonify_t *sonify, const float *input, float *output, unsigned long frames);
+
+#endif
@@ -0,0 +1,198 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+#include <string.h>
+#include <math.h>
+
+#include "stretch.h"
+
+#define min(x, y) ((x)<(y) ? x : y)
+
+/*******************************************************************************************************/
+size_t stretch_arena_size(int channelCount, double rate)
+{
+        unsigned long historyFrames = STRETCHHISTORY * rate;
+        return arena_round(historyFrames * channelCount * sizeof(float)) + arena_round(historyFrames * sizeof(float)) + arena_round(historyFrames / STRETCHDECIMATE * sizeof(float));
+}
+
+/*******************************************************************************************************/
+int stretch_init(stretch_t *stretch, int channelCount, double rate, arena_t *arena)
+{
+        stretch->channelCount = channelCount;
+        stretch->historyFrames = STRETCHHISTORY * rate;
+        stretch->templateFrames = STRETCHTEMPLATE * rate;
+        stretch->minLag = STRETCHMINLAG * rate;
+        stretch->maxLag = stretch->historyFrames - stretch->templateFrames;
+        stretch->fadeFrames = STRETCHFADE * rate + 1;
+        stretch->limitFrames = STRETCHLIMIT * rate;
+        stretch->filled = 0;
+        stretch->lag = 0;
+        stretch->position = 0;
+        stretch->silent = 1;
+        atomic_init(&stretch->stretches, 0);
+        atomic_init(&stretch->stretchedFrames, 0);
+        atomic_init(&stretch->silences, 0);
+
+        stretch->history = arena_alloc(arena, stretch->historyFrames * channelCount * sizeof(float));
+        stretch->mono = arena_alloc(arena, stretch->historyFrames * sizeof(float));
+        stretch->coarse = arena_alloc(arena, stretch->historyFrames / STRETCHDECIMATE * sizeof(float));
+        return (stretch->history == NULL || stretch->mono == NULL || stretch->coarse == NULL ? -1 : 0);
+}
+
+/*******************************************************************************************************/
+/* Return the lag between minLag and maxLag at which the last templateFrames of the signal best match the samples before them. */
+static unsigned long best_lag(const float *signal, unsigned long length, unsigned long templateFrames, unsigned long minLag, unsigned long maxLag)
+{
+        const float *recent = signal + length - templateFrames;
+        unsigned long best = maxLag;
+        double bestScore = -INFINITY;
+
+        for (unsigned long lag = minLag; lag <= maxLag; lag++)
+        {
+                const float *earlier = recent - lag;
+                double xy = 0, yy = 1e-12;
+                for (unsigned long k = 0; k < templateFrames; k++)
+                {
+                        xy += recent[k] * earlier[k];
+                        yy += earlier[k] * earlier[k];
+                }
+                /* normalized cross-correlation, without the constant energy of the recent frames */
+                double score = xy / sqrt(yy);
+                if (score > bestScore)
+                {
+                        bestScore = score;
+                        best = lag;
+                }
+        }
+        return best;
+}
+
+/*******************************************************************************************************/
+/* Return the lag at which the most recent frames of the history best match the frames before them. */
+static unsigned long stretch_search(stretch_t *stretch)
+{
+        int channelCount = stretch->channelCount;
+        unsigned long coarseFrames = stretch->historyFrames / STRETCHDECIMATE;
+        unsigned long offset = stretch->historyFrames - coarseFrames * STRETCHDECIMATE;
+
+        for (unsigned long i = 0; i < stretch->historyFrames; i++)
+        {
+                float sum = 0;
+                for (int j = 0; j < channelCount; j++)
+                        sum += stretch->history[i * channelCount + j];
+                stretch->mono[i] = sum;
+        }
+
+        /* the decimated copy ends with the newest frame, the sum over each group is a crude lowpass filter */
+        for (unsigned long i = 0; i < coarseFrames; i++)
+        {
+                float sum = 0;
+                for (int k = 0; k < STRETCHDECIMATE; k++)
+                        sum += stretch->mono[offset + i * STRETCHDECIMATE + k];
+                stretch->coarse[i] = sum;
+        }
+
+        unsigned long templateFrames = stretch->templateFrames / STRETCHDECIMATE;
+        unsigned long minLag = (stretch->minLag + STRETCHDECIMATE - 1) / STRETCHDECIMATE;
+        unsigned long maxLag = min(stretch->maxLag / STRETCHDECIMATE, coarseFrames - templateFrames);
+        unsigned long lag = STRETCHDECIMATE * best_lag(stretch->coarse, coarseFrames, templateFrames, minLag, maxLag);
+
+        /* refine at the full rate within one coarse step on either side */
+        minLag = (lag > stretch->minLag + STRETCHDECIMATE ? lag - STRETCHDECIMATE : stretch->minLag);
+        maxLag = min(lag + STRETCHDECIMATE, stretch->maxLag);
+        return best_lag(stretch->mono, stretch->historyFrames, stretch->templateFrames, minLag, maxLag);
+}
+
+/*******************************************************************************************************/
+/* The frame that continues the repetition of the last lag frames of the history. */
+static const float *stretch_frame(stretch_t *stretch, unsigned long position)
+{
+        return stretch->history + (stretch->historyFrames - stretch->lag + position % stretch->lag) * stretch->channelCount;
+}
+
+/*******************************************************************************************************/
+void stretch_process(stretch_t *stretch, float *data, unsigned long available, unsigned long frames)
+{
+        int channelCount = stretch->channelCount;
+        unsigned long fade = min(stretch->fadeFrames, available);
+
+        /* the real signal resumes, it is crossfaded with the repetition or faded in after silence */
+        if (stretch->lag && !stretch->silent)
+        {
+                for (unsigned long i = 0; i < fade; i++)
+                {
+                        float weight = (float)(i + 1) / (fade + 1);
+                        const float *repeat = stretch_frame(stretch, stretch->position + i);
+                        for (int j = 0; j < channelCount; j++)
+                                data[i * channelCount + j] = weight * data[i * channelCount + j] + (1 - weight) * repeat[j];
+                }
+        }
+        else if (stretch->silent && available > 0 && stretch->filled > 0)
+        {
+                for (unsigned long i = 0; i < fade; i++)
+                        for (int j = 0; j < channelCount; j++)
+                                data[i * channelCount + j] *= (float)(i + 1) / (fade + 1);
+        }
+        if (available > 0)
+        {
+                stretch->lag = 0;
+                stretch->position = 0;
+                stretch->silent = 0;
+        }
+
+        /* keep the real frames as history */
+        unsigned long keep = min(available, stretch->historyFrames);
+        memmove(stretch->history, stretch->history + keep * channelCount, (stretch->historyFrames - keep) * channelCount * sizeof(float));
+        memcpy(stretch->history + (stretch->historyFrames - keep) * channelCount, data + (available - keep) * channelCount, keep * channelCount * sizeof(float));
+        stretch->filled = min(stretch->filled + available, stretch->historyFrames);
+
+        if (available == frames)
+                return;
+
+        float *fill = data + available * channelCount;
+        unsigned long missing = frames - available;
+
+        /* at the start there is nothing to repeat yet */
+        if (stretch->silent || stretch->filled < stretch->historyFrames)
+        {
+                memset(fill, 0, missing * channelCount * sizeof(float));
+                return;
+        }
+
+        if (stretch->lag == 0)
+        {
+                stretch->lag = stretch_search(stretch);
+                atomic_fetch_add_explicit(&stretch->stretches, 1, memory_order_relaxed);
+        }
+
+        for (unsigned long i = 0; i < missing; i++)
+        {
+                const float *repeat = stretch_frame(stretch, stretch->position);
+                float weight = 1;
+
+                /* the shortage lasts too long, fade out over the last frames before the limit */
+                if (stretch->position >= stretch->limitFrames)
+                        weight = 0;
+                else if (stretch->position + stretch->fadeFrames > stretch->limitFrames)
+                        weight = (float)(stretch->limitFrames - stretch->position) / stretch->fadeFrames;
+
+                for (int j = 0; j < channelCount; j++)
+                        fill[i * channelCount + j] = weight * repeat[j];
+                stretch->position++;
+        }
+        atomic_fetch_add_explicit(&stretch->stretchedFrames, missing, memory_order_relaxed);
+
+        if (stretch->position >= stretch->limitFrames)
+        {
+                atomic_fetch_add_explicit(&stretch->silences, 1, memory_order_relaxed);
+                stretch->silent = 1;
+        }
+}
@@ -0,0 +1,57 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+#ifndef STRETCH_H
+#define STRETCH_H
+
+#include <stdatomic.h>
+
+#include "arena.h"
+
+#define STRETCHHISTORY  (0.04)  // in seconds, the most recent output that is kept
+#define STRETCHTEMPLATE (0.01)  // in seconds, the segment that is matched to find the period
+#define STRETCHMINLAG   (0.0025)// in seconds, the shortest period
+#define STRETCHFADE     (0.005) // in seconds, the crossfade back to the real signal
+#define STRETCHLIMIT    (0.1)   // in seconds, a longer shortage is faded to silence
+#define STRETCHDECIMATE (4)     // decimation factor of the coarse search for the period
+
+/* When the output callback gets fewer frames than the audio device asks for, the remainder is
+   filled by repeating the most recent period of the signal, in the manner of WSOLA. The period is
+   the lag at which the most recent output best matches the output before it, so the repeated
+   segment continues smoothly. The period is searched on the sum of the channels, first coarsely on
+   a decimated copy and then refined around the best coarse lag, hence the search takes about the
+   same time for any number of channels. When the real signal resumes it is crossfaded in. Only
+   when the shortage lasts longer than STRETCHLIMIT the output fades to silence, after which the
+   signal fades in again. The interventions are counted. */
+typedef struct {
+        int channelCount;
+        float *history;                 /* the most recent real output frames, the newest last */
+        float *mono, *coarse;           /* the sum of the channels of the history, and its decimated copy */
+        unsigned long historyFrames, filled;
+        unsigned long templateFrames, minLag, maxLag, fadeFrames, limitFrames;
+        unsigned long lag;              /* the period that is repeated, 0 when not stretching */
+        unsigned long position;         /* number of frames that have been inserted */
+        int silent;                     /* the output has faded to silence */
+        atomic_ulong stretches;         /* number of shortages that were bridged */
+        atomic_ulong stretchedFrames;   /* number of frames that were inserted */
+        atomic_ulong silences;          /* number of shortages that ended in silence */
+} stretch_t;
+
+/* Return the number of bytes that the stretcher needs from the arena. */
+size_t stretch_arena_size(int channelCount, double rate);
+
+/* Set up the stretcher, the output starts silent. */
+int stretch_init(stretch_t *stretch, int channelCount, double rate, arena_t *arena);
+
+/* The first available frames of data are real, the remaining ones up to frames are filled. */
+void stretch_process(stretch_t *stretch, float *data, unsigned long available, unsigned long frames);
+
+#endif
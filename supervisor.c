@@ -0,0 +1,592 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+/* this must precede all includes, sched_setaffinity and the CPU_SET macros are GNU extensions */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#if defined __linux__
+#include <sched.h>
+#endif
+#elif defined _WIN32
+// Windows code goes here
+#endif
+
+#include "options.h"
+#include "thread.h"
+
+#define PIPELINECOUNT  (32)    // maximum number of pipelines in the manifest
+#define NAMELEN        (32)
+#define LINELEN        (1024)
+#define ARGCOUNT       (64)    // maximum number of arguments of a pipeline
+#define RESTARTDELAY   (1.0)   // in seconds, the first delay before a pipeline that stopped is started again
+#define RESTARTMAX     (60.0)  // in seconds, the delay doubles up to this value
+#define HEALTHSTALL    (5.0)   // in seconds, a pipeline without output for this long is considered stalled
+#define STATUSINTERVAL (10.0)  // in seconds, how often the health of all pipelines is printed
+#define STOPTIMEOUT    (3.0)   // in seconds, after which a pipeline that does not stop is killed
+
+#if defined __linux__ || defined __APPLE__
+
+/* The supervisor starts the pipelines that are listed in a manifest, each one as a separate
+   lsl2audio, audio2lsl or resampleaudio process. They all run on the same set of cores with their
+   own priority, they are started again when they stop, and their output is collected with the
+   name of the pipeline in front of it. The health of all pipelines is printed together. */
+typedef struct {
+        char name[NAMELEN];
+        int priority;                   /* like the nice value, a lower value runs first */
+        char command[LINELEN];          /* the arguments point into this */
+        char *argv[ARGCOUNT];
+        pid_t pid;                      /* 0 when it is not running */
+        int input, output;              /* pipes to its stdin and from its stdout and stderr */
+        char line[LINELEN];             /* the output line that is not complete yet */
+        size_t length;
+        char status[LINELEN];           /* the most recent complete output line */
+        int enabled;                    /* whether it should be running */
+        unsigned long starts;
+        int exitStatus;
+        double started, lastOutput, restartAt, backoff;
+} pipeline_t;
+
+pipeline_t pipeline[PIPELINECOUNT];
+int pipelineCount = 0, coreCount = 0;
+volatile sig_atomic_t keepRunning = 1;
+
+/*******************************************************************************************************/
+void signal_handler(int sig)
+{
+        keepRunning = 0;
+}
+
+/*******************************************************************************************************/
+/* Split the command in place into arguments, double quotes keep spaces within an argument. */
+int split_command(char *command, char *argv[], int maxCount)
+{
+        int argc = 0;
+        char *str = command, *dest;
+
+        while (*str)
+        {
+                while (*str == ' ' || *str == '\t')
+                        str++;
+                if (*str == 0)
+                        break;
+                if (argc == maxCount - 1)
+                        return -1;
+                argv[argc++] = dest = str;
+                int quoted = 0;
+                while (*str && (quoted || (*str != ' ' && *str != '\t')))
+                {
+                        if (*str == '"')
+                                quoted = !quoted;
+                        else
+                                *dest++ = *str;
+                        str++;
+                }
+                if (*str)
+                        str++;
+                *dest = 0;
+        }
+        argv[argc] = NULL;
+        return argc;
+}
+
+/*******************************************************************************************************/
+/* Each line of the manifest contains the name, the priority and the command of a pipeline, empty
+   lines and lines that start with # are skipped. */
+int read_manifest(const char *filename)
+{
+        char line[LINELEN];
+        int lineNumber = 0;
+        FILE *fp;
+
+        if ((fp = fopen(filename, "r")) == NULL)
+        {
+                printf("ERROR: Cannot open the manifest '%s'.\n", filename);
+                return -1;
+        }
+
+        while (fgets(line, LINELEN, fp))
+        {
+                pipeline_t *p = &pipeline[pipelineCount];
+                int offset = 0;
+
+                lineNumber++;
+                line[strcspn(line, "\r\n")] = 0;
+                if (line[strspn(line, " \t")] == 0 || line[strspn(line, " \t")] == '#')
+                        continue;
+
+                if (pipelineCount == PIPELINECOUNT)
+                {
+                        printf("ERROR: The manifest contains more than %d pipelines.\n", PIPELINECOUNT);
+                        goto error;
+                }
+
+                memset(p, 0, sizeof(pipeline_t));
+                if (sscanf(line, "%31s %d %n", p->name, &p->priority, &offset) != 2 || offset == 0)
+                {
+                        printf("ERROR: Invalid line %d in the manifest.\n", lineNumber);
+                        goto error;
+                }
+                for (int i = 0; i < pipelineCount; i++)
+                        if (strcmp(pipeline[i].name, p->name) == 0)
+                        {
+                                printf("ERROR: The name '%s' is used twice in the manifest.\n", p->name);
+                                goto error;
+                        }
+
+                snprintf(p->command, LINELEN, "%s", line + offset);
+                if (split_command(p->command, p->argv, ARGCOUNT) < 1)
+                {
+                        printf("ERROR: Invalid command on line %d in the manifest.\n", lineNumber);
+                        goto error;
+                }
+                p->input = p->output = -1;
+                p->enabled = 1;
+                p->backoff = RESTARTDELAY;
+                pipelineCount++;
+        }
+
+        fclose(fp);
+        return 0;
+
+error:
+        fclose(fp);
+        return -1;
+}
+
+/*******************************************************************************************************/
+pipeline_t *find_pipeline(const char *name)
+{
+        for (int i = 0; i < pipelineCount; i++)
+                if (strcmp(pipeline[i].name, name) == 0)
+                        return &pipeline[i];
+        printf("ERROR: Unknown pipeline '%s'.\n", name);
+        return NULL;
+}
+
+/*******************************************************************************************************/
+/* This runs in the child process, between fork and exec. */
+void setup_child(pipeline_t *p, int input, int output)
+{
+        dup2(input, STDIN_FILENO);
+        dup2(output, STDOUT_FILENO);
+        dup2(output, STDERR_FILENO);
+        close(input);
+        close(output);
+
+        /* the supervisor handles Ctrl-C and stops the pipelines itself */
+        setpgid(0, 0);
+        signal(SIGPIPE, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+
+        if (setpriority(PRIO_PROCESS, 0, p->priority))
+                printf("WARNING: Cannot set the priority to %d.\n", p->priority);
+
+#if defined __linux__
+        /* all pipelines share the same cores, the threads of the audio and LSL libraries inherit this */
+        if (coreCount > 0)
+        {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                for (int i = 0; i < coreCount; i++)
+                        CPU_SET(i, &set);
+                if (sched_setaffinity(0, sizeof(set), &set))
+                        printf("WARNING: Cannot restrict the pipeline to %d cores.\n", coreCount);
+        }
+#endif
+}
+
+/*******************************************************************************************************/
+int start_pipeline(pipeline_t *p)
+{
+        int input[2], output[2];
+
+        if (pipe(input))
+                return -1;
+        if (pipe(output))
+        {
+                close(input[0]);
+                close(input[1]);
+                return -1;
+        }
+
+        /* the output that is still buffered would otherwise also be written by the child */
+        fflush(stdout);
+
+        p->pid = fork();
+        if (p->pid < 0)
+        {
+                printf("ERROR: Cannot start pipeline '%s'.\n", p->name);
+                p->pid = 0;
+                close(input[0]); close(input[1]);
+                close(output[0]); close(output[1]);
+                return -1;
+        }
+        else if (p->pid == 0)
+        {
+                close(input[1]);
+                close(output[0]);
+                setup_child(p, input[0], output[1]);
+                execvp(p->argv[0], p->argv);
+                printf("ERROR: Cannot execute '%s'.\n", p->argv[0]);
+                _exit(127);
+        }
+
+        close(input[0]);
+        close(output[1]);
+        p->input = input[1];
+        p->output = output[0];
+        fcntl(p->output, F_SETFL, O_NONBLOCK);
+        fcntl(p->input, F_SETFD, FD_CLOEXEC);
+        fcntl(p->output, F_SETFD, FD_CLOEXEC);
+
+        p->length = 0;
+        p->status[0] = 0;
+        p->starts++;
+        p->started = p->lastOutput = thread_now();
+        printf("Started pipeline '%s' with process %d.\n", p->name, (int)p->pid);
+        return 0;
+}
+
+/*******************************************************************************************************/
+void stop_pipeline(pipeline_t *p)
+{
+        if (p->pid > 0)
+                kill(p->pid, SIGTERM);
+}
+
+/*******************************************************************************************************/
+/* Collect the output of the pipeline and print every complete line with its name in front of it. */
+void read_output(pipeline_t *p)
+{
+        ssize_t count;
+
+        while ((count = read(p->output, p->line + p->length, LINELEN - 1 - p->length)) > 0)
+        {
+                p->length += count;
+                p->lastOutput = thread_now();
+
+                char *start = p->line, *end;
+                while ((end = memchr(start, '\n', p->line + p->length - start)) != NULL)
+                {
+                        *end = 0;
+                        printf("[%s] %s\n", p->name, start);
+                        snprintf(p->status, LINELEN, "%s", start);
+                        start = end + 1;
+                }
+
+                /* a very long line is printed in parts */
+                if (start == p->line && p->length == LINELEN - 1)
+                {
+                        p->line[p->length] = 0;
+                        printf("[%s] %s\n", p->name, p->line);
+                        start = p->line + p->length;
+                }
+
+                p->length -= start - p->line;
+                memmove(p->line, start, p->length);
+        }
+
+        if (count == 0)
+        {
+                /* the pipeline closed its output, the exit status follows */
+                close(p->output);
+                p->output = -1;
+        }
+}
+
+/*******************************************************************************************************/
+/* Reap the pipelines that stopped and schedule them to be started again. */
+void reap_pipelines(void)
+{
+        int status;
+        pid_t pid;
+
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+        {
+                for (int i = 0; i < pipelineCount; i++)
+                {
+                        pipeline_t *p = &pipeline[i];
+                        if (p->pid != pid)
+                                continue;
+
+                        double now = thread_now();
+                        p->pid = 0;
+                        p->exitStatus = (WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status));
+                        if (p->output >= 0)
+                        {
+                                read_output(p);
+                                if (p->output >= 0)
+                                        close(p->output);
+                                p->output = -1;
+                        }
+                        close(p->input);
+                        p->input = -1;
+
+                        /* a pipeline that keeps failing is started again with an increasing delay */
+                        if (now - p->started > RESTARTMAX)
+                                p->backoff = RESTARTDELAY;
+                        p->restartAt = now + p->backoff;
+                        if (p->enabled)
+                                printf("WARNING: Pipeline '%s' stopped with status %d, starting again in %.0f seconds.\n", p->name, p->exitStatus, p->backoff);
+                        else
+                                printf("Pipeline '%s' stopped with status %d.\n", p->name, p->exitStatus);
+                        p->backoff = (2 * p->backoff < RESTARTDELAY ? RESTARTDELAY : 2 * p->backoff);
+                        p->backoff = (p->backoff < RESTARTMAX ? p->backoff : RESTARTMAX);
+                }
+        }
+}
+
+/*******************************************************************************************************/
+/* Print the health of each pipeline, followed by a summary of all of them. */
+void print_health(void)
+{
+        double now = thread_now();
+        int running = 0, stalled = 0;
+        unsigned long restarts = 0;
+
+        for (int i = 0; i < pipelineCount; i++)
+        {
+                pipeline_t *p = &pipeline[i];
+                const char *state = "stopped";
+
+                if (p->pid > 0 && now - p->lastOutput > HEALTHSTALL)
+                {
+                        state = "stalled";
+                        stalled++;
+                }
+                else if (p->pid > 0)
+                {
+                        state = "running";
+                        running++;
+                }
+                else if (p->enabled)
+                        state = "restarting";
+                restarts += (p->starts > 1 ? p->starts - 1 : 0);
+
+                printf("pipeline %-12s %-10s priority = %3d, starts = %lu, ", p->name, state, p->priority, p->starts);
+                if (p->pid > 0)
+                        printf("uptime = %.0f s, last output = %.1f s ago", now - p->started, now - p->lastOutput);
+                else
+                        printf("exit status = %d", p->exitStatus);
+                printf("\n");
+                if (p->status[0])
+                        printf("    %s\n", p->status);
+        }
+
+        printf("pipelines = %d, running = %d, stalled = %d, restarts = %lu\n", pipelineCount, running, stalled, restarts);
+}
+
+/*******************************************************************************************************/
+/* The commands are read from stdin in the same loop as the output of the pipelines. */
+int handle_command(char *line)
+{
+        char command[NAMELEN] = "", name[NAMELEN] = "";
+        int offset = 0, remainder = 0;
+        pipeline_t *p;
+
+        line[strcspn(line, "\r\n")] = 0;
+        if (sscanf(line, "%31s %n", command, &offset) < 1)
+                return 0;
+        sscanf(line + offset, "%31s %n", name, &remainder);
+        offset += remainder;
+
+        if (strcmp(command, "help") == 0)
+        {
+                printf("help                   show this help\n");
+                printf("status                 print the health of all pipelines\n");
+                printf("start <name>           start a pipeline that was stopped\n");
+                printf("stop <name>            stop a pipeline and do not start it again\n");
+                printf("restart <name>         stop a pipeline and start it again\n");
+                printf("send <name> <command>  pass a command to the pipeline, see its help\n");
+                printf("quit                   stop all pipelines and the supervisor\n");
+        }
+        else if (strcmp(command, "status") == 0)
+                print_health();
+        else if (strcmp(command, "quit") == 0)
+                keepRunning = 0;
+        else if (strcmp(command, "start") == 0 && (p = find_pipeline(name)))
+        {
+                p->enabled = 1;
+                p->backoff = RESTARTDELAY;
+                p->restartAt = 0;
+        }
+        else if (strcmp(command, "stop") == 0 && (p = find_pipeline(name)))
+        {
+                p->enabled = 0;
+                stop_pipeline(p);
+        }
+        else if (strcmp(command, "restart") == 0 && (p = find_pipeline(name)))
+        {
+                p->enabled = 1;
+                p->backoff = 0;
+                stop_pipeline(p);
+        }
+        else if (strcmp(command, "send") == 0 && (p = find_pipeline(name)))
+        {
+                if (p->pid == 0 || dprintf(p->input, "%s\n", line + offset) < 0)
+                        printf("ERROR: Pipeline '%s' is not running.\n", p->name);
+        }
+        else if (strcmp(command, "start") && strcmp(command, "stop") && strcmp(command, "restart") && strcmp(command, "send"))
+        {
+                printf("ERROR: Unknown command '%s', type 'help' for a list of commands.\n", command);
+                return -1;
+        }
+        return 0;
+}
+
+/*******************************************************************************************************/
+int main(int argc, char *argv[])
+{
+        const char *manifest = option_get(argc, argv, "manifest");
+        struct pollfd fds[PIPELINECOUNT + 1];
+        pipeline_t *polled[PIPELINECOUNT + 1];
+        char line[LINELEN];
+        double lastStatus;
+        int commands = 1;
+
+        coreCount = option_number(argc, argv, "cores", 0);
+
+        if (manifest == NULL || *manifest == 0)
+        {
+                printf("Usage: supervisor --manifest=<file> [--cores=<N>]\n");
+                return 1;
+        }
+        if (read_manifest(manifest))
+                return 1;
+        if (pipelineCount == 0)
+        {
+                printf("ERROR: The manifest does not contain any pipelines.\n");
+                return 1;
+        }
+
+#if defined __APPLE__
+        if (coreCount > 0)
+                printf("WARNING: The pipelines cannot be restricted to %d cores on macOS.\n", coreCount);
+#endif
+
+        /* the output of the pipelines is printed as it arrives */
+        setvbuf(stdout, NULL, _IOLBF, 0);
+        signal(SIGPIPE, SIG_IGN);
+        signal(SIGINT, signal_handler);
+        signal(SIGTERM, signal_handler);
+
+        printf("Supervising %d pipelines", pipelineCount);
+        if (coreCount > 0)
+                printf(" on %d cores", coreCount);
+        printf(".\n");
+        printf("Type 'help' for a list of commands.\n");
+
+        lastStatus = thread_now();
+        while (keepRunning)
+        {
+                double now = thread_now();
+                int count = 0;
+
+                for (int i = 0; i < pipelineCount; i++)
+                        if (pipeline[i].pid == 0 && pipeline[i].enabled && now >= pipeline[i].restartAt)
+                                start_pipeline(&pipeline[i]);
+
+                if (commands)
+                {
+                        fds[count].fd = STDIN_FILENO;
+                        fds[count].events = POLLIN;
+                        polled[count++] = NULL;
+                }
+                for (int i = 0; i < pipelineCount; i++)
+                        if (pipeline[i].output >= 0)
+                        {
+                                fds[count].fd = pipeline[i].output;
+                                fds[count].events = POLLIN;
+                                polled[count++] = &pipeline[i];
+                        }
+
+                if (poll(fds, count, 100) > 0)
+                {
+                        for (int i = 0; i < count; i++)
+                        {
+                                if (!(fds[i].revents & (POLLIN | POLLHUP)))
+                                        continue;
+                                if (polled[i])
+                                        read_output(polled[i]);
+                                else if (fgets(line, LINELEN, stdin))
+                                        handle_command(line);
+                                else
+                                        /* stdin was closed, keep running without commands */
+                                        commands = 0;
+                        }
+                }
+
+                reap_pipelines();
+
+                if (thread_now() - lastStatus >= STATUSINTERVAL)
+                {
+                        print_health();
+                        lastStatus = thread_now();
+                }
+        }
+
+        /* stop all pipelines, and kill the ones that do not stop in time */
+        printf("Stopping all pipelines.\n");
+        for (int i = 0; i < pipelineCount; i++)
+        {
+                pipeline[i].enabled = 0;
+                stop_pipeline(&pipeline[i]);
+        }
+        double deadline = thread_now() + STOPTIMEOUT;
+        for (;;)
+        {
+                int running = 0;
+                reap_pipelines();
+                for (int i = 0; i < pipelineCount; i++)
+                        running += (pipeline[i].pid > 0);
+                if (running == 0)
+                        break;
+                if (thread_now() > deadline)
+                {
+                        for (int i = 0; i < pipelineCount; i++)
+                                if (pipeline[i].pid > 0)
+                                        kill(pipeline[i].pid, SIGKILL);
+                        deadline = thread_now() + STOPTIMEOUT;
+                }
+                thread_sleep(50);
+        }
+
+        printf("Finished.\n");
+        return 0;
+}
+
+#elif defined _WIN32
+
+/*******************************************************************************************************/
+int main(int argc, char *argv[])
+{
+        printf("ERROR: The supervisor is not supported on Windows.\n");
+        return 1;
+}
+
+#endif
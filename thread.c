@@ -0,0 +1,127 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdlib.h>
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#elif defined _WIN32
+// Windows code goes here
+#endif
+
+#include "thread.h"
+
+#if defined _WIN32
+typedef struct {
+        thread_function_t function;
+        void *arg;
+} trampoline_t;
+
+static DWORD WINAPI trampoline(LPVOID param)
+{
+        trampoline_t t = *(trampoline_t *)param;
+        free(param);
+        t.function(t.arg);
+        return 0;
+}
+#endif
+
+/*******************************************************************************************************/
+int thread_create(thread_t *thread, thread_function_t function, void *arg)
+{
+#if defined __linux__ || defined __APPLE__
+        return pthread_create(thread, NULL, function, arg);
+#elif defined _WIN32
+        trampoline_t *t = malloc(sizeof(trampoline_t));
+        if (t == NULL)
+                return -1;
+        t->function = function;
+        t->arg = arg;
+        *thread = CreateThread(NULL, 0, trampoline, t, 0, NULL);
+        if (*thread == NULL)
+        {
+                free(t);
+                return -1;
+        }
+        return 0;
+#endif
+}
+
+/*******************************************************************************************************/
+int thread_join(thread_t thread)
+{
+#if defined __linux__ || defined __APPLE__
+        return pthread_join(thread, NULL);
+#elif defined _WIN32
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+        return 0;
+#endif
+}
+
+/*******************************************************************************************************/
+void thread_sleep(unsigned int msec)
+{
+#if defined __linux__ || defined __APPLE__
+        struct timespec ts;
+        ts.tv_sec = msec / 1000;
+        ts.tv_nsec = (msec % 1000) * 1000000L;
+        nanosleep(&ts, NULL);
+#elif defined _WIN32
+        Sleep(msec);
+#endif
+}
+
+/*******************************************************************************************************/
+double thread_now(void)
+{
+#if defined __linux__ || defined __APPLE__
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec * 1e-9;
+#elif defined _WIN32
+        LARGE_INTEGER count, frequency;
+        QueryPerformanceCounter(&count);
+        QueryPerformanceFrequency(&frequency);
+        return (double)count.QuadPart / frequency.QuadPart;
+#endif
+}
+
+/*******************************************************************************************************/
+void thread_sleep_until(double deadline)
+{
+#if defined __linux__
+        /* an absolute deadline does not accumulate the errors of the individual sleeps */
+        struct timespec ts;
+        ts.tv_sec = (time_t)deadline;
+        ts.tv_nsec = (long)((deadline - ts.tv_sec) * 1e9);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+                ;
+#elif defined __APPLE__
+        /* macOS does not have clock_nanosleep, the remaining time is computed instead */
+        double remaining = deadline - thread_now();
+        if (remaining > 0)
+        {
+                struct timespec ts;
+                ts.tv_sec = (time_t)remaining;
+                ts.tv_nsec = (long)((remaining - ts.tv_sec) * 1e9);
+                nanosleep(&ts, NULL);
+        }
+#elif defined _WIN32
+        double remaining = deadline - thread_now();
+        if (remaining > 0)
+                Sleep((DWORD)(remaining * 1000));
+#endif
+}
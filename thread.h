@@ -0,0 +1,43 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#include <pthread.h>
+typedef pthread_t thread_t;
+#elif defined _WIN32
+// Windows code goes here
+#include <windows.h>
+typedef HANDLE thread_t;
+#endif
+
+typedef void *(*thread_function_t)(void *);
+
+/* Start a background thread, this returns 0 on success. */
+int thread_create(thread_t *thread, thread_function_t function, void *arg);
+
+/* Wait for a background thread to finish. */
+int thread_join(thread_t thread);
+
+/* Sleep for the specified number of milliseconds. */
+void thread_sleep(unsigned int msec);
+
+/* Return the time in seconds of a monotonic clock. */
+double thread_now(void);
+
+/* Sleep until the monotonic clock reaches the deadline in seconds. */
+void thread_sleep_until(double deadline);
+
+#endif
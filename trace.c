@@ -0,0 +1,154 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "trace.h"
+#include "thread.h"
+
+#ifdef TRACE
+
+/* The fields are atomic, so that the dump can read events that are being overwritten without a
+   data race, such events are detected with the head and skipped. */
+typedef struct {
+        _Atomic double time;
+        _Atomic(const char *) name;
+        atomic_int phase;
+        _Atomic float value;
+} record_t;
+
+typedef struct {
+        _Atomic(const char *) name;
+        atomic_ulong head;              /* total number of events, only changed by the owning thread */
+        record_t record[TRACERECORDS];
+} buffer_t;
+
+static buffer_t buffer[TRACETHREADS];
+static atomic_int threadCount = 0;
+static _Thread_local int slot = -1;
+
+/*******************************************************************************************************/
+/* The first event of a thread claims a buffer, when they have all been claimed the events are lost. */
+static buffer_t *trace_buffer(void)
+{
+        if (slot < 0)
+                slot = atomic_fetch_add(&threadCount, 1);
+        return (slot < TRACETHREADS ? &buffer[slot] : NULL);
+}
+
+/*******************************************************************************************************/
+/* The buffers are kept per role, a thread that takes over the role of a thread that has stopped,
+   e.g. the callback of a device that was opened again, continues in the same buffer. */
+void trace_thread(const char *name)
+{
+        if (slot >= 0 && slot < TRACETHREADS && atomic_load_explicit(&buffer[slot].name, memory_order_relaxed) == name)
+                return;
+
+        int count = atomic_load(&threadCount);
+        for (int t = 0; t < count && t < TRACETHREADS; t++)
+        {
+                const char *role = atomic_load_explicit(&buffer[t].name, memory_order_relaxed);
+                if (role && strcmp(role, name) == 0)
+                {
+                        slot = t;
+                        return;
+                }
+        }
+
+        buffer_t *b = trace_buffer();
+        if (b)
+                atomic_store_explicit(&b->name, name, memory_order_relaxed);
+}
+
+/*******************************************************************************************************/
+void trace_event(const char *name, char phase, double value)
+{
+        buffer_t *b = trace_buffer();
+        if (b == NULL)
+                return;
+
+        unsigned long head = atomic_load_explicit(&b->head, memory_order_relaxed);
+        record_t *r = &b->record[head % TRACERECORDS];
+        atomic_store_explicit(&r->time, thread_now(), memory_order_relaxed);
+        atomic_store_explicit(&r->name, name, memory_order_relaxed);
+        atomic_store_explicit(&r->phase, phase, memory_order_relaxed);
+        atomic_store_explicit(&r->value, value, memory_order_relaxed);
+        atomic_store_explicit(&b->head, head + 1, memory_order_release);
+        /* the new head must be visible before the next event starts overwriting the oldest record */
+        atomic_thread_fence(memory_order_release);
+}
+
+/*******************************************************************************************************/
+int trace_dump(const char *filename)
+{
+        FILE *fp = fopen(filename, "w");
+        int count = atomic_load(&threadCount), first = 1;
+
+        if (fp == NULL)
+                return -1;
+
+        fprintf(fp, "{\"traceEvents\":[\n");
+        for (int t = 0; t < count && t < TRACETHREADS; t++)
+        {
+                buffer_t *b = &buffer[t];
+                const char *threadName = atomic_load_explicit(&b->name, memory_order_relaxed);
+                fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", t, threadName ? threadName : "thread");
+                first = 0;
+
+                unsigned long head = atomic_load_explicit(&b->head, memory_order_acquire);
+                unsigned long start = (head > TRACERECORDS ? head - TRACERECORDS : 0);
+                for (unsigned long i = start; i < head; i++)
+                {
+                        record_t *r = &b->record[i % TRACERECORDS];
+                        double time = atomic_load_explicit(&r->time, memory_order_relaxed);
+                        const char *name = atomic_load_explicit(&r->name, memory_order_relaxed);
+                        char phase = atomic_load_explicit(&r->phase, memory_order_relaxed);
+                        float value = atomic_load_explicit(&r->value, memory_order_relaxed);
+
+                        /* the thread continues, skip the event if it is being overwritten or has been in the meantime */
+                        atomic_thread_fence(memory_order_acquire);
+                        if (atomic_load_explicit(&b->head, memory_order_relaxed) >= i + TRACERECORDS)
+                                continue;
+
+                        fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d", name, phase, time * 1e6, t);
+                        if (phase == 'C')
+                                fprintf(fp, ",\"args\":{\"value\":%g}", value);
+                        else if (phase == 'i')
+                                fprintf(fp, ",\"s\":\"t\"");
+                        fprintf(fp, "}");
+                }
+        }
+        fprintf(fp, "\n]}\n");
+
+        return (fclose(fp) ? -1 : 0);
+}
+
+#else
+
+/*******************************************************************************************************/
+void trace_thread(const char *name)
+{
+}
+
+/*******************************************************************************************************/
+void trace_event(const char *name, char phase, double value)
+{
+}
+
+/*******************************************************************************************************/
+int trace_dump(const char *filename)
+{
+        return -1;
+}
+
+#endif
@@ -0,0 +1,48 @@
+/*
+
+   Copyright (C) 2022-2025, Robert Oostenveld
+
+   This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#define TRACETHREADS  (16)      // maximum number of threads or roles that record events
+#define TRACERECORDS  (16384)   // events per thread, the oldest ones are overwritten
+
+/* Trace points on the real-time path, which are only compiled in with TRACE. Each thread writes
+   timestamped events to its own ring buffer, without locks or allocations, and the most recent
+   events of all threads can be exported in the Chrome trace format, which can be opened in
+   Perfetto or chrome://tracing. The names must be string literals. */
+#ifdef TRACE
+#define TRACE_THREAD(name)              trace_thread(name)
+#define TRACE_BEGIN(name)               trace_event(name, 'B', 0)
+#define TRACE_END(name)                 trace_event(name, 'E', 0)
+#define TRACE_INSTANT(name)             trace_event(name, 'i', 0)
+#define TRACE_COUNTER(name, value)      trace_event(name, 'C', value)
+#else
+#define TRACE_THREAD(name)              ((void)0)
+#define TRACE_BEGIN(name)               ((void)0)
+#define TRACE_END(name)                 ((void)0)
+#define TRACE_INSTANT(name)             ((void)0)
+#define TRACE_COUNTER(name, value)      ((void)0)
+#endif
+
+/* Name the calling thread in the trace, a thread with the same name as an earlier one continues
+   in its buffer, hence the name should identify the role of a thread that is only running once. */
+void trace_thread(const char *name);
+
+/* Record an event of the calling thread, the phase is B or E for the begin and end of a duration,
+   i for an instant and C for a counter. */
+void trace_event(const char *name, char phase, double value);
+
+/* Write the recorded events to a JSON file, this returns 0 on success and -1 if the tracing is
+   not compiled in or if the file cannot be written. */
+int trace_dump(const char *filename);
+
+#endif